@@ -618,9 +618,13 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
-/* Should be with all slots_lock held for the address spaces. */
+/*
+ * Should be with all slots_lock held for the address spaces.  @atomic must
+ * be set when several threads reap at the same time.
+ */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
-                                     uint32_t slot_id, uint64_t offset)
+                                     uint32_t slot_id, uint64_t offset,
+                                     bool atomic)
 {
     KVMMemoryListener *kml;
     KVMSlot *mem;
@@ -637,7 +641,11 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    if (atomic) {
+        set_bit_atomic(offset, mem->dirty_bmap);
+    } else {
+        set_bit(offset, mem->dirty_bmap);
+    }
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -674,11 +682,13 @@ static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
  * Should be with all slots_lock held for the address spaces.  It returns the
  * dirty page we've collected on this dirty ring.
  */
-static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu,
+                                        bool atomic)
 {
     struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
     uint32_t ring_size = s->kvm_dirty_ring_size;
     uint32_t count = 0, fetch = cpu->kvm_fetch_index;
+    int64_t stamp;
 
     /*
      * It's possible that we race with vcpu creation code where the vcpu is
@@ -692,13 +702,14 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     assert(dirty_gfns && ring_size);
     trace_kvm_dirty_ring_reap_vcpu(cpu->cpu_index);
 
+    stamp = get_clock();
     while (true) {
         cur = &dirty_gfns[fetch % ring_size];
         if (!dirty_gfn_is_dirtied(cur)) {
             break;
         }
         kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
-                                 cur->offset);
+                                 cur->offset, atomic);
         dirty_gfn_set_collected(cur);
         trace_kvm_dirty_ring_page(cpu->cpu_index, fetch, cur->offset);
         fetch++;
@@ -707,9 +718,87 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     cpu->kvm_fetch_index = fetch;
     cpu->dirty_pages += count;
 
+    if (count) {
+        stamp = get_clock() - stamp;
+        cpu->dirty_ring_reap_ns += stamp;
+        cpu->dirty_ring_reap_max_ns = MAX(cpu->dirty_ring_reap_max_ns, stamp);
+    }
+
     return count;
 }
 
+/*
+ * Reap the rings of the vCPUs whose index is @share modulo the number of
+ * reaper threads.  Every vCPU belongs to exactly one share, so the shares
+ * can be reaped concurrently; the dirty bitmaps are then updated with
+ * atomic operations.
+ */
+static uint64_t kvm_dirty_ring_reap_share(KVMState *s, unsigned int share)
+{
+    unsigned int nr_threads = s->reaper.nr_threads;
+    uint64_t total = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->cpu_index % nr_threads == share) {
+            total += kvm_dirty_ring_reap_one(s, cpu, true);
+        }
+    }
+
+    return total;
+}
+
+static void *kvm_dirty_ring_helper_thread(void *opaque)
+{
+    KVMDirtyRingHelper *h = opaque;
+
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&h->sem);
+        WITH_RCU_READ_LOCK_GUARD() {
+            h->reaped = kvm_dirty_ring_reap_share(h->s, h->share);
+        }
+        qemu_sem_post(&h->s->reaper.helpers_done);
+    }
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/* Must be with slots_lock held */
+static uint64_t kvm_dirty_ring_reap_all(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint64_t total = 0;
+    unsigned int i;
+    CPUState *cpu;
+
+    if (!r->helpers) {
+        CPU_FOREACH(cpu) {
+            total += kvm_dirty_ring_reap_one(s, cpu, false);
+        }
+        return total;
+    }
+
+    for (i = 0; i < r->nr_threads - 1; i++) {
+        qemu_sem_post(&r->helpers[i].sem);
+    }
+
+    /* The caller reaps share 0 while the helpers take the others */
+    total += kvm_dirty_ring_reap_share(s, 0);
+
+    for (i = 0; i < r->nr_threads - 1; i++) {
+        qemu_sem_wait(&r->helpers_done);
+    }
+    for (i = 0; i < r->nr_threads - 1; i++) {
+        total += r->helpers[i].reaped;
+    }
+
+    return total;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -720,11 +809,9 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     stamp = get_clock();
 
     if (cpu) {
-        total = kvm_dirty_ring_reap_one(s, cpu);
+        total = kvm_dirty_ring_reap_one(s, cpu, false);
     } else {
-        CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
-        }
+        total = kvm_dirty_ring_reap_all(s);
     }
 
     if (total) {
@@ -1408,10 +1495,28 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 static void kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
+    unsigned int i;
 
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
                        s, QEMU_THREAD_JOINABLE);
+
+    if (r->nr_threads < 2) {
+        return;
+    }
+
+    qemu_sem_init(&r->helpers_done, 0);
+    r->helpers = g_new0(KVMDirtyRingHelper, r->nr_threads - 1);
+    for (i = 0; i < r->nr_threads - 1; i++) {
+        KVMDirtyRingHelper *h = &r->helpers[i];
+        g_autofree char *name = g_strdup_printf("kvm-reaper/%u", i + 1);
+
+        h->s = s;
+        h->share = i + 1;
+        qemu_sem_init(&h->sem, 0);
+        qemu_thread_create(&h->thread, name, kvm_dirty_ring_helper_thread,
+                           h, QEMU_THREAD_DETACHED);
+    }
 }
 
 static int kvm_dirty_ring_init(KVMState *s)
@@ -2928,6 +3033,7 @@ int kvm_cpu_exec(CPUState *cpu)
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
             bql_lock();
+            cpu->dirty_ring_full_exits++;
             /*
              * We throttle vCPU by making it sleep once it exit from kernel
              * due to dirty ring full. In the dirtylimit scenario, reaping
@@ -3585,6 +3691,39 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->reaper.nr_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "dirty-ring-reapers must be at least 1.");
+        return;
+    }
+
+    s->reaper.nr_threads = value;
+}
+
 static void kvm_accel_instance_init(Object *obj)
 {
     KVMState *s = KVM_STATE(obj);
@@ -3597,6 +3736,7 @@ static void kvm_accel_instance_init(Object *obj)
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
     s->kvm_dirty_ring_with_bitmap = false;
+    s->reaper.nr_threads = 1;
     s->kvm_eager_split_size = 0;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
@@ -3643,6 +3783,12 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reapers", "uint32",
+        kvm_get_dirty_ring_reapers, kvm_set_dirty_ring_reapers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reapers",
+        "Number of threads that reap the KVM dirty rings (default: 1)");
+
     kvm_arch_accel_class_init(oc);
 }
 
@@ -3811,6 +3957,67 @@ exit:
     return list;
 }
 
+/* Statistics that QEMU keeps for each vCPU with the KVM dirty ring */
+static const struct {
+    const char *name;
+    StatsType type;
+    bool nanoseconds;
+    size_t offset;
+} kvm_dirty_ring_vcpu_stats[] = {
+    { "dirty_ring_full_exits", STATS_TYPE_CUMULATIVE, false,
+      offsetof(CPUState, dirty_ring_full_exits) },
+    { "dirty_ring_reap_ns", STATS_TYPE_CUMULATIVE, true,
+      offsetof(CPUState, dirty_ring_reap_ns) },
+    { "dirty_ring_reap_max_ns", STATS_TYPE_PEAK, true,
+      offsetof(CPUState, dirty_ring_reap_max_ns) },
+};
+
+static StatsList *add_dirty_ring_stats(CPUState *cpu, strList *names,
+                                       StatsList *stats_list)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(kvm_dirty_ring_vcpu_stats); i++) {
+        Stats *stats;
+
+        if (!apply_str_list_filter(kvm_dirty_ring_vcpu_stats[i].name, names)) {
+            continue;
+        }
+
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(kvm_dirty_ring_vcpu_stats[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QNUM;
+        stats->value->u.scalar =
+            *(uint64_t *)((void *)cpu + kvm_dirty_ring_vcpu_stats[i].offset);
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    return stats_list;
+}
+
+static StatsSchemaValueList *add_dirty_ring_schema(StatsSchemaValueList *list)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(kvm_dirty_ring_vcpu_stats); i++) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(kvm_dirty_ring_vcpu_stats[i].name);
+        value->type = kvm_dirty_ring_vcpu_stats[i].type;
+        if (kvm_dirty_ring_vcpu_stats[i].nanoseconds) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_SECONDS;
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = -9;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+
+    return list;
+}
+
 /* Cached stats descriptors */
 typedef struct StatsDescriptors {
     const char *ident; /* cache key, currently the StatsTarget */
@@ -3927,6 +4134,10 @@ static void query_stats(StatsResultList **result, StatsTarget target,
         stats_list = add_kvmstat_entry(pdesc, stats, stats_list, errp);
     }
 
+    if (target == STATS_TARGET_VCPU && kvm_state->kvm_dirty_ring_size) {
+        stats_list = add_dirty_ring_stats(cpu, names, stats_list);
+    }
+
     if (!stats_list) {
         return;
     }
@@ -3971,6 +4182,10 @@ static void query_stats_schema(StatsSchemaList **result, StatsTarget target,
         stats_list = add_kvmschema_entry(pdesc, stats_list, errp);
     }
 
+    if (target == STATS_TARGET_VCPU && kvm_state->kvm_dirty_ring_size) {
+        stats_list = add_dirty_ring_schema(stats_list);
+    }
+
     add_stats_schema(result, STATS_PROVIDER_KVM, target, stats_list);
 }
 
@@ -596,7 +596,7 @@ void cpu_exec_step_atomic(CPUState *cpu)
         tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
         if (tb == NULL) {
             mmap_lock();
-            tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
+            tb = tb_gen_code(cpu, pc, cs_base, flags, cflags, 0);
             mmap_unlock();
         }
 
@@ -961,6 +961,52 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 
 /* main execution loop */
 
+static void tb_jmp_cache_set(CPUState *cpu, vaddr pc, TranslationBlock *tb,
+                             uint32_t cflags)
+{
+    uint32_t h = tb_jmp_cache_hash_func(pc);
+    CPUJumpCache *jc = cpu->tb_jmp_cache;
+
+    if (cflags & CF_PCREL) {
+        jc->array[h].pc = pc;
+        /* Ensure pc is written first. */
+        qatomic_store_release(&jc->array[h].tb, tb);
+    } else {
+        /* Use the pc value already stored in tb->pc. */
+        qatomic_set(&jc->array[h].tb, tb);
+    }
+}
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * A TB that spans two pages is never chained to, so each execution of it
+ * comes back through cpu_exec_loop.  Once that happened tb_hot_threshold
+ * times, replace it with a TB that stops at the page boundary: that one
+ * can be chained to, and leaves for the second page with goto_ptr.
+ */
+static TranslationBlock *tb_split_hot(CPUState *cpu, TranslationBlock *tb,
+                                      vaddr pc, uint64_t cs_base,
+                                      uint32_t flags, uint32_t cflags)
+{
+    unsigned int threshold = qatomic_read(&tb_hot_threshold);
+    TranslationBlock *ntb;
+
+    if (!threshold || !tb->icount_page0 || tb->icount_page0 >= tb->icount ||
+        qatomic_fetch_inc(&tb->exec_count) != threshold - 1) {
+        return tb;
+    }
+
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    ntb = tb_gen_code(cpu, pc, cs_base, flags, cflags, tb->icount_page0);
+    mmap_unlock();
+
+    tb_jmp_cache_set(cpu, pc, ntb, cflags);
+    qatomic_inc(&tb_ctx.tb_hot_split_count);
+    return ntb;
+}
+#endif
+
 static int __attribute__((noinline))
 cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
 {
@@ -999,27 +1045,15 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
 
             tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
             if (tb == NULL) {
-                CPUJumpCache *jc;
-                uint32_t h;
-
                 mmap_lock();
-                tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
+                tb = tb_gen_code(cpu, pc, cs_base, flags, cflags, 0);
                 mmap_unlock();
 
                 /*
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
                  */
-                h = tb_jmp_cache_hash_func(pc);
-                jc = cpu->tb_jmp_cache;
-                if (cflags & CF_PCREL) {
-                    jc->array[h].pc = pc;
-                    /* Ensure pc is written first. */
-                    qatomic_store_release(&jc->array[h].tb, tb);
-                } else {
-                    /* Use the pc value already stored in tb->pc. */
-                    qatomic_set(&jc->array[h].tb, tb);
-                }
+                tb_jmp_cache_set(cpu, pc, tb, cflags);
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -1029,6 +1063,9 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
              * direct jump to a TB spanning two pages because the mapping
              * for the second page can change.
              */
+            if (tb_page_addr1(tb) != -1) {
+                tb = tb_split_hot(cpu, tb, pc, cs_base, flags, cflags);
+            }
             if (tb_page_addr1(tb) != -1) {
                 last_tb = NULL;
             }
@@ -237,9 +237,12 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
-    desc->vindex = 0;
+    desc->l2_index = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
-    memset(desc->vtable, -1, sizeof(desc->vtable));
+    if (desc->l2_used) {
+        memset(desc->l2table, -1, CPU_TLB_L2_SIZE * sizeof(CPUTLBEntry));
+        desc->l2_used = 0;
+    }
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
@@ -261,6 +264,9 @@ static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
     fast->mask = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
     fast->table = g_new(CPUTLBEntry, n_entries);
     desc->fulltlb = g_new(CPUTLBEntryFull, n_entries);
+    desc->l2table = NULL;
+    desc->l2fulltlb = NULL;
+    desc->l2_used = 0;
     tlb_mmu_flush_locked(desc, fast);
 }
 
@@ -300,24 +306,87 @@ void tlb_destroy(CPUState *cpu)
 
         g_free(fast->table);
         g_free(desc->fulltlb);
+        g_free(desc->l2table);
+        g_free(desc->l2fulltlb);
     }
 }
 
-/* flush_all_helper: run fn across all cpus
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data);
+
+/**
+ * tlb_flush_queue:
+ * @cpu: cpu on which to flush
+ * @req: range to flush; bits < TARGET_PAGE_BITS flushes the whole mmu_idx
  *
- * If the wait flag is set then the src cpu's helper will be queued as
- * "safe" work and the loop exited creating a synchronisation point
- * where all queued work will be finished before execution starts
- * again.
+ * Queue @req on @cpu, merging it with a pending request for an
+ * overlapping or adjacent range of the same significant bits if there
+ * is one.  The queue is drained by a single work item, which is only
+ * scheduled when the queue goes from empty to non-empty; the kick it
+ * implies makes @cpu apply the flushes at its next TB boundary.
  */
-static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
-                             run_on_cpu_data d)
+static void tlb_flush_queue(CPUState *cpu, const CPUTLBPendingFlush *req)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    uint16_t idxmap;
+    bool coalesced = false;
+    bool schedule;
+    unsigned int i;
+
+    qemu_spin_lock(&c->lock);
+
+    idxmap = req->idxmap & ~c->pending_full;
+    if (idxmap == 0) {
+        coalesced = true;
+    } else if (req->bits < TARGET_PAGE_BITS) {
+        c->pending_full |= idxmap;
+    } else {
+        for (i = 0; i < c->n_pending; i++) {
+            CPUTLBPendingFlush *p = &c->pending[i];
+            vaddr start, end;
+
+            if (p->bits != req->bits ||
+                req->addr > p->addr + p->len ||
+                p->addr > req->addr + req->len) {
+                continue;
+            }
+            start = MIN(p->addr, req->addr);
+            end = MAX(p->addr + p->len, req->addr + req->len);
+            p->addr = start;
+            p->len = end - start;
+            p->idxmap |= idxmap;
+            coalesced = true;
+            break;
+        }
+        if (!coalesced && c->n_pending < CPU_TLB_PENDING_FLUSHES) {
+            c->pending[c->n_pending] = *req;
+            c->pending[c->n_pending].idxmap = idxmap;
+            c->n_pending++;
+        } else if (!coalesced) {
+            tlb_debug("queue full, forcing flush of mmu_map:0x%x\n", idxmap);
+            c->pending_full |= idxmap;
+        }
+    }
+
+    schedule = !c->pending_scheduled;
+    c->pending_scheduled = true;
+    qemu_spin_unlock(&c->lock);
+
+    if (coalesced) {
+        qatomic_set(&c->coalesced_flush_count, c->coalesced_flush_count + 1);
+    }
+    if (schedule) {
+        async_run_on_cpu(cpu, tlb_flush_pending_async_work, RUN_ON_CPU_NULL);
+    }
+}
+
+/* Queue @req on every cpu but @src.  */
+static void tlb_flush_queue_all(CPUState *src, const CPUTLBPendingFlush *req)
 {
     CPUState *cpu;
 
     CPU_FOREACH(cpu) {
         if (cpu != src) {
-            async_run_on_cpu(cpu, fn, d);
+            tlb_flush_queue(cpu, req);
         }
     }
 }
@@ -367,8 +436,9 @@ void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
     tlb_debug("mmu_idx: 0x%" PRIx16 "\n", idxmap);
 
     if (cpu->created && !qemu_cpu_is_self(cpu)) {
-        async_run_on_cpu(cpu, tlb_flush_by_mmuidx_async_work,
-                         RUN_ON_CPU_HOST_INT(idxmap));
+        CPUTLBPendingFlush req = { .idxmap = idxmap };
+
+        tlb_flush_queue(cpu, &req);
     } else {
         tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(idxmap));
     }
@@ -381,12 +451,12 @@ void tlb_flush(CPUState *cpu)
 
 void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, uint16_t idxmap)
 {
-    const run_on_cpu_func fn = tlb_flush_by_mmuidx_async_work;
+    CPUTLBPendingFlush req = { .idxmap = idxmap };
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    fn(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_flush_queue_all(src_cpu, &req);
+    tlb_flush_by_mmuidx_async_work(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
 void tlb_flush_all_cpus(CPUState *src_cpu)
@@ -397,11 +467,16 @@ void tlb_flush_all_cpus(CPUState *src_cpu)
 void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 {
     const run_on_cpu_func fn = tlb_flush_by_mmuidx_async_work;
+    CPUTLBPendingFlush req = { .idxmap = idxmap };
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_flush_queue_all(src_cpu, &req);
+    if (lazy_tlb_sync) {
+        fn(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
+    } else {
+        async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    }
 }
 
 void tlb_flush_all_cpus_synced(CPUState *src_cpu)
@@ -451,26 +526,89 @@ static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry, vaddr page)
     return tlb_flush_entry_mask_locked(tlb_entry, page, -1);
 }
 
-/* Called with tlb_c.lock held */
-static void tlb_flush_vtlb_page_mask_locked(CPUState *cpu, int mmu_idx,
-                                            vaddr page,
-                                            vaddr mask)
+/* Return the index of the first way of the second level tlb set for PAGE. */
+static inline size_t tlb_l2_set(vaddr page)
+{
+    return ((page >> TARGET_PAGE_BITS) & MAKE_64BIT_MASK(0, CPU_TLB_L2_SET_BITS))
+           * CPU_TLB_L2_WAYS;
+}
+
+/* Return the page of a tlb entry that is not empty. */
+static inline vaddr tlb_entry_page(const CPUTLBEntry *te)
+{
+    uint64_t addr = te->addr_read;
+
+    if (addr == -1) {
+        addr = te->addr_write;
+    }
+    if (addr == -1) {
+        addr = te->addr_code;
+    }
+    return addr & TARGET_PAGE_MASK;
+}
+
+/*
+ * Called with tlb_c.lock held.  Entries in the second level tlb are not
+ * counted in n_used_entries, which only tracks the use of the fast tlb.
+ */
+static void tlb_flush_l2_page_mask_locked(CPUState *cpu, int mmu_idx,
+                                          vaddr page,
+                                          vaddr mask)
 {
     CPUTLBDesc *d = &cpu->neg.tlb.d[mmu_idx];
-    int k;
+    vaddr set_mask = MAKE_64BIT_MASK(TARGET_PAGE_BITS, CPU_TLB_L2_SET_BITS);
+    size_t k, first, last;
 
     assert_cpu_is_self(cpu);
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
-        if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
-            tlb_n_used_entries_dec(cpu, mmu_idx);
-        }
+    if (!d->l2_used) {
+        return;
+    }
+
+    if ((mask & set_mask) == set_mask) {
+        /* The set index bits take part in the comparison: only one set. */
+        first = tlb_l2_set(page);
+        last = first + CPU_TLB_L2_WAYS;
+    } else {
+        first = 0;
+        last = CPU_TLB_L2_SIZE;
+    }
+
+    for (k = first; k < last; k++) {
+        tlb_flush_entry_mask_locked(&d->l2table[k], page, mask);
     }
 }
 
-static inline void tlb_flush_vtlb_page_locked(CPUState *cpu, int mmu_idx,
-                                              vaddr page)
+static inline void tlb_flush_l2_page_locked(CPUState *cpu, int mmu_idx,
+                                            vaddr page)
 {
-    tlb_flush_vtlb_page_mask_locked(cpu, mmu_idx, page, -1);
+    tlb_flush_l2_page_mask_locked(cpu, mmu_idx, page, -1);
+}
+
+/* Called with tlb_c.lock held */
+static void tlb_l2_insert_locked(CPUTLBDesc *desc, const CPUTLBEntry *te,
+                                 const CPUTLBEntryFull *full)
+{
+    size_t set, way, k;
+
+    if (!desc->l2table) {
+        desc->l2table = g_new(CPUTLBEntry, CPU_TLB_L2_SIZE);
+        desc->l2fulltlb = g_new(CPUTLBEntryFull, CPU_TLB_L2_SIZE);
+        memset(desc->l2table, -1, CPU_TLB_L2_SIZE * sizeof(CPUTLBEntry));
+    }
+
+    /* Prefer a free way, otherwise replace them in turn. */
+    set = tlb_l2_set(tlb_entry_page(te));
+    way = set + desc->l2_index++ % CPU_TLB_L2_WAYS;
+    for (k = set; k < set + CPU_TLB_L2_WAYS; k++) {
+        if (tlb_entry_is_empty(&desc->l2table[k])) {
+            way = k;
+            break;
+        }
+    }
+
+    desc->l2table[way] = *te;
+    desc->l2fulltlb[way] = *full;
+    desc->l2_used++;
 }
 
 static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
@@ -488,7 +626,7 @@ static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
         if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
             tlb_n_used_entries_dec(cpu, midx);
         }
-        tlb_flush_vtlb_page_locked(cpu, midx, page);
+        tlb_flush_l2_page_locked(cpu, midx, page);
     }
 }
 
@@ -580,22 +718,15 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, vaddr addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
+        CPUTLBPendingFlush req = {
+            .addr = addr,
+            .len = TARGET_PAGE_SIZE,
+            .idxmap = idxmap,
+            .bits = TARGET_LONG_BITS,
+        };
 
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        tlb_flush_queue(cpu, &req);
     }
 }
 
@@ -607,34 +738,18 @@ void tlb_flush_page(CPUState *cpu, vaddr addr)
 void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, vaddr addr,
                                        uint16_t idxmap)
 {
+    CPUTLBPendingFlush req;
+
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-    }
+    req.addr = addr;
+    req.len = TARGET_PAGE_SIZE;
+    req.idxmap = idxmap;
+    req.bits = TARGET_LONG_BITS;
+    tlb_flush_queue_all(src_cpu, &req);
 
     tlb_flush_page_by_mmuidx_async_0(src_cpu, addr, idxmap);
 }
@@ -648,36 +763,34 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               vaddr addr,
                                               uint16_t idxmap)
 {
+    CPUTLBPendingFlush req;
+
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    req.addr = addr;
+    req.len = TARGET_PAGE_SIZE;
+    req.idxmap = idxmap;
+    req.bits = TARGET_LONG_BITS;
+    tlb_flush_queue_all(src_cpu, &req);
+
+    if (lazy_tlb_sync) {
+        tlb_flush_page_by_mmuidx_async_0(src_cpu, addr, idxmap);
+        return;
+    }
+
     /*
      * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
+     * See tlb_flush_page_by_mmuidx_async_1 for details.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
@@ -690,6 +803,50 @@ void tlb_flush_page_all_cpus_synced(CPUState *src, vaddr addr)
     tlb_flush_page_by_mmuidx_all_cpus_synced(src, addr, ALL_MMUIDX_BITS);
 }
 
+/*
+ * Return true if the page of @te matches a page of [@addr, @addr + @len)
+ * under @mask.  @addr and @len must be page aligned.
+ */
+static inline bool tlb_entry_in_range(const CPUTLBEntry *te, vaddr addr,
+                                      vaddr len, vaddr mask)
+{
+    return ((tlb_entry_page(te) - addr) & mask) < len;
+}
+
+/* Called with tlb_c.lock held */
+static void tlb_flush_range_scan_locked(CPUState *cpu, int midx,
+                                        vaddr addr, vaddr len, vaddr mask)
+{
+    CPUTLBDesc *d = &cpu->neg.tlb.d[midx];
+    CPUTLBDescFast *f = &cpu->neg.tlb.f[midx];
+    size_t i, n = tlb_n_entries(f);
+
+    tlb_debug("scanning midx %d ("
+              "%016" VADDR_PRIx "/%016" VADDR_PRIx "+%016" VADDR_PRIx ")\n",
+              midx, addr, mask, len);
+
+    for (i = 0; i < n; i++) {
+        CPUTLBEntry *te = &f->table[i];
+
+        if (!tlb_entry_is_empty(te) &&
+            tlb_entry_in_range(te, addr, len, mask)) {
+            memset(te, -1, sizeof(*te));
+            tlb_n_used_entries_dec(cpu, midx);
+        }
+    }
+
+    if (d->l2_used) {
+        for (i = 0; i < CPU_TLB_L2_SIZE; i++) {
+            CPUTLBEntry *te = &d->l2table[i];
+
+            if (!tlb_entry_is_empty(te) &&
+                tlb_entry_in_range(te, addr, len, mask)) {
+                memset(te, -1, sizeof(*te));
+            }
+        }
+    }
+}
+
 static void tlb_flush_range_locked(CPUState *cpu, int midx,
                                    vaddr addr, vaddr len,
                                    unsigned bits)
@@ -698,24 +855,6 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
     CPUTLBDescFast *f = &cpu->neg.tlb.f[midx];
     vaddr mask = MAKE_64BIT_MASK(0, bits);
 
-    /*
-     * If @bits is smaller than the tlb size, there may be multiple entries
-     * within the TLB; otherwise all addresses that match under @mask hit
-     * the same TLB entry.
-     * TODO: Perhaps allow bits to be a few bits less than the size.
-     * For now, just flush the entire TLB.
-     *
-     * If @len is larger than the tlb size, then it will take longer to
-     * test all of the entries in the TLB than it will to flush it all.
-     */
-    if (mask < f->mask || len > f->mask) {
-        tlb_debug("forcing full flush midx %d ("
-                  "%016" VADDR_PRIx "/%016" VADDR_PRIx "+%016" VADDR_PRIx ")\n",
-                  midx, addr, mask, len);
-        tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
-        return;
-    }
-
     /*
      * Check if we need to flush due to large pages.
      * Because large_page_mask contains all 1's from the msb,
@@ -729,6 +868,19 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
         return;
     }
 
+    /*
+     * If @bits is smaller than the tlb size, there may be multiple entries
+     * within the TLB; otherwise all addresses that match under @mask hit
+     * the same TLB entry.  If @len is larger than the tlb size, probing
+     * page by page would visit the same entries several times.
+     * In both cases walk the TLB once instead, which costs about as much
+     * as flushing it but keeps the entries outside of the range.
+     */
+    if (mask < f->mask || len > f->mask) {
+        tlb_flush_range_scan_locked(cpu, midx, addr, len, mask);
+        return;
+    }
+
     for (vaddr i = 0; i < len; i += TARGET_PAGE_SIZE) {
         vaddr page = addr + i;
         CPUTLBEntry *entry = tlb_entry(cpu, midx, page);
@@ -736,19 +888,12 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
         if (tlb_flush_entry_mask_locked(entry, page, mask)) {
             tlb_n_used_entries_dec(cpu, midx);
         }
-        tlb_flush_vtlb_page_mask_locked(cpu, midx, page, mask);
+        tlb_flush_l2_page_mask_locked(cpu, midx, page, mask);
     }
 }
 
-typedef struct {
-    vaddr addr;
-    vaddr len;
-    uint16_t idxmap;
-    uint16_t bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
-                                              TLBFlushRangeData d)
+                                              CPUTLBPendingFlush d)
 {
     int mmu_idx;
 
@@ -788,16 +933,51 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
 static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
                                               run_on_cpu_data data)
 {
-    TLBFlushRangeData *d = data.host_ptr;
+    CPUTLBPendingFlush *d = data.host_ptr;
     tlb_flush_range_by_mmuidx_async_0(cpu, *d);
     g_free(d);
 }
 
+/*
+ * Apply the flushes queued by tlb_flush_queue.  Requests that arrive
+ * while this runs are queued again and schedule a new work item.
+ */
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    CPUTLBPendingFlush pending[CPU_TLB_PENDING_FLUSHES];
+    unsigned int i, n;
+    uint16_t full;
+
+    assert_cpu_is_self(cpu);
+
+    qemu_spin_lock(&c->lock);
+    full = c->pending_full;
+    n = c->n_pending;
+    memcpy(pending, c->pending, n * sizeof(pending[0]));
+    c->pending_full = 0;
+    c->n_pending = 0;
+    c->pending_scheduled = false;
+    qemu_spin_unlock(&c->lock);
+
+    tlb_debug("pending: mmu_map:0x%x + %u ranges\n", full, n);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (i = 0; i < n; i++) {
+        pending[i].idxmap &= ~full;
+        if (pending[i].idxmap) {
+            tlb_flush_range_by_mmuidx_async_0(cpu, pending[i]);
+        }
+    }
+}
+
 void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
                                vaddr len, uint16_t idxmap,
                                unsigned bits)
 {
-    TLBFlushRangeData d;
+    CPUTLBPendingFlush d;
 
     /*
      * If all bits are significant, and len is small,
@@ -822,10 +1002,7 @@ void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_range_by_mmuidx_async_0(cpu, d);
     } else {
-        /* Otherwise allocate a structure, freed by the worker.  */
-        TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
-                         RUN_ON_CPU_HOST_PTR(p));
+        tlb_flush_queue(cpu, &d);
     }
 }
 
@@ -839,8 +1016,7 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
                                         vaddr addr, vaddr len,
                                         uint16_t idxmap, unsigned bits)
 {
-    TLBFlushRangeData d;
-    CPUState *dst_cpu;
+    CPUTLBPendingFlush d;
 
     /*
      * If all bits are significant, and len is small,
@@ -862,16 +1038,7 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu,
-                             tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
-
+    tlb_flush_queue_all(src_cpu, &d);
     tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
 }
 
@@ -889,8 +1056,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                                uint16_t idxmap,
                                                unsigned bits)
 {
-    TLBFlushRangeData d, *p;
-    CPUState *dst_cpu;
+    CPUTLBPendingFlush d, *p;
 
     /*
      * If all bits are significant, and len is small,
@@ -912,13 +1078,11 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
+    tlb_flush_queue_all(src_cpu, &d);
+
+    if (lazy_tlb_sync) {
+        tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
+        return;
     }
 
     p = g_memdup(&d, sizeof(d));
@@ -1012,6 +1176,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
 
     qemu_spin_lock(&cpu->neg.tlb.c.lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
         unsigned int i;
         unsigned int n = tlb_n_entries(&cpu->neg.tlb.f[mmu_idx]);
 
@@ -1020,9 +1185,11 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                          start1, length);
         }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
-            tlb_reset_dirty_range_locked(&cpu->neg.tlb.d[mmu_idx].vtable[i],
-                                         start1, length);
+        if (desc->l2_used) {
+            for (i = 0; i < CPU_TLB_L2_SIZE; i++) {
+                tlb_reset_dirty_range_locked(&desc->l2table[i],
+                                             start1, length);
+            }
         }
     }
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
@@ -1052,9 +1219,14 @@ void tlb_set_dirty(CPUState *cpu, vaddr addr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_set_dirty1_locked(&cpu->neg.tlb.d[mmu_idx].vtable[k], addr);
+        CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+        size_t k, set = tlb_l2_set(addr);
+
+        if (!desc->l2_used) {
+            continue;
+        }
+        for (k = set; k < set + CPU_TLB_L2_WAYS; k++) {
+            tlb_set_dirty1_locked(&desc->l2table[k], addr);
         }
     }
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
@@ -1213,19 +1385,14 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
     tlb->c.dirty |= 1 << mmu_idx;
 
     /* Make sure there's no cached translation for the new page.  */
-    tlb_flush_vtlb_page_locked(cpu, mmu_idx, addr_page);
+    tlb_flush_l2_page_locked(cpu, mmu_idx, addr_page);
 
     /*
-     * Only evict the old entry to the victim tlb if it's for a
+     * Only evict the old entry to the second level tlb if it's for a
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, addr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
-        CPUTLBEntry *tv = &desc->vtable[vidx];
-
-        /* Evict the old entry into the victim tlb.  */
-        copy_tlb_helper_locked(tv, te);
-        desc->vfulltlb[vidx] = desc->fulltlb[index];
+        tlb_l2_insert_locked(desc, te, &desc->fulltlb[index]);
         tlb_n_used_entries_dec(cpu, mmu_idx);
     }
 
@@ -1357,35 +1524,55 @@ static void io_failed(CPUState *cpu, CPUTLBEntryFull *full, vaddr addr,
     }
 }
 
-/* Return true if ADDR is present in the victim tlb, and has been copied
-   back to the main tlb.  */
-static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
-                           MMUAccessType access_type, vaddr page)
+/* Return true if ADDR is present in the second level tlb, and has been
+   moved to the main tlb.  */
+static bool tlb_l2_hit(CPUState *cpu, size_t mmu_idx, size_t index,
+                       MMUAccessType access_type, vaddr page)
 {
-    size_t vidx;
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    size_t set, k;
 
     assert_cpu_is_self(cpu);
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
-        CPUTLBEntry *vtlb = &cpu->neg.tlb.d[mmu_idx].vtable[vidx];
-        uint64_t cmp = tlb_read_idx(vtlb, access_type);
+    if (!desc->l2_used) {
+        goto miss;
+    }
+
+    set = tlb_l2_set(page);
+    for (k = set; k < set + CPU_TLB_L2_WAYS; k++) {
+        CPUTLBEntry *l2 = &desc->l2table[k];
+        uint64_t cmp = tlb_read_idx(l2, access_type);
 
         if (cmp == page) {
-            /* Found entry in victim tlb, swap tlb and iotlb.  */
+            /*
+             * Found entry in the second level tlb.  The entry it replaces
+             * in the main tlb belongs to the set of its own page.
+             */
             CPUTLBEntry tmptlb, *tlb = &cpu->neg.tlb.f[mmu_idx].table[index];
+            CPUTLBEntryFull tmpf = desc->l2fulltlb[k];
 
             qemu_spin_lock(&cpu->neg.tlb.c.lock);
-            copy_tlb_helper_locked(&tmptlb, tlb);
-            copy_tlb_helper_locked(tlb, vtlb);
-            copy_tlb_helper_locked(vtlb, &tmptlb);
+            copy_tlb_helper_locked(&tmptlb, l2);
+            memset(l2, -1, sizeof(*l2));
+            if (tlb_entry_is_empty(tlb)) {
+                /* The fast tlb gains an entry */
+                tlb_n_used_entries_inc(cpu, mmu_idx);
+            } else {
+                /* Swapped with the demoted entry, the count stays put */
+                tlb_l2_insert_locked(desc, tlb, &desc->fulltlb[index]);
+            }
+            copy_tlb_helper_locked(tlb, &tmptlb);
+            desc->fulltlb[index] = tmpf;
             qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 
-            CPUTLBEntryFull *f1 = &cpu->neg.tlb.d[mmu_idx].fulltlb[index];
-            CPUTLBEntryFull *f2 = &cpu->neg.tlb.d[mmu_idx].vfulltlb[vidx];
-            CPUTLBEntryFull tmpf;
-            tmpf = *f1; *f1 = *f2; *f2 = tmpf;
+            qatomic_set(&cpu->neg.tlb.c.l2_hit_count,
+                        cpu->neg.tlb.c.l2_hit_count + 1);
             return true;
         }
     }
+
+miss:
+    qatomic_set(&cpu->neg.tlb.c.l2_miss_count,
+                cpu->neg.tlb.c.l2_miss_count + 1);
     return false;
 }
 
@@ -1428,7 +1615,7 @@ static int probe_access_internal(CPUState *cpu, vaddr addr,
     CPUTLBEntryFull *full;
 
     if (!tlb_hit_page(tlb_addr, page_addr)) {
-        if (!victim_tlb_hit(cpu, mmu_idx, index, access_type, page_addr)) {
+        if (!tlb_l2_hit(cpu, mmu_idx, index, access_type, page_addr)) {
             if (!cpu->cc->tcg_ops->tlb_fill(cpu, addr, fault_size, access_type,
                                             mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
@@ -1625,7 +1812,7 @@ tb_page_addr_t get_page_addr_code_hostp(CPUArchState *env, vaddr addr,
  * Perform a TLB lookup and populate the qemu_plugin_hwaddr structure.
  * This should be a hot path as we will have just looked this path up
  * in the softmmu lookup code (or helper). We don't handle re-fills or
- * checking the victim table. This is purely informational.
+ * checking the second level tlb. This is purely informational.
  *
  * The one corner case is i/o write, which can cause changes to the
  * address space.  Those changes, and the corresponding tlb flush,
@@ -1708,8 +1895,8 @@ static bool mmu_lookup1(CPUState *cpu, MMULookupPageData *data,
 
     /* If the TLB entry is for a different page, reload and try again.  */
     if (!tlb_hit(tlb_addr, addr)) {
-        if (!victim_tlb_hit(cpu, mmu_idx, index, access_type,
-                            addr & TARGET_PAGE_MASK)) {
+        if (!tlb_l2_hit(cpu, mmu_idx, index, access_type,
+                        addr & TARGET_PAGE_MASK)) {
             tlb_fill(cpu, addr, data->size, access_type, mmu_idx, ra);
             maybe_resized = true;
             index = tlb_index(cpu, mmu_idx, addr);
@@ -1885,8 +2072,8 @@ static void *atomic_mmu_lookup(CPUState *cpu, vaddr addr, MemOpIdx oi,
     /* Check TLB entry and enforce page permissions.  */
     tlb_addr = tlb_addr_write(tlbe);
     if (!tlb_hit(tlb_addr, addr)) {
-        if (!victim_tlb_hit(cpu, mmu_idx, index, MMU_DATA_STORE,
-                            addr & TARGET_PAGE_MASK)) {
+        if (!tlb_l2_hit(cpu, mmu_idx, index, MMU_DATA_STORE,
+                        addr & TARGET_PAGE_MASK)) {
             tlb_fill(cpu, addr, size,
                      MMU_DATA_STORE, mmu_idx, retaddr);
             index = tlb_index(cpu, mmu_idx, addr);
@@ -71,7 +71,7 @@ G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 
 TranslationBlock *tb_gen_code(CPUState *cpu, vaddr pc,
                               uint64_t cs_base, uint32_t flags,
-                              int cflags);
+                              int cflags, int max_insns);
 void page_init(void);
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
@@ -95,6 +95,19 @@ static inline vaddr log_pc(CPUState *cpu, const TranslationBlock *tb)
 
 extern bool one_insn_per_tb;
 
+/*
+ * Don't wait in an exclusive section for the other vCPUs to apply the
+ * *_all_cpus_synced flushes; they do so at their next TB boundary.
+ */
+extern bool lazy_tlb_sync;
+
+/*
+ * Number of entries from the main loop after which a TB that spans two
+ * pages, and therefore cannot be chained to, is retranslated to stop at
+ * the page boundary.  0 disables this.
+ */
+extern unsigned int tb_hot_threshold;
+
 /**
  * tcg_req_mo:
  * @type: TCGBar
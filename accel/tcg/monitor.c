@@ -126,19 +126,42 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
-static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
+static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide,
+                             size_t *pcoalesced)
 {
     CPUState *cpu;
-    size_t full = 0, part = 0, elide = 0;
+    size_t full = 0, part = 0, elide = 0, coalesced = 0;
 
     CPU_FOREACH(cpu) {
         full += qatomic_read(&cpu->neg.tlb.c.full_flush_count);
         part += qatomic_read(&cpu->neg.tlb.c.part_flush_count);
         elide += qatomic_read(&cpu->neg.tlb.c.elide_flush_count);
+        coalesced += qatomic_read(&cpu->neg.tlb.c.coalesced_flush_count);
     }
     *pfull = full;
     *ppart = part;
     *pelide = elide;
+    *pcoalesced = coalesced;
+}
+
+static void dump_tlb_l2_info(GString *buf)
+{
+    CPUState *cpu;
+    size_t hits = 0, misses = 0;
+
+    CPU_FOREACH(cpu) {
+        hits += qatomic_read(&cpu->neg.tlb.c.l2_hit_count);
+        misses += qatomic_read(&cpu->neg.tlb.c.l2_miss_count);
+    }
+    g_string_append_printf(buf, "TLB L2 hits         %zu\n", hits);
+    g_string_append_printf(buf, "TLB L2 misses       %zu\n", misses);
+
+    CPU_FOREACH(cpu) {
+        g_string_append_printf(buf, "  cpu %-3d L2 hits %zu misses %zu\n",
+                               cpu->cpu_index,
+                               qatomic_read(&cpu->neg.tlb.c.l2_hit_count),
+                               qatomic_read(&cpu->neg.tlb.c.l2_miss_count));
+    }
 }
 
 static void tcg_dump_info(GString *buf)
@@ -150,7 +173,7 @@ static void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
-    size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t nb_tbs, flush_full, flush_part, flush_elide, flush_coalesced;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -191,11 +214,16 @@ static void dump_exec_info(GString *buf)
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    g_string_append_printf(buf, "TB hot split count  %u\n",
+                           qatomic_read(&tb_ctx.tb_hot_split_count));
 
-    tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
+    tlb_flush_counts(&flush_full, &flush_part, &flush_elide,
+                     &flush_coalesced);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    g_string_append_printf(buf, "TLB merged flushes  %zu\n", flush_coalesced);
+    dump_tlb_l2_info(buf);
     tcg_dump_info(buf);
 }
 
@@ -217,7 +245,7 @@ HumanReadableText *qmp_x_query_jit(Error **errp)
 
 static void tcg_dump_op_count(GString *buf)
 {
-    g_string_append_printf(buf, "[TCG profiler not compiled]\n");
+    tcg_dump_op_stats(buf);
 }
 
 HumanReadableText *qmp_x_query_opcount(Error **errp)
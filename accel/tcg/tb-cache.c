@@ -0,0 +1,623 @@
+/*
+ * Persistent translation block cache
+ *
+ * The host code of the TBs generated during a run is written to a file
+ * when QEMU exits, and mapped back on the next run of the same QEMU binary
+ * so that guest code that has not changed in between does not need to be
+ * translated again.
+ *
+ * Entries are looked up by the usual TB key extended with the CPU
+ * configuration, and only used if the guest code bytes they were generated
+ * from are identical to the ones in guest memory.  The few host addresses
+ * outside the TB that the code embeds are patched using the relocations
+ * recorded by the TCG backend.
+ *
+ * The file holds host code that is executed as is, so it must be as
+ * trusted as the QEMU binary itself.  The checks below only guard against
+ * files from other QEMU builds, hosts and guests, not against tampering.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cacheflush.h"
+#include "qemu/cacheinfo.h"
+#include "qemu/crc32c.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
+#include "qemu/xxhash.h"
+#include "qapi/error.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "qemu/plugin.h"
+#include "tcg/tcg.h"
+#include "host/cpuinfo.h"
+#include "elf.h"
+#include "tb-cache.h"
+#include "trace.h"
+
+#define TB_CACHE_MAGIC      0x4548434143425451ULL     /* "QTBCACHE" */
+#define TB_CACHE_VERSION    2
+
+/* Upper bound for the size of the file.  */
+#define TB_CACHE_MAX_SIZE   (512 * MiB)
+
+typedef struct TBCacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t nb_entries;
+    /* Everything below must match the running QEMU.  */
+    char qemu_version[32];
+    char target[16];
+    uint64_t exe_size;
+    int64_t exe_mtime;
+    int64_t anchor_offset;      /* tb_cache_init() - tcg_tbc_anchor() */
+    uint64_t cpuinfo;
+    uint32_t icache_linesize;
+    uint32_t tb_struct_size;
+    uint8_t build_id[32];       /* GNU build ID of the binary, if any */
+    /* Checked on use, since it is only known once the guest is loaded.  */
+    uint64_t guest_base;
+} TBCacheHeader;
+
+/*
+ * Each entry is followed by the guest code, the relocations and the host
+ * code with its search data, each part padded to 8 bytes.
+ */
+typedef struct TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t cpu_type;          /* hash of the CPU's QOM type name */
+    uint32_t guest_size;
+    uint32_t code_size;
+    uint32_t search_size;
+    uint16_t icount;
+    uint16_t nb_relocs;
+    uint16_t jmp_reset_offset[2];
+    uint16_t jmp_insn_offset[2];
+    uint32_t cpu_config;        /* see tb_cache_cpu_config() */
+} TBCacheEntry;
+
+QEMU_BUILD_BUG_ON(sizeof(TBCacheHeader) % 8);
+QEMU_BUILD_BUG_ON(sizeof(TBCacheEntry) % 8);
+QEMU_BUILD_BUG_ON(sizeof(TCGTBCacheReloc) % 8);
+
+bool tb_cache_enabled;
+
+static struct {
+    char *path;
+    QemuMutex lock;
+
+    /* The file loaded at startup; read-only after tb_cache_init().  */
+    const void *map;
+    size_t map_size;
+    uint32_t nb_loaded;
+    uint64_t loaded_guest_base;
+    GHashTable *entries;        /* TBCacheEntry -> GSList of TBCacheEntry */
+
+    /* Entries for TBs generated during this run, protected by @lock.  */
+    GByteArray *new_data;
+    uint32_t nb_new;
+
+    uint64_t hits;
+    uint64_t misses;
+} tbc;
+
+static inline size_t tb_cache_entry_guest_size(const TBCacheEntry *e)
+{
+    return ROUND_UP(e->guest_size, 8);
+}
+
+static inline size_t tb_cache_entry_relocs_size(const TBCacheEntry *e)
+{
+    return e->nb_relocs * sizeof(TCGTBCacheReloc);
+}
+
+static inline size_t tb_cache_entry_code_size(const TBCacheEntry *e)
+{
+    return ROUND_UP((size_t)e->code_size + e->search_size, 8);
+}
+
+static inline size_t tb_cache_entry_size(const TBCacheEntry *e)
+{
+    return sizeof(*e) + tb_cache_entry_guest_size(e) +
+           tb_cache_entry_relocs_size(e) + tb_cache_entry_code_size(e);
+}
+
+static inline const uint8_t *tb_cache_entry_guest(const TBCacheEntry *e)
+{
+    return (const uint8_t *)(e + 1);
+}
+
+static inline const TCGTBCacheReloc *
+tb_cache_entry_relocs(const TBCacheEntry *e)
+{
+    return (const void *)(tb_cache_entry_guest(e) +
+                          tb_cache_entry_guest_size(e));
+}
+
+static inline const uint8_t *tb_cache_entry_code(const TBCacheEntry *e)
+{
+    return (const uint8_t *)tb_cache_entry_relocs(e) +
+           tb_cache_entry_relocs_size(e);
+}
+
+static guint tb_cache_entry_hash(gconstpointer p)
+{
+    const TBCacheEntry *e = p;
+
+    return qemu_xxhash7(e->pc, e->cs_base, e->flags, e->cflags,
+                        e->cpu_type ^ e->cpu_config);
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *ea = a, *eb = b;
+
+    return ea->pc == eb->pc && ea->cs_base == eb->cs_base &&
+           ea->flags == eb->flags && ea->cflags == eb->cflags &&
+           ea->cpu_type == eb->cpu_type && ea->cpu_config == eb->cpu_config;
+}
+
+/*
+ * Hash the CPU configuration that translation depends on but that is not
+ * part of the TB flags, i.e. the features of the CPU model as adjusted on
+ * the command line.  The same CPU type can be configured differently.
+ */
+static uint32_t tb_cache_cpu_config(CPUState *cpu)
+{
+#if defined(TARGET_I386)
+    CPUX86State *env = cpu_env(cpu);
+
+    return crc32c(0xffffffff, (const uint8_t *)env->features,
+                  sizeof(env->features));
+#elif defined(TARGET_ARM)
+    ARMCPU *arm_cpu = ARM_CPU(cpu);
+    uint32_t crc;
+
+    crc = crc32c(0xffffffff, (const uint8_t *)&arm_cpu->isar,
+                 sizeof(arm_cpu->isar));
+    return crc32c(crc, (const uint8_t *)&arm_cpu->env.features,
+                  sizeof(arm_cpu->env.features));
+#elif defined(TARGET_RISCV)
+    RISCVCPU *riscv_cpu = RISCV_CPU(cpu);
+    CPURISCVState *env = &riscv_cpu->env;
+    RISCVCPUConfig cfg;
+    uint32_t crc;
+
+    /* The spec strings differ from run to run, their values are in env */
+    memcpy(&cfg, &riscv_cpu->cfg, sizeof(cfg));
+    cfg.priv_spec = cfg.user_spec = cfg.bext_spec = cfg.vext_spec = NULL;
+    crc = crc32c(0xffffffff, (const uint8_t *)&cfg, sizeof(cfg));
+    crc = crc32c(crc, (const uint8_t *)&env->misa_ext, sizeof(env->misa_ext));
+    crc = crc32c(crc, (const uint8_t *)&env->priv_ver, sizeof(env->priv_ver));
+    return crc32c(crc, (const uint8_t *)&env->vext_ver, sizeof(env->vext_ver));
+#else
+    /* Only the CPU type and the TB flags tell CPUs apart */
+    return 0;
+#endif
+}
+
+static void tb_cache_entry_key(TBCacheEntry *e, CPUState *cpu,
+                               const TranslationBlock *tb, vaddr pc)
+{
+    memset(e, 0, sizeof(*e));
+    e->pc = pc;
+    e->cs_base = tb->cs_base;
+    e->flags = tb->flags;
+    e->cflags = tb->cflags;
+    e->cpu_type = g_str_hash(object_get_typename(OBJECT(cpu)));
+    e->cpu_config = tb_cache_cpu_config(cpu);
+}
+
+static uint64_t tb_cache_guest_base(void)
+{
+#ifdef CONFIG_USER_ONLY
+    return guest_base;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Copy the GNU build ID of the QEMU executable to @buf, which must be
+ * zeroed.  It changes whenever QEMU is built from other sources or with
+ * other options, unlike the size and modification time of the file.
+ */
+static void tb_cache_build_id(uint8_t *buf, size_t size)
+{
+    const Elf64_Phdr *phdr = (const void *)qemu_getauxval(AT_PHDR);
+    unsigned long phnum = qemu_getauxval(AT_PHNUM);
+    uintptr_t bias = 0;
+    unsigned long i;
+
+    if (!phdr) {
+        return;
+    }
+    for (i = 0; i < phnum; i++) {
+        if (phdr[i].p_type == PT_PHDR) {
+            bias = (uintptr_t)phdr - phdr[i].p_vaddr;
+        }
+    }
+    for (i = 0; i < phnum; i++) {
+        const void *p = (const void *)(bias + phdr[i].p_vaddr);
+        const void *end = p + phdr[i].p_memsz;
+
+        if (phdr[i].p_type != PT_NOTE) {
+            continue;
+        }
+        while (p + sizeof(Elf64_Nhdr) <= end) {
+            const Elf64_Nhdr *n = p;
+            const void *name = n + 1;
+            const void *desc = name + ROUND_UP(n->n_namesz, 4);
+
+            if (n->n_type == NT_GNU_BUILD_ID && n->n_namesz == 4 &&
+                !memcmp(name, "GNU", 4) && desc + n->n_descsz <= end) {
+                memcpy(buf, desc, MIN(n->n_descsz, size));
+                return;
+            }
+            p = desc + ROUND_UP(n->n_descsz, 4);
+        }
+    }
+}
+
+/*
+ * Fill in the parts of the header that identify the running QEMU.  The
+ * generated code depends on the layout of QEMU's data structures, on the
+ * host features it was generated for and on the relative position of the
+ * helpers, so only accept files from this exact binary.
+ */
+static bool tb_cache_header_init(TBCacheHeader *h)
+{
+    struct stat st;
+
+    memset(h, 0, sizeof(*h));
+    if (stat("/proc/self/exe", &st) < 0) {
+        return false;
+    }
+
+    h->magic = TB_CACHE_MAGIC;
+    h->version = TB_CACHE_VERSION;
+    pstrcpy(h->qemu_version, sizeof(h->qemu_version), QEMU_VERSION);
+    pstrcpy(h->target, sizeof(h->target), TARGET_NAME);
+    h->exe_size = st.st_size;
+    h->exe_mtime = st.st_mtime;
+    h->anchor_offset = (uintptr_t)tb_cache_init - tcg_tbc_anchor();
+    h->cpuinfo = cpuinfo;
+    h->icache_linesize = qemu_icache_linesize;
+    h->tb_struct_size = sizeof(TranslationBlock);
+    tb_cache_build_id(h->build_id, sizeof(h->build_id));
+    h->guest_base = tb_cache_guest_base();
+    return true;
+}
+
+static bool tb_cache_parse(const void *map, size_t size, const char **reason)
+{
+    const TBCacheHeader *h = map;
+    TBCacheHeader expected;
+    size_t offset = sizeof(*h);
+    uint32_t i;
+
+    if (size < sizeof(*h) || h->magic != TB_CACHE_MAGIC ||
+        h->version != TB_CACHE_VERSION) {
+        *reason = "not a TB cache file";
+        return false;
+    }
+    if (!tb_cache_header_init(&expected)) {
+        *reason = "cannot identify the QEMU binary";
+        return false;
+    }
+    expected.nb_entries = h->nb_entries;
+    expected.guest_base = h->guest_base;
+    if (memcmp(h, &expected, sizeof(*h))) {
+        *reason = "written by a different QEMU binary or host";
+        return false;
+    }
+
+    for (i = 0; i < h->nb_entries; i++) {
+        const TBCacheEntry *e = map + offset;
+        GSList *l;
+
+        if (size - offset < sizeof(*e) ||
+            size - offset < tb_cache_entry_size(e)) {
+            *reason = "truncated";
+            return false;
+        }
+        if (e->guest_size == 0 || e->guest_size > TARGET_PAGE_SIZE ||
+            e->code_size == 0 || e->code_size > UINT16_MAX) {
+            *reason = "corrupted";
+            return false;
+        }
+        offset += tb_cache_entry_size(e);
+
+        /* Keep the list head, which is the value stored in the table.  */
+        l = g_hash_table_lookup(tbc.entries, e);
+        if (l) {
+            g_slist_insert(l, (gpointer)e, 1);
+        } else {
+            g_hash_table_insert(tbc.entries, (gpointer)e,
+                                g_slist_prepend(NULL, (gpointer)e));
+        }
+    }
+
+    tbc.nb_loaded = h->nb_entries;
+    tbc.loaded_guest_base = h->guest_base;
+    return true;
+}
+
+static void tb_cache_load(void)
+{
+    const char *reason;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(tbc.path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0 ||
+        st.st_size > TB_CACHE_MAX_SIZE) {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    if (!tb_cache_parse(map, st.st_size, &reason)) {
+        trace_tb_cache_reject(tbc.path, reason);
+        g_hash_table_remove_all(tbc.entries);
+        munmap(map, st.st_size);
+        return;
+    }
+
+    tbc.map = map;
+    tbc.map_size = st.st_size;
+    trace_tb_cache_load(tbc.path, tbc.nb_loaded);
+}
+
+static bool tb_cache_write(int fd)
+{
+    TBCacheHeader h;
+    bool keep_old;
+
+    keep_old = tbc.map && tbc.loaded_guest_base == tb_cache_guest_base();
+    if (!tb_cache_header_init(&h)) {
+        return false;
+    }
+    h.nb_entries = tbc.nb_new + (keep_old ? tbc.nb_loaded : 0);
+
+    if (qemu_write_full(fd, &h, sizeof(h)) != sizeof(h)) {
+        return false;
+    }
+    if (keep_old) {
+        size_t len = tbc.map_size - sizeof(h);
+
+        if (qemu_write_full(fd, tbc.map + sizeof(h), len) != len) {
+            return false;
+        }
+    }
+    return qemu_write_full(fd, tbc.new_data->data, tbc.new_data->len) ==
+           tbc.new_data->len;
+}
+
+/*
+ * Write the new entries, after the loaded ones, to a temporary file and
+ * rename it over the old one, so that concurrent QEMU processes using the
+ * same cache each see a consistent file.
+ */
+void tb_cache_save(void)
+{
+    g_autofree char *tmp = g_strdup_printf("%s.XXXXXX", tbc.path);
+    int fd;
+
+    QEMU_LOCK_GUARD(&tbc.lock);
+
+    trace_tb_cache_save(tbc.path, tbc.nb_new, qatomic_read(&tbc.hits),
+                        qatomic_read(&tbc.misses));
+    if (!tbc.nb_new) {
+        return;
+    }
+
+    fd = g_mkstemp(tmp);
+    if (fd < 0) {
+        warn_report("tb-cache: cannot create %s: %s", tmp, strerror(errno));
+        return;
+    }
+    if (!tb_cache_write(fd) || qemu_fdatasync(fd) < 0) {
+        warn_report("tb-cache: cannot write %s: %s", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    close(fd);
+    if (rename(tmp, tbc.path) < 0) {
+        warn_report("tb-cache: cannot rename %s to %s: %s",
+                    tmp, tbc.path, strerror(errno));
+        unlink(tmp);
+        return;
+    }
+
+    /* Saved, a second call (e.g. from atexit) has nothing left to do */
+    tbc.nb_new = 0;
+    g_byte_array_set_size(tbc.new_data, 0);
+}
+
+bool tb_cache_init(const char *path, Error **errp)
+{
+    if (tb_cache_enabled) {
+        error_setg(errp, "the TB cache is already initialized");
+        return false;
+    }
+
+    tbc.path = g_strdup(path);
+    qemu_mutex_init(&tbc.lock);
+    tbc.entries = g_hash_table_new_full(tb_cache_entry_hash,
+                                        tb_cache_entry_equal, NULL,
+                                        (GDestroyNotify)g_slist_free);
+    tbc.new_data = g_byte_array_new();
+
+    /* An unusable file is not an error, it is simply replaced on exit. */
+    tb_cache_load();
+    atexit(tb_cache_save);
+
+    tb_cache_enabled = true;
+    return true;
+}
+
+bool tb_cache_active(CPUState *cpu)
+{
+    if (!tb_cache_enabled) {
+        return false;
+    }
+#ifdef CONFIG_PLUGIN
+    /* Instrumentation is inserted at translation time.  */
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+static void tb_cache_relocate(const TBCacheEntry *e, tcg_insn_unit *buf)
+{
+    const TCGTBCacheReloc *r = tb_cache_entry_relocs(e);
+    const void *rx = tcg_splitwx_to_rx(buf);
+    int i;
+
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        void *site = (void *)buf + r->offset;
+        int64_t val;
+
+        switch (r->kind) {
+        case TCG_TBC_RELOC_ABS64:
+            stq_he_p(site, tcg_tbc_anchor() + r->addend);
+            break;
+        case TCG_TBC_RELOC_PC32_EPILOGUE:
+            val = (tcg_code_gen_epilogue + r->addend) -
+                  (rx + r->offset + 4);
+            stl_he_p(site, val);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+}
+
+static bool tb_cache_entry_valid(const TBCacheEntry *e, vaddr pc)
+{
+    const TCGTBCacheReloc *r = tb_cache_entry_relocs(e);
+    int i;
+
+    if ((pc & ~TARGET_PAGE_MASK) + e->guest_size > TARGET_PAGE_SIZE) {
+        return false;
+    }
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        size_t len = r->kind == TCG_TBC_RELOC_ABS64 ? 8 : 4;
+
+        if (r->kind > TCG_TBC_RELOC_PC32_EPILOGUE ||
+            (size_t)r->offset + len > e->code_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int tb_cache_restore(CPUState *cpu, TranslationBlock *tb, vaddr pc,
+                     const void *host_pc, tcg_insn_unit *buf,
+                     int *search_size)
+{
+    TBCacheEntry key;
+    GSList *l;
+
+    if (!tbc.map || tbc.loaded_guest_base != tb_cache_guest_base()) {
+        return -1;
+    }
+
+    tb_cache_entry_key(&key, cpu, tb, pc);
+    for (l = g_hash_table_lookup(tbc.entries, &key); l; l = l->next) {
+        const TBCacheEntry *e = l->data;
+        size_t len = (size_t)e->code_size + e->search_size;
+
+        if (!tb_cache_entry_valid(e, pc) ||
+            memcmp(host_pc, tb_cache_entry_guest(e), e->guest_size)) {
+            continue;
+        }
+        if ((void *)buf + len > tcg_ctx->code_gen_highwater) {
+            /* Let translation deal with the overflow.  */
+            break;
+        }
+
+        memcpy(buf, tb_cache_entry_code(e), len);
+        tb_cache_relocate(e, buf);
+        flush_idcache_range((uintptr_t)tcg_splitwx_to_rx(buf),
+                            (uintptr_t)buf, e->code_size);
+
+        tb->size = e->guest_size;
+        tb->icount = e->icount;
+        tb->jmp_reset_offset[0] = e->jmp_reset_offset[0];
+        tb->jmp_reset_offset[1] = e->jmp_reset_offset[1];
+        tb->jmp_insn_offset[0] = e->jmp_insn_offset[0];
+        tb->jmp_insn_offset[1] = e->jmp_insn_offset[1];
+
+        qatomic_inc(&tbc.hits);
+        *search_size = e->search_size;
+        return e->code_size;
+    }
+
+    qatomic_inc(&tbc.misses);
+    return -1;
+}
+
+static void tb_cache_append(const void *data, size_t len)
+{
+    static const uint8_t zero[8];
+
+    g_byte_array_append(tbc.new_data, data, len);
+    if (len % 8) {
+        g_byte_array_append(tbc.new_data, zero, 8 - len % 8);
+    }
+}
+
+void tb_cache_record(CPUState *cpu, const TranslationBlock *tb, vaddr pc,
+                     const void *host_pc, const tcg_insn_unit *buf,
+                     int code_size, int search_size)
+{
+    TCGContext *s = tcg_ctx;
+    TBCacheEntry e;
+
+    /* Only TBs that are entirely described by one page of guest code.  */
+    if (s->tbc_unsafe || tb_page_addr1(tb) != -1 ||
+        (pc & ~TARGET_PAGE_MASK) + tb->size > TARGET_PAGE_SIZE) {
+        return;
+    }
+
+    tb_cache_entry_key(&e, cpu, tb, pc);
+    e.guest_size = tb->size;
+    e.code_size = code_size;
+    e.search_size = search_size;
+    e.icount = tb->icount;
+    e.nb_relocs = s->tbc_nb_relocs;
+    e.jmp_reset_offset[0] = tb->jmp_reset_offset[0];
+    e.jmp_reset_offset[1] = tb->jmp_reset_offset[1];
+    e.jmp_insn_offset[0] = tb->jmp_insn_offset[0];
+    e.jmp_insn_offset[1] = tb->jmp_insn_offset[1];
+
+    QEMU_LOCK_GUARD(&tbc.lock);
+
+    if (tbc.map_size + tbc.new_data->len + tb_cache_entry_size(&e) >
+        TB_CACHE_MAX_SIZE) {
+        return;
+    }
+    tb_cache_append(&e, sizeof(e));
+    tb_cache_append(host_pc, e.guest_size);
+    tb_cache_append(s->tbc_relocs, tb_cache_entry_relocs_size(&e));
+    tb_cache_append(buf, (size_t)code_size + search_size);
+    tbc.nb_new++;
+}
@@ -0,0 +1,80 @@
+/*
+ * Persistent translation block cache
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_TB_CACHE_H
+#define ACCEL_TCG_TB_CACHE_H
+
+#include "qapi/error.h"
+#include "tcg/tcg.h"
+
+#if TCG_TARGET_HAS_TB_CACHE
+extern bool tb_cache_enabled;
+
+/*
+ * Load the TB cache from @path, if it exists and was written by this
+ * very QEMU binary on a compatible host, and write it back on exit.
+ */
+bool tb_cache_init(const char *path, Error **errp);
+
+/*
+ * Write the TBs generated so far to the cache file.  Called on exit, and
+ * by linux-user before exiting without running atexit handlers.
+ */
+void tb_cache_save(void);
+
+/* Return true if TBs for @cpu may be loaded from and saved to the cache. */
+bool tb_cache_active(CPUState *cpu);
+
+/*
+ * Look up code for @tb, whose guest code starts at @host_pc, and copy it
+ * to @buf.  Return the size of the code and store the size of the search
+ * data that follows it in @search_size, or return -1 on a miss.
+ */
+int tb_cache_restore(CPUState *cpu, TranslationBlock *tb, vaddr pc,
+                     const void *host_pc, tcg_insn_unit *buf,
+                     int *search_size);
+
+/*
+ * Add @tb, which tcg_ctx has just generated at @buf, to the cache.
+ * @code_size and @search_size are as returned by tb_cache_restore().
+ */
+void tb_cache_record(CPUState *cpu, const TranslationBlock *tb, vaddr pc,
+                     const void *host_pc, const tcg_insn_unit *buf,
+                     int code_size, int search_size);
+#else
+#define tb_cache_enabled false
+
+static inline bool tb_cache_init(const char *path, Error **errp)
+{
+    error_setg(errp, "the TB cache is not supported on this host");
+    return false;
+}
+
+static inline void tb_cache_save(void)
+{
+}
+
+static inline bool tb_cache_active(CPUState *cpu)
+{
+    return false;
+}
+
+static inline int tb_cache_restore(CPUState *cpu, TranslationBlock *tb,
+                                   vaddr pc, const void *host_pc,
+                                   tcg_insn_unit *buf, int *search_size)
+{
+    return -1;
+}
+
+static inline void tb_cache_record(CPUState *cpu, const TranslationBlock *tb,
+                                   vaddr pc, const void *host_pc,
+                                   const tcg_insn_unit *buf,
+                                   int code_size, int search_size)
+{
+}
+#endif
+
+#endif
@@ -39,14 +39,19 @@
 #include "hw/boards.h"
 #endif
 #include "internal-target.h"
+#include "tb-cache.h"
 
 struct TCGState {
     AccelState parent_obj;
 
     bool mttcg_enabled;
     bool one_insn_per_tb;
+    bool lazy_tlb_sync;
+    bool op_stats;
+    uint32_t hot_tb_threshold;
     int splitwx_enabled;
     unsigned long tb_size;
+    char *tb_cache_path;
 };
 typedef struct TCGState TCGState;
 
@@ -99,6 +104,8 @@ static void tcg_accel_instance_init(Object *obj)
 
 bool mttcg_enabled;
 bool one_insn_per_tb;
+bool lazy_tlb_sync;
+unsigned int tb_hot_threshold;
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -111,11 +118,23 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    lazy_tlb_sync = s->lazy_tlb_sync;
+    tcg_op_stats_enabled = s->op_stats;
+    tb_hot_threshold = s->hot_tb_threshold;
 
     page_init();
     tb_htable_init();
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
 
+    if (s->tb_cache_path) {
+        Error *local_err = NULL;
+
+        if (!tb_cache_init(s->tb_cache_path, &local_err)) {
+            error_report_err(local_err);
+            return -EINVAL;
+        }
+    }
+
 #if defined(CONFIG_SOFTMMU)
     /*
      * There's no guest base to take into account, so go ahead and
@@ -181,6 +200,34 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_hot_tb_threshold(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->hot_tb_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_hot_tb_threshold(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > UINT16_MAX) {
+        error_setg(errp, "hot-tb-threshold must be at most %u", UINT16_MAX);
+        return;
+    }
+
+    s->hot_tb_threshold = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -193,6 +240,21 @@ static void tcg_set_splitwx(Object *obj, bool value, Error **errp)
     s->splitwx_enabled = value;
 }
 
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache_path);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache_path);
+    s->tb_cache_path = *value ? g_strdup(value) : NULL;
+}
+
 static bool tcg_get_one_insn_per_tb(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -207,6 +269,34 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+static bool tcg_get_lazy_tlb_sync(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->lazy_tlb_sync;
+}
+
+static void tcg_set_lazy_tlb_sync(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->lazy_tlb_sync = value;
+}
+
+static bool tcg_get_op_stats(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->op_stats;
+}
+
+static void tcg_set_op_stats(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->op_stats = value;
+}
+
 static int tcg_gdbstub_supported_sstep_flags(void)
 {
     /*
@@ -252,6 +342,29 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+    object_class_property_add_bool(oc, "lazy-tlb-sync",
+                                   tcg_get_lazy_tlb_sync,
+                                   tcg_set_lazy_tlb_sync);
+    object_class_property_set_description(oc, "lazy-tlb-sync",
+        "Let vCPUs apply broadcast TLB invalidations at their next TB");
+
+    object_class_property_add_bool(oc, "op-stats",
+                                   tcg_get_op_stats,
+                                   tcg_set_op_stats);
+    object_class_property_set_description(oc, "op-stats",
+        "Collect translation statistics for 'info opcount'");
+
+    object_class_property_add(oc, "hot-tb-threshold", "int",
+        tcg_get_hot_tb_threshold, tcg_set_hot_tb_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "hot-tb-threshold",
+        "Executions after which a TB spanning two pages is split");
+
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache, tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "File used to keep translated code across runs");
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -64,6 +64,7 @@
 #include "internal-common.h"
 #include "internal-target.h"
 #include "perf.h"
+#include "tb-cache.h"
 #include "tcg/insn-start-words.h"
 
 TBContext tb_ctx;
@@ -284,16 +285,21 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
+/*
+ * Called with mmap_lock held for user mode emulation.
+ * If @max_insns is not 0, it limits the number of insns below what
+ * @cflags allows, without changing the key used to look up the TB.
+ */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               vaddr pc, uint64_t cs_base,
-                              uint32_t flags, int cflags)
+                              uint32_t flags, int cflags, int max_insns)
 {
     CPUArchState *env = cpu_env(cpu);
     TranslationBlock *tb, *existing_tb;
     tb_page_addr_t phys_pc, phys_p2;
     tcg_insn_unit *gen_code_buf;
-    int gen_code_size, search_size, max_insns;
+    int gen_code_size, search_size;
+    bool limited = max_insns != 0;
     int64_t ti;
     void *host_pc;
 
@@ -305,9 +311,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (phys_pc == -1) {
         /* Generate a one-shot TB with 1 insn in it */
         cflags = (cflags & ~CF_COUNT_MASK) | 1;
+        max_insns = 0;
     }
 
-    max_insns = cflags & CF_COUNT_MASK;
+    if (max_insns == 0) {
+        max_insns = cflags & CF_COUNT_MASK;
+    }
     if (max_insns == 0) {
         max_insns = TCG_MAX_INSNS;
     }
@@ -333,6 +342,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->icount_page0 = 0;
+    tb->exec_count = 0;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     if (phys_pc != -1) {
@@ -353,8 +364,22 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tcg_ctx->guest_mo = TCG_MO_ALL;
 #endif
 
+    tcg_ctx->tbc_record = false;
+    if (tb_cache_enabled && phys_pc != -1 && tb_cache_active(cpu) && !limited) {
+        gen_code_size = tb_cache_restore(cpu, tb, pc, host_pc, gen_code_buf,
+                                         &search_size);
+        if (gen_code_size >= 0) {
+            tcg_ctx->gen_tb = NULL;
+            tb->tc.size = gen_code_size;
+            goto restored;
+        }
+        tcg_ctx->tbc_record = true;
+    }
+
  restart_translate:
     trace_translate_block(tb, pc, tb->tc.ptr);
+    tcg_ctx->tbc_unsafe = false;
+    tcg_ctx->tbc_nb_relocs = 0;
 
     gen_code_size = setjmp_gen_code(env, tb, pc, host_pc, &max_insns, &ti);
     if (unlikely(gen_code_size < 0)) {
@@ -429,6 +454,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
     tb->tc.size = gen_code_size;
 
+    if (tcg_ctx->tbc_record) {
+        tcg_ctx->tbc_record = false;
+        tb_cache_record(cpu, tb, pc, host_pc, gen_code_buf,
+                        gen_code_size, search_size);
+    }
+
     /*
      * For CF_PCREL, attribute all executions of the generated code
      * to its first mapping.
@@ -508,6 +539,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         }
     }
 
+ restored:
     qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
@@ -138,6 +138,7 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     db->is_jmp = DISAS_NEXT;
     db->num_insns = 0;
     db->max_insns = *max_insns;
+    tb->icount_page0 = 0;
     db->singlestep_enabled = cflags & CF_SINGLE_STEP;
     db->saved_can_do_io = -1;
     db->host_addr[0] = host_pc;
@@ -174,6 +175,9 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
             set_can_do_io(db, true);
         }
         ops->translate_insn(db, cpu);
+        if (is_same_page(db, db->pc_next - 1)) {
+            tb->icount_page0 = db->num_insns;
+        }
 
         /*
          * We can't instrument after instructions that change control
@@ -31,11 +31,21 @@
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
+#define BLOCK_COPY_MAX_MERGED_BUFFER (4 * MiB)
 #define BLOCK_COPY_MAX_MEM (128 * MiB)
 #define BLOCK_COPY_MAX_WORKERS 64
+#define BLOCK_COPY_INITIAL_WORKERS 8
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
 
+/*
+ * Latency one copy task (and so one copy-before-write operation) should
+ * take.  Chunk size and background concurrency are adapted towards it.
+ */
+#define BLOCK_COPY_TARGET_LATENCY_NS (10 * SCALE_MS)
+/* Interval over which background throughput is sampled */
+#define BLOCK_COPY_ADAPT_WINDOW_NS (200 * SCALE_MS)
+
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
     COPY_READ_WRITE,
@@ -80,6 +90,12 @@ typedef struct BlockCopyCallState {
     int ret;
 } BlockCopyCallState;
 
+static bool block_copy_call_is_background(BlockCopyCallState *call_state)
+{
+    /* Only block_copy_async() calls run in their own coroutine */
+    return call_state->co != NULL;
+}
+
 typedef struct BlockCopyTask {
     AioTask task;
 
@@ -98,6 +114,9 @@ typedef struct BlockCopyTask {
      */
     BlockCopyMethod method;
 
+    /* Set in block_copy_task_entry(), used to measure the task latency */
+    int64_t start_ns;
+
     /*
      * Generally, req is protected by lock in BlockCopyState, Still req.offset
      * is only set on task creation, so may be read concurrently after creation.
@@ -129,6 +148,11 @@ typedef struct BlockCopyState {
     int64_t max_transfer;
     uint64_t len;
     BdrvRequestFlags write_flags;
+    /*
+     * Flags for copy-range requests.  BDRV_REQ_NO_FALLBACK unless the user
+     * asked for copy offloading even when it is not cheap.
+     */
+    BdrvRequestFlags copy_range_flags;
 
     /*
      * Fields whose state changes throughout the execution
@@ -137,6 +161,19 @@ typedef struct BlockCopyState {
     CoMutex lock;
     int64_t in_flight_bytes;
     BlockCopyMethod method;
+    /*
+     * Adaptive sizing, see block_copy_adapt().  @chunk is the current limit
+     * for one task, @workers the current limit of parallel tasks of
+     * background calls.
+     */
+    int64_t chunk;
+    int workers;
+    int workers_step;
+    int64_t latency_ns;
+    int64_t fg_latency_ns;
+    int64_t window_start_ns;
+    uint64_t window_bytes;
+    uint64_t window_bw;
     BlockReqList reqs;
     QLIST_HEAD(, BlockCopyCallState) calls;
     /*
@@ -162,15 +199,17 @@ typedef struct BlockCopyState {
 } BlockCopyState;
 
 /* Called with lock held */
-static int64_t block_copy_chunk_size(BlockCopyState *s)
+static int64_t block_copy_max_chunk_size(BlockCopyState *s)
 {
     switch (s->method) {
     case COPY_READ_WRITE_CLUSTER:
         return s->cluster_size;
-    case COPY_READ_WRITE:
     case COPY_RANGE_SMALL:
         return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER),
                    s->max_transfer);
+    case COPY_READ_WRITE:
+        return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_MERGED_BUFFER),
+                   s->max_transfer);
     case COPY_RANGE_FULL:
         return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_COPY_RANGE),
                    s->max_transfer);
@@ -180,6 +219,83 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
     }
 }
 
+/* Called with lock held */
+static int64_t block_copy_chunk_size(BlockCopyState *s)
+{
+    return MAX(MIN(s->chunk, block_copy_max_chunk_size(s)), s->cluster_size);
+}
+
+/*
+ * block_copy_adapt
+ *
+ * Feed the result of a finished copy task into the chunk size and
+ * concurrency controllers.  Called with lock held.
+ *
+ * The chunk size is doubled while full-sized tasks complete in less than half
+ * the target latency and halved when they take longer than it, so that a
+ * guest write that has to wait for an in-flight task is not delayed by much
+ * more than the target.  Adjacent dirty clusters are merged into tasks of up
+ * to that size by block_copy_task_create().
+ *
+ * The number of parallel background tasks is tuned by hill climbing on the
+ * throughput measured over BLOCK_COPY_ADAPT_WINDOW_NS, and is halved
+ * whenever copy-before-write requests or minimal-sized tasks exceed the
+ * target latency, i.e. when the target device is saturated.
+ */
+static void block_copy_adapt(BlockCopyState *s, int64_t bytes,
+                             int64_t latency_ns)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t max_chunk = block_copy_max_chunk_size(s);
+    bool saturated;
+
+    s->latency_ns = s->latency_ns ?
+        (s->latency_ns * 7 + latency_ns) / 8 : latency_ns;
+
+    /* The method, and so the maximum, may have changed */
+    s->chunk = MIN(s->chunk, max_chunk);
+    if (latency_ns > BLOCK_COPY_TARGET_LATENCY_NS) {
+        s->chunk = MAX(QEMU_ALIGN_DOWN(s->chunk / 2, s->cluster_size),
+                       s->cluster_size);
+    } else if (latency_ns < BLOCK_COPY_TARGET_LATENCY_NS / 2 &&
+               bytes >= s->chunk && s->chunk < max_chunk) {
+        s->chunk = MIN(s->chunk * 2, max_chunk);
+    }
+
+    s->window_bytes += bytes;
+    if (now - s->window_start_ns < BLOCK_COPY_ADAPT_WINDOW_NS) {
+        return;
+    }
+
+    saturated = s->fg_latency_ns > BLOCK_COPY_TARGET_LATENCY_NS ||
+        (s->chunk == s->cluster_size &&
+         s->latency_ns > BLOCK_COPY_TARGET_LATENCY_NS);
+    if (saturated) {
+        qatomic_set(&s->workers, MAX(s->workers / 2, 1));
+        s->workers_step = 1;
+    } else {
+        /* bytes per second */
+        uint64_t bw = s->window_bytes * 1000 /
+            MAX((now - s->window_start_ns) / SCALE_MS, 1);
+
+        /* Turn around when the last step lost more than 1/16 */
+        if (bw < s->window_bw - s->window_bw / 16) {
+            s->workers_step = -s->workers_step;
+        }
+        qatomic_set(&s->workers, MIN(MAX(s->workers + s->workers_step, 1),
+                                     BLOCK_COPY_MAX_WORKERS));
+        s->window_bw = bw;
+    }
+
+    trace_block_copy_adapt(s, s->chunk, s->workers, s->latency_ns,
+                           s->fg_latency_ns, s->window_bw);
+
+    /* Forget copy-before-write latency if no guest writes come any more */
+    s->fg_latency_ns /= 2;
+    s->window_start_ns = now;
+    s->window_bytes = 0;
+}
+
 /*
  * Search for the first dirty area in offset/bytes range and create task at
  * the beginning of it.
@@ -246,9 +362,9 @@ static void coroutine_fn block_copy_task_shrink(BlockCopyTask *task,
     reqlist_shrink_req(&task->req, new_bytes);
 }
 
-static void coroutine_fn block_copy_task_end(BlockCopyTask *task, int ret)
+/* Called with lock held */
+static void block_copy_task_end_locked(BlockCopyTask *task, int ret)
 {
-    QEMU_LOCK_GUARD(&task->s->lock);
     task->s->in_flight_bytes -= task->req.bytes;
     if (ret < 0) {
         bdrv_set_dirty_bitmap(task->s->copy_bitmap, task->req.offset,
@@ -262,6 +378,12 @@ static void coroutine_fn block_copy_task_end(BlockCopyTask *task, int ret)
     reqlist_remove_req(&task->req);
 }
 
+static void coroutine_fn block_copy_task_end(BlockCopyTask *task, int ret)
+{
+    QEMU_LOCK_GUARD(&task->s->lock);
+    block_copy_task_end_locked(task, ret);
+}
+
 void block_copy_state_free(BlockCopyState *s)
 {
     if (!s) {
@@ -287,6 +409,7 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
     /* Keep BDRV_REQ_SERIALISING set (or not set) in block_copy_state_new() */
     s->write_flags = (s->write_flags & BDRV_REQ_SERIALISING) |
         (compress ? BDRV_REQ_WRITE_COMPRESSED : 0);
+    s->copy_range_flags = use_copy_range ? 0 : BDRV_REQ_NO_FALLBACK;
 
     if (s->max_transfer < s->cluster_size) {
         /*
@@ -301,11 +424,15 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
         s->method = COPY_READ_WRITE_CLUSTER;
     } else {
         /*
-         * If copy range enabled, start with COPY_RANGE_SMALL, until first
-         * successful copy_range (look at block_copy_do_copy).
+         * Start with COPY_RANGE_SMALL, until first successful copy_range
+         * (look at block_copy_do_copy).  Without @use_copy_range, copy_range
+         * is only used where it is offloaded (e.g. reflink or
+         * copy_file_range(2) within one filesystem), so the first attempt
+         * fails quickly if source and target don't share storage.
          */
-        s->method = use_copy_range ? COPY_RANGE_SMALL : COPY_READ_WRITE;
+        s->method = COPY_RANGE_SMALL;
     }
+    s->chunk = block_copy_max_chunk_size(s);
 }
 
 static int64_t block_copy_calculate_cluster_size(BlockDriverState *target,
@@ -415,6 +542,9 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .max_transfer = QEMU_ALIGN_DOWN(
                                     block_copy_max_transfer(source, target),
                                     cluster_size),
+        .workers = BLOCK_COPY_INITIAL_WORKERS,
+        .workers_step = 1,
+        .window_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
     };
 
     block_copy_set_copy_opts(s, false, false);
@@ -507,7 +637,7 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
     case COPY_RANGE_SMALL:
     case COPY_RANGE_FULL:
         ret = bdrv_co_copy_range(s->source, offset, s->target, offset, nbytes,
-                                 0, s->write_flags);
+                                 0, s->write_flags | s->copy_range_flags);
         if (ret >= 0) {
             /* Successful copy-range, increase chunk size.  */
             *method = COPY_RANGE_FULL;
@@ -566,11 +696,15 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyMethod method = t->method;
     int ret;
 
+    t->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
                                  &error_is_read);
     }
 
+    co_put_to_shres(s->mem, t->req.bytes);
+
+    /* Account and end the task in one critical section */
     WITH_QEMU_LOCK_GUARD(&s->lock) {
         if (s->method == t->method) {
             s->method = method;
@@ -581,12 +715,18 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
                 t->call_state->ret = ret;
                 t->call_state->error_is_read = error_is_read;
             }
-        } else if (s->progress) {
-            progress_work_done(s->progress, t->req.bytes);
+        } else {
+            if (t->method != COPY_WRITE_ZEROES) {
+                block_copy_adapt(s, t->req.bytes,
+                                 qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                 t->start_ns);
+            }
+            if (s->progress) {
+                progress_work_done(s->progress, t->req.bytes);
+            }
         }
+        block_copy_task_end_locked(t, ret);
     }
-    co_put_to_shres(s->mem, t->req.bytes);
-    block_copy_task_end(t, ret);
 
     return ret;
 }
@@ -796,6 +936,11 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         if (!aio && bytes) {
             aio = aio_task_pool_new(call_state->max_workers);
         }
+        if (aio && block_copy_call_is_background(call_state)) {
+            /* s->workers only changes under lock, a stale value is fine */
+            aio_task_pool_set_max_busy_tasks(aio,
+                    MIN(call_state->max_workers, qatomic_read(&s->workers)));
+        }
 
         ret = block_copy_task_run(aio, task);
         if (ret < 0) {
@@ -914,6 +1059,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
                             void *cb_opaque)
 {
     int ret;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     BlockCopyCallState *call_state = g_new(BlockCopyCallState, 1);
 
     *call_state = (BlockCopyCallState) {
@@ -938,6 +1084,17 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
     ret = call_state->ret;
     g_free(call_state);
 
+    /*
+     * Synchronous calls are copy-before-write operations that a guest write
+     * is waiting for; their latency limits background concurrency.
+     */
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        int64_t latency_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
+
+        s->fg_latency_ns = s->fg_latency_ns ?
+            (s->fg_latency_ns * 7 + latency_ns) / 8 : latency_ns;
+    }
+
     return ret;
 }
 
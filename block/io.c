@@ -3379,9 +3379,8 @@ static int coroutine_fn GRAPH_RDLOCK bdrv_co_copy_range_internal(
     int ret;
     assert_bdrv_graph_readable();
 
-    /* TODO We can support BDRV_REQ_NO_FALLBACK here */
+    /* BDRV_REQ_NO_FALLBACK is passed down to the driver in write_flags */
     assert(!(read_flags & BDRV_REQ_NO_FALLBACK));
-    assert(!(write_flags & BDRV_REQ_NO_FALLBACK));
     assert(!(read_flags & BDRV_REQ_NO_WAIT));
     assert(!(write_flags & BDRV_REQ_NO_WAIT));
 
@@ -3393,7 +3392,9 @@ static int coroutine_fn GRAPH_RDLOCK bdrv_co_copy_range_internal(
         return ret;
     }
     if (write_flags & BDRV_REQ_ZERO_WRITE) {
-        return bdrv_co_pwrite_zeroes(dst, dst_offset, bytes, write_flags);
+        /* Zeroes are never worth failing the whole copy over */
+        return bdrv_co_pwrite_zeroes(dst, dst_offset, bytes,
+                                     write_flags & ~BDRV_REQ_NO_FALLBACK);
     }
 
     if (!src || !src->bs || !bdrv_co_is_inserted(src->bs)) {
@@ -11,7 +11,11 @@
 #include "qemu/osdep.h"
 #include <liburing.h>
 #include "block/aio.h"
+#include "qemu/bitmap.h"
+#include "qemu/lockable.h"
 #include "qemu/queue.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
@@ -26,9 +30,21 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Milliseconds of inactivity before the SQPOLL kernel thread goes to sleep */
+#define SQPOLL_IDLE_MS 100
+
+/* Size of the fixed file and buffer tables of each ring */
+#define MAX_FIXED_FILES 64
+#define MAX_FIXED_BUFS 1024
+
+/* The kernel does not accept larger fixed buffers */
+#define FIXED_BUF_MAX_SIZE (1 * GiB)
+
 typedef struct LuringAIOCB {
     Coroutine *co;
+    LuringState *s;
     struct io_uring_sqe sqeq;
+    CqeHandler cqe_handler; /* for requests on a shared ring */
     ssize_t ret;
     QEMUIOVector *qiov;
     bool is_read;
@@ -49,25 +65,97 @@ typedef struct LuringQueue {
     QSIMPLEQ_HEAD(, LuringAIOCB) submit_queue;
 } LuringQueue;
 
-typedef struct LuringState {
+struct LuringState {
     AioContext *aio_context;
 
+    /*
+     * If the AioContext monitors file descriptors with io_uring, requests
+     * are submitted on that ring with aio_add_sqe() instead of on our own
+     * ring, which is not even set up then.  Block I/O completions and file
+     * descriptor events are then reaped with the same io_uring_enter(2).
+     */
+    bool shared;
+
     struct io_uring ring;
 
     /* No locking required, only accessed from AioContext home thread */
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
-} LuringState;
+
+    /*
+     * Set once the ring has the fixed file and buffer tables registered;
+     * never cleared again.  Written under luring_fixed.lock.
+     */
+    bool fixed;
+    QLIST_ENTRY(LuringState) next;
+};
+
+/*
+ * Guest RAM registered with blk_register_buf(), split into chunks of at
+ * most FIXED_BUF_MAX_SIZE that use consecutive fixed buffer indices.
+ */
+typedef struct LuringFixedRegion {
+    void *host;
+    size_t size;
+    int index;
+    unsigned refcnt;
+} LuringFixedRegion;
+
+/* Sorted by host address; guest RAM blocks do not overlap */
+typedef struct LuringFixedRegions {
+    struct rcu_head rcu;
+    int nr;
+    LuringFixedRegion regions[];
+} LuringFixedRegions;
+
+/*
+ * Files and buffers are registered with every ring at the same index, so
+ * that requests can be prepared without knowing which ring they end up in.
+ */
+static struct {
+    QemuMutex lock;
+    QLIST_HEAD(, LuringState) rings;
+    int files[MAX_FIXED_FILES];
+    DECLARE_BITMAP(bufs_used, MAX_FIXED_BUFS);
+
+    /* Read locklessly under RCU by the submission path */
+    LuringFixedRegions *regions;
+} luring_fixed;
+
+static void __attribute__((constructor)) luring_fixed_init(void)
+{
+    qemu_mutex_init(&luring_fixed.lock);
+    QLIST_INIT(&luring_fixed.rings);
+    for (int i = 0; i < MAX_FIXED_FILES; i++) {
+        luring_fixed.files[i] = -1;
+    }
+}
+
+static void luring_cqe_handler_cb(CqeHandler *cqe_handler);
+
+/* Submit a request on the shared ring of the AioContext */
+static void luring_add_sqe(LuringState *s, LuringAIOCB *luringcb)
+{
+    luringcb->cqe_handler.cb = luring_cqe_handler_cb;
+    aio_add_sqe(s->aio_context, &luringcb->sqeq, &luringcb->cqe_handler);
+    s->io_q.in_flight++;
+}
 
 /**
  * luring_resubmit:
  *
  * Resubmit a request by appending it to submit_queue.  The caller must ensure
  * that ioq_submit() is called later so that submit_queue requests are started.
+ * Requests on a shared ring are submitted with the next event loop iteration.
  */
 static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
 {
+    if (s->shared) {
+        luring_add_sqe(s, luringcb);
+        return;
+    }
+
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
 }
@@ -102,12 +190,103 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update sqe */
     luringcb->sqeq.off += nread;
-    luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* Single buffer, the qiov is not referenced by the sqe */
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len -= nread;
+    } else {
+        luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
 
+/**
+ * luring_complete:
+ * @s: AIO state
+ * @luringcb: the request whose cqe was reaped
+ * @ret: the result from the cqe
+ *
+ * Completes the request and wakes up its coroutine, unless the request needs
+ * to be resubmitted.
+ */
+static void luring_complete(LuringState *s, LuringAIOCB *luringcb, int ret)
+{
+    int total_bytes;
+
+    /* Change counters one-by-one because we can be nested. */
+    s->io_q.in_flight--;
+    trace_luring_process_completion(s, luringcb, ret);
+
+    /* total_read is non-zero only for resubmitted read requests */
+    total_bytes = ret + luringcb->total_read;
+
+    if (ret < 0) {
+        /*
+         * Only writev/readv/fsync requests on regular files or host block
+         * devices are submitted. Therefore -EAGAIN is not expected but it's
+         * known to happen sometimes with Linux SCSI. Submit again and hope
+         * the request completes successfully.
+         *
+         * For more information, see:
+         * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
+         *
+         * If the code is changed to submit other types of requests in the
+         * future, then this workaround may need to be extended to deal with
+         * genuine -EAGAIN results that should not be resubmitted
+         * immediately.
+         */
+        if (ret == -EINTR || ret == -EAGAIN) {
+            luring_resubmit(s, luringcb);
+            return;
+        }
+    } else if (!luringcb->qiov) {
+        goto end;
+    } else if (total_bytes == luringcb->qiov->size) {
+        ret = 0;
+    /* Only read/write */
+    } else {
+        /* Short Read/Write */
+        if (luringcb->is_read) {
+            if (ret > 0) {
+                luring_resubmit_short_read(s, luringcb, ret);
+                return;
+            } else {
+                /* Pad with zeroes */
+                qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
+                                  luringcb->qiov->size - total_bytes);
+                ret = 0;
+            }
+        } else {
+            ret = -ENOSPC;
+        }
+    }
+end:
+    luringcb->ret = ret;
+    qemu_iovec_destroy(&luringcb->resubmit_qiov);
+
+    /*
+     * If the coroutine is already entered it must be in ioq_submit()
+     * and will notice luringcb->ret has been filled in when it
+     * eventually runs later. Coroutines cannot be entered recursively
+     * so avoid doing that!
+     */
+    assert(luringcb->co->ctx == s->aio_context);
+    if (!qemu_coroutine_entered(luringcb->co)) {
+        aio_co_wake(luringcb->co);
+    }
+}
+
+/* Called from aio_poll() for requests on the shared ring */
+static void luring_cqe_handler_cb(CqeHandler *cqe_handler)
+{
+    LuringAIOCB *luringcb = container_of(cqe_handler, LuringAIOCB,
+                                         cqe_handler);
+
+    luring_complete(luringcb->s, luringcb, cqe_handler->res);
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -124,7 +303,6 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 static void luring_process_completions(LuringState *s)
 {
     struct io_uring_cqe *cqes;
-    int total_bytes;
 
     defer_call_begin();
 
@@ -158,67 +336,7 @@ static void luring_process_completions(LuringState *s)
         io_uring_cqe_seen(&s->ring, cqes);
         cqes = NULL;
 
-        /* Change counters one-by-one because we can be nested. */
-        s->io_q.in_flight--;
-        trace_luring_process_completion(s, luringcb, ret);
-
-        /* total_read is non-zero only for resubmitted read requests */
-        total_bytes = ret + luringcb->total_read;
-
-        if (ret < 0) {
-            /*
-             * Only writev/readv/fsync requests on regular files or host block
-             * devices are submitted. Therefore -EAGAIN is not expected but it's
-             * known to happen sometimes with Linux SCSI. Submit again and hope
-             * the request completes successfully.
-             *
-             * For more information, see:
-             * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
-             *
-             * If the code is changed to submit other types of requests in the
-             * future, then this workaround may need to be extended to deal with
-             * genuine -EAGAIN results that should not be resubmitted
-             * immediately.
-             */
-            if (ret == -EINTR || ret == -EAGAIN) {
-                luring_resubmit(s, luringcb);
-                continue;
-            }
-        } else if (!luringcb->qiov) {
-            goto end;
-        } else if (total_bytes == luringcb->qiov->size) {
-            ret = 0;
-        /* Only read/write */
-        } else {
-            /* Short Read/Write */
-            if (luringcb->is_read) {
-                if (ret > 0) {
-                    luring_resubmit_short_read(s, luringcb, ret);
-                    continue;
-                } else {
-                    /* Pad with zeroes */
-                    qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
-                                      luringcb->qiov->size - total_bytes);
-                    ret = 0;
-                }
-            } else {
-                ret = -ENOSPC;
-            }
-        }
-end:
-        luringcb->ret = ret;
-        qemu_iovec_destroy(&luringcb->resubmit_qiov);
-
-        /*
-         * If the coroutine is already entered it must be in ioq_submit()
-         * and will notice luringcb->ret has been filled in when it
-         * eventually runs later. Coroutines cannot be entered recursively
-         * so avoid doing that!
-         */
-        assert(luringcb->co->ctx == s->aio_context);
-        if (!qemu_coroutine_entered(luringcb->co)) {
-            aio_co_wake(luringcb->co);
-        }
+        luring_complete(s, luringcb, ret);
     }
 
     qemu_bh_cancel(s->completion_bh);
@@ -323,35 +441,107 @@ static void luring_deferred_fn(void *opaque)
     }
 }
 
+/*
+ * Returns the fixed buffer index that covers [@buf, @buf + @len), or -1 if
+ * the memory is not (completely) inside one registered buffer.
+ */
+static int luring_fixed_buf_index(void *buf, size_t len)
+{
+    LuringFixedRegions *r;
+    LuringFixedRegion *region;
+    uintptr_t addr = (uintptr_t)buf;
+    uintptr_t start;
+    size_t chunk;
+    int lo, hi;
+
+    RCU_READ_LOCK_GUARD();
+
+    r = qatomic_rcu_read(&luring_fixed.regions);
+    if (!r) {
+        return -1;
+    }
+
+    /* Find the last region that starts at or below @buf */
+    lo = 0;
+    hi = r->nr;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if ((uintptr_t)r->regions[mid].host <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1;
+    }
+
+    region = &r->regions[lo - 1];
+    start = (uintptr_t)region->host;
+    if (addr - start + len > region->size) {
+        return -1;
+    }
+
+    chunk = (addr - start) / FIXED_BUF_MAX_SIZE;
+    if ((addr - start + len - 1) / FIXED_BUF_MAX_SIZE != chunk) {
+        return -1;
+    }
+    return region->index + chunk;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
+ * @fixed_file: index of @fd in the fixed file table, or -1
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
- * @type: type of request
+ * @type: type of request, optionally ORed with QEMU_AIO_REGISTERED_BUF
  *
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+static int luring_do_submit(int fd, int fixed_file, LuringAIOCB *luringcb,
+                            LuringState *s, uint64_t offset, int type)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    bool fixed = qatomic_load_acquire(&s->fixed);
+    int buf_index = -1;
+
+    if (fixed && (type & QEMU_AIO_REGISTERED_BUF) &&
+        luringcb->qiov->niov == 1) {
+        buf_index = luring_fixed_buf_index(luringcb->qiov->iov[0].iov_base,
+                                           luringcb->qiov->iov[0].iov_len);
+    }
+    if (fixed && fixed_file >= 0) {
+        fd = fixed_file;
+    }
 
-    switch (type) {
+    switch (type & ~QEMU_AIO_REGISTERED_BUF) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
-        break;
     case QEMU_AIO_ZONE_APPEND:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd,
+                                      luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len,
+                                      offset, buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd,
+                                     luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len,
+                                     offset, buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -361,6 +551,17 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed && fixed_file >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
+
+    if (s->shared) {
+        luring_add_sqe(s, luringcb);
+        trace_luring_do_submit(s, s->io_q.blocked, s->io_q.in_queue,
+                               s->io_q.in_flight);
+        return 0;
+    }
+
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -379,21 +580,22 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type)
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, int fixed_file,
+                                  uint64_t offset, QEMUIOVector *qiov, int type)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
     LuringState *s = aio_get_linux_io_uring(ctx);
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
+        .s          = s,
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
-        .is_read    = (type == QEMU_AIO_READ),
+        .is_read    = ((type & ~QEMU_AIO_REGISTERED_BUF) == QEMU_AIO_READ),
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    ret = luring_do_submit(fd, fixed_file, &luringcb, s, offset, type);
 
     if (ret < 0) {
         return ret;
@@ -407,43 +609,349 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
 
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
-    aio_set_fd_handler(old_context, s->ring.ring_fd,
-                       NULL, NULL, NULL, NULL, s);
-    qemu_bh_delete(s->completion_bh);
+    if (!s->shared) {
+        aio_set_fd_handler(old_context, s->ring.ring_fd,
+                           NULL, NULL, NULL, NULL, s);
+        qemu_bh_delete(s->completion_bh);
+    }
     s->aio_context = NULL;
 }
 
 void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
+    if (s->shared) {
+        /* The AioContext reaps our completions */
+        assert(aio_has_io_uring(new_context));
+        return;
+    }
     s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
     aio_set_fd_handler(s->aio_context, s->ring.ring_fd,
                        qemu_luring_completion_cb, NULL,
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+/* Called with luring_fixed.lock held */
+static int luring_update_fixed_buf(LuringState *s, LuringFixedRegion *region,
+                                   bool add)
+{
+#ifdef HAVE_IO_URING_REGISTER_SPARSE
+    size_t nr = DIV_ROUND_UP(region->size, FIXED_BUF_MAX_SIZE);
+
+    for (size_t i = 0; i < nr; i++) {
+        size_t offset = i * FIXED_BUF_MAX_SIZE;
+        struct iovec iov = { NULL, 0 };
+        __u64 tag = 0;
+        int ret;
+
+        if (add) {
+            iov.iov_base = (uint8_t *)region->host + offset;
+            iov.iov_len = MIN(region->size - offset, FIXED_BUF_MAX_SIZE);
+        }
+        ret = io_uring_register_buffers_update_tag(&s->ring, region->index + i,
+                                                   &iov, &tag, 1);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+/*
+ * Registers the fixed file and buffer tables with @s and fills them with
+ * everything that is registered so far.  Called with luring_fixed.lock held.
+ */
+static void luring_fixed_setup(LuringState *s)
+{
+#ifdef HAVE_IO_URING_REGISTER_SPARSE
+    LuringFixedRegions *r = luring_fixed.regions;
+    int ret;
+
+    if (s->fixed) {
+        return;
+    }
+
+    ret = io_uring_register_files_sparse(&s->ring, MAX_FIXED_FILES);
+    if (ret < 0) {
+        return;
+    }
+    ret = io_uring_register_buffers_sparse(&s->ring, MAX_FIXED_BUFS);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    ret = io_uring_register_files_update(&s->ring, 0, luring_fixed.files,
+                                         MAX_FIXED_FILES);
+    if (ret < 0) {
+        goto fail;
+    }
+    for (int i = 0; r && i < r->nr; i++) {
+        ret = luring_update_fixed_buf(s, &r->regions[i], true);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+
+    trace_luring_fixed_setup(s);
+    qatomic_store_release(&s->fixed, true);
+    return;
+
+fail:
+    io_uring_unregister_buffers(&s->ring);
+    io_uring_unregister_files(&s->ring);
+#endif
+}
+
+/* Called with luring_fixed.lock held */
+static void luring_clear_fixed_file(int index)
+{
+    LuringState *s;
+    int fd = -1;
+
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        if (s->fixed) {
+            io_uring_register_files_update(&s->ring, index, &fd, 1);
+        }
+    }
+    luring_fixed.files[index] = -1;
+}
+
+static bool luring_fixed_in_use(void)
+{
+    for (int i = 0; i < MAX_FIXED_FILES; i++) {
+        if (luring_fixed.files[i] >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int luring_register_file(int fd, Error **errp)
+{
+#ifdef HAVE_IO_URING_REGISTER_SPARSE
+    LuringState *s;
+    int index = -1;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    for (int i = 0; i < MAX_FIXED_FILES; i++) {
+        if (luring_fixed.files[i] < 0) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        error_setg(errp, "Too many files registered with io_uring");
+        return -1;
+    }
+
+    luring_fixed.files[index] = fd;
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        luring_fixed_setup(s);
+        if (s->fixed &&
+            io_uring_register_files_update(&s->ring, index, &fd, 1) < 0) {
+            /* Callers fall back to using the plain file descriptor */
+            luring_clear_fixed_file(index);
+            error_setg(errp, "Failed to register file with io_uring");
+            return -1;
+        }
+    }
+
+    trace_luring_register_file(fd, index);
+    return index;
+#else
+    error_setg(errp, "io_uring fixed files are not supported in this build");
+    return -1;
+#endif
+}
+
+void luring_unregister_file(int index)
+{
+    if (index < 0) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+    luring_clear_fixed_file(index);
+}
+
+bool luring_register_buf(void *host, size_t size, Error **errp)
+{
+    LuringFixedRegions *old, *new;
+    LuringFixedRegion region;
+    LuringState *s;
+    size_t nr;
+    int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    old = luring_fixed.regions;
+    for (i = 0; old && i < old->nr; i++) {
+        if (old->regions[i].host == host && old->regions[i].size == size) {
+            old->regions[i].refcnt++;
+            return true;
+        }
+    }
+
+    nr = DIV_ROUND_UP(size, FIXED_BUF_MAX_SIZE);
+    region = (LuringFixedRegion) {
+        .host = host,
+        .size = size,
+        .index = bitmap_find_next_zero_area(luring_fixed.bufs_used,
+                                            MAX_FIXED_BUFS, 0, nr, 0),
+        .refcnt = 1,
+    };
+    if (region.index + nr > MAX_FIXED_BUFS) {
+        error_setg(errp, "Too much memory registered with io_uring");
+        return false;
+    }
+
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        if (s->fixed) {
+            int ret = luring_update_fixed_buf(s, &region, true);
+            if (ret < 0) {
+                LuringState *s2;
+
+                QLIST_FOREACH(s2, &luring_fixed.rings, next) {
+                    if (s2 == s) {
+                        break;
+                    }
+                    if (s2->fixed) {
+                        luring_update_fixed_buf(s2, &region, false);
+                    }
+                }
+                error_setg_errno(errp, -ret, "Failed to register memory "
+                                 "with io_uring (check RLIMIT_MEMLOCK)");
+                return false;
+            }
+        }
+    }
+    bitmap_set(luring_fixed.bufs_used, region.index, nr);
+
+    new = g_malloc(sizeof(*new) +
+                   sizeof(LuringFixedRegion) * ((old ? old->nr : 0) + 1));
+    new->nr = 0;
+    /* Keep the array sorted for luring_fixed_buf_index() */
+    for (i = 0; old && i < old->nr &&
+                (uintptr_t)old->regions[i].host < (uintptr_t)host; i++) {
+        new->regions[new->nr++] = old->regions[i];
+    }
+    new->regions[new->nr++] = region;
+    for (; old && i < old->nr; i++) {
+        new->regions[new->nr++] = old->regions[i];
+    }
+    qatomic_rcu_set(&luring_fixed.regions, new);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+
+    trace_luring_register_buf(host, size, region.index);
+    return true;
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringFixedRegions *old, *new;
+    LuringFixedRegion *region = NULL;
+    LuringState *s;
+    int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    old = luring_fixed.regions;
+    for (i = 0; old && i < old->nr; i++) {
+        if (old->regions[i].host == host && old->regions[i].size == size) {
+            region = &old->regions[i];
+            break;
+        }
+    }
+    if (!region || --region->refcnt > 0) {
+        return;
+    }
+
+    /* In-flight requests keep their own reference to the buffer */
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        if (s->fixed) {
+            luring_update_fixed_buf(s, region, false);
+        }
+    }
+    bitmap_clear(luring_fixed.bufs_used, region->index,
+                 DIV_ROUND_UP(size, FIXED_BUF_MAX_SIZE));
+
+    new = g_malloc(sizeof(*new) + sizeof(LuringFixedRegion) * (old->nr - 1));
+    new->nr = 0;
+    for (i = 0; i < old->nr; i++) {
+        if (&old->regions[i] != region) {
+            new->regions[new->nr++] = old->regions[i];
+        }
+    }
+    qatomic_rcu_set(&luring_fixed.regions, new);
+    g_free_rcu(old, rcu);
+}
+
+LuringState *luring_init(AioContext *ctx, int64_t sqpoll_cpu, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = { 0 };
 
     trace_luring_init_state(s, sizeof(*s));
+    ioq_init(&s->io_q);
+
+    /*
+     * Share the ring of the AioContext unless SQPOLL or fixed files and
+     * buffers need a ring of our own.  The fixed tables can only be updated
+     * from other threads on rings that are not IORING_SETUP_SINGLE_ISSUER.
+     */
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.lock) {
+        s->shared = sqpoll_cpu < 0 && aio_has_io_uring(ctx) &&
+                    !luring_fixed_in_use();
+    }
+    if (s->shared) {
+        trace_luring_init_shared(s, ctx);
+        return s;
+    }
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (sqpoll_cpu >= 0) {
+        params.flags = IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF;
+        params.sq_thread_cpu = sqpoll_cpu;
+        params.sq_thread_idle = SQPOLL_IDLE_MS;
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring%s",
+                         sqpoll_cpu >= 0 ? " in SQPOLL mode" : "");
         g_free(s);
         return NULL;
     }
 
-    ioq_init(&s->io_q);
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.lock) {
+        if (luring_fixed_in_use()) {
+            luring_fixed_setup(s);
+        }
+        QLIST_INSERT_HEAD(&luring_fixed.rings, s, next);
+    }
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    if (s->shared) {
+        assert(s->io_q.in_flight == 0);
+        trace_luring_cleanup_state(s);
+        g_free(s);
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.lock) {
+        QLIST_REMOVE(s, next);
+    }
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
@@ -24,10 +24,25 @@
 #include "qemu/ratelimit.h"
 #include "qemu/bitmap.h"
 #include "qemu/memalign.h"
+#include "qemu/units.h"
+#include "sysemu/iothread.h"
 
 #define MAX_IN_FLIGHT 16
+#define MAX_IN_FLIGHT_LIMIT 256
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
+/* Limit for growing the default buffer along with the in-flight window */
+#define MAX_MIRROR_BUF_SIZE (128 * MiB)
+
+/* Interval for the throughput and dirty rate statistics */
+#define MIRROR_STATS_WINDOW_NS (500 * SCALE_MS)
+
+/*
+ * Guest writes are counted per region of at least this size; regions with
+ * MIRROR_HEAT_HOT or more recent writes are copied last.
+ */
+#define MIRROR_HEAT_REGION_BITS 20 /* 1 MiB */
+#define MIRROR_HEAT_HOT 4
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -93,6 +108,42 @@ typedef struct MirrorBlockJob {
     int64_t active_write_bytes_in_flight;
     bool prepared;
     bool in_drain;
+
+    /*
+     * Adaptive in-flight window, see mirror_update_stats().  The buffer
+     * grows with the window (in extra_bufs) unless its size was given.
+     */
+    unsigned max_in_flight;
+    bool window_full;
+    bool grow_buf;
+    size_t buf_align;
+    size_t buf_total;
+    GSList *extra_bufs;
+
+    /* Statistics of the current window, see mirror_update_stats() */
+    int64_t stats_start_ns;
+    uint64_t bytes_copied;
+    uint64_t stats_bytes_copied;
+    int64_t stats_remaining;
+    uint64_t stats_bw;
+    /* Results of the last complete window, to be accessed with atomics */
+    bool stats_valid;
+    uint64_t dirty_rate;
+    int64_t convergence_rate;
+
+    /*
+     * Guest write counts per region, updated from any thread with atomics
+     * and halved after each pass over the dirty bitmap.  Passes alternately
+     * skip and include hot regions (defer_hot).
+     */
+    uint8_t *heat;
+    int heat_shift;
+    bool defer_hot;
+
+    /* IOThreads that copy operations are spread over, round-robin */
+    IOThread **iothreads;
+    int nr_iothreads;
+    int next_iothread;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -222,6 +273,7 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
         }
         if (!s->initial_zeroing_ongoing) {
             job_progress_update(&s->common.job, op->bytes);
+            s->bytes_copied += op->bytes;
         }
     }
     qemu_iovec_destroy(&op->qiov);
@@ -250,22 +302,46 @@ static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
 static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
+    BlockErrorAction action;
 
-    if (ret < 0) {
-        BlockErrorAction action;
+    assert(ret < 0);
 
-        bdrv_set_dirty_bitmap(s->dirty_bitmap, op->offset, op->bytes);
-        action = mirror_error_action(s, true, -ret);
-        if (action == BLOCK_ERROR_ACTION_REPORT && s->ret >= 0) {
-            s->ret = ret;
-        }
+    bdrv_set_dirty_bitmap(s->dirty_bitmap, op->offset, op->bytes);
+    action = mirror_error_action(s, true, -ret);
+    if (action == BLOCK_ERROR_ACTION_REPORT && s->ret >= 0) {
+        s->ret = ret;
+    }
 
-        mirror_iteration_done(op, ret);
-        return;
+    mirror_iteration_done(op, ret);
+}
+
+/*
+ * If copy work is spread over IOThreads, move the calling operation
+ * coroutine to the next one.  Returns the AioContext that mirror_co_return()
+ * must move back to before touching the job state again, or NULL.
+ */
+static AioContext *coroutine_fn mirror_co_offload(MirrorBlockJob *s)
+{
+    AioContext *home;
+    IOThread *iothread;
+
+    if (!s->nr_iothreads) {
+        return NULL;
     }
 
-    ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
-    mirror_write_complete(op, ret);
+    home = qemu_get_current_aio_context();
+    iothread = s->iothreads[s->next_iothread];
+    s->next_iothread = (s->next_iothread + 1) % s->nr_iothreads;
+    aio_co_reschedule_self(iothread_get_aio_context(iothread));
+
+    return home;
+}
+
+static void coroutine_fn mirror_co_return(AioContext *home)
+{
+    if (home) {
+        aio_co_reschedule_self(home);
+    }
 }
 
 /* Clip bytes relative to offset to not exceed end-of-file */
@@ -347,8 +423,10 @@ static void coroutine_fn mirror_co_read(void *opaque)
 {
     MirrorOp *op = opaque;
     MirrorBlockJob *s = op->s;
+    AioContext *home;
     int nb_chunks;
-    uint64_t ret;
+    int ret;
+    int write_ret = 0;
     uint64_t max_bytes;
 
     max_bytes = s->granularity * s->max_iov;
@@ -375,6 +453,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
 
     while (s->buf_free_count < nb_chunks) {
         trace_mirror_yield_in_flight(s, op->offset, s->in_flight);
+        s->window_full = true;
         mirror_wait_for_free_in_flight_slot(s);
     }
 
@@ -397,16 +476,28 @@ static void coroutine_fn mirror_co_read(void *opaque)
     op->is_in_flight = true;
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
+    home = mirror_co_offload(s);
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
                              &op->qiov, 0);
     }
-    mirror_read_complete(op, ret);
+    if (ret >= 0) {
+        write_ret = blk_co_pwritev(s->target, op->offset, op->qiov.size,
+                                   &op->qiov, 0);
+    }
+    mirror_co_return(home);
+
+    if (ret < 0) {
+        mirror_read_complete(op, ret);
+    } else {
+        mirror_write_complete(op, write_ret);
+    }
 }
 
 static void coroutine_fn mirror_co_zero(void *opaque)
 {
     MirrorOp *op = opaque;
+    AioContext *home;
     int ret;
 
     op->s->in_flight++;
@@ -414,14 +505,17 @@ static void coroutine_fn mirror_co_zero(void *opaque)
     *op->bytes_handled = op->bytes;
     op->is_in_flight = true;
 
+    home = mirror_co_offload(op->s);
     ret = blk_co_pwrite_zeroes(op->s->target, op->offset, op->bytes,
                                op->s->unmap ? BDRV_REQ_MAY_UNMAP : 0);
+    mirror_co_return(home);
     mirror_write_complete(op, ret);
 }
 
 static void coroutine_fn mirror_co_discard(void *opaque)
 {
     MirrorOp *op = opaque;
+    AioContext *home;
     int ret;
 
     op->s->in_flight++;
@@ -429,7 +523,9 @@ static void coroutine_fn mirror_co_discard(void *opaque)
     *op->bytes_handled = op->bytes;
     op->is_in_flight = true;
 
+    home = mirror_co_offload(op->s);
     ret = blk_co_pdiscard(op->s->target, op->offset, op->bytes);
+    mirror_co_return(home);
     mirror_write_complete(op, ret);
 }
 
@@ -479,6 +575,87 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
+/* Called from any thread for guest writes that dirty the bitmap */
+static void mirror_note_write(MirrorBlockJob *s, uint64_t offset,
+                              uint64_t bytes)
+{
+    uint8_t *heat = qatomic_read(&s->heat);
+    uint64_t i, end;
+
+    if (!heat || !bytes) {
+        return;
+    }
+
+    /* Lost updates from racing writers don't matter for a heuristic */
+    end = (offset + bytes - 1) >> s->heat_shift;
+    for (i = offset >> s->heat_shift; i <= end; i++) {
+        uint8_t h = qatomic_read(&heat[i]);
+
+        if (h < UINT8_MAX) {
+            qatomic_set(&heat[i], h + 1);
+        }
+    }
+}
+
+static bool mirror_is_hot(MirrorBlockJob *s, int64_t offset)
+{
+    return qatomic_read(&s->heat[offset >> s->heat_shift]) >= MIRROR_HEAT_HOT;
+}
+
+/* A pass over the dirty bitmap has ended */
+static void mirror_end_pass(MirrorBlockJob *s)
+{
+    size_t i, nb_regions;
+
+    if (!s->defer_hot) {
+        nb_regions = DIV_ROUND_UP(s->bdev_length, 1ULL << s->heat_shift);
+        for (i = 0; i < nb_regions; i++) {
+            qatomic_set(&s->heat[i], qatomic_read(&s->heat[i]) / 2);
+        }
+    }
+    s->defer_hot = !s->defer_hot && !s->should_complete;
+}
+
+/*
+ * Return the next dirty offset to copy.  Called with the dirty bitmap lock
+ * held.
+ *
+ * Regions that the guest keeps writing to are skipped by every other pass
+ * over the bitmap, so they are copied after the rest of the disk instead of
+ * over and over again.
+ */
+static int64_t mirror_next_dirty(MirrorBlockJob *s)
+{
+    int passes = 0;
+
+    for (;;) {
+        int64_t offset = bdrv_dirty_iter_next(s->dbi);
+        int64_t region_end;
+
+        if (offset < 0) {
+            /* At most one deferring pass precedes a full one */
+            assert(++passes <= 2);
+            bdrv_set_dirty_iter(s->dbi, 0);
+            mirror_end_pass(s);
+            trace_mirror_restart_iter(s, bdrv_get_dirty_count(s->dirty_bitmap));
+            continue;
+        }
+
+        if (!s->defer_hot || !mirror_is_hot(s, offset)) {
+            return offset;
+        }
+
+        region_end = ROUND_UP(offset + 1, 1LL << s->heat_shift);
+        if (region_end >= s->bdev_length) {
+            assert(++passes <= 2);
+            bdrv_set_dirty_iter(s->dbi, 0);
+            mirror_end_pass(s);
+            continue;
+        }
+        bdrv_set_dirty_iter(s->dbi, region_end);
+    }
+}
+
 static void coroutine_fn GRAPH_RDLOCK mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source = s->mirror_top_bs->backing->bs;
@@ -490,13 +667,7 @@ static void coroutine_fn GRAPH_RDLOCK mirror_iteration(MirrorBlockJob *s)
     int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
-    offset = bdrv_dirty_iter_next(s->dbi);
-    if (offset < 0) {
-        bdrv_set_dirty_iter(s->dbi, 0);
-        offset = bdrv_dirty_iter_next(s->dbi);
-        trace_mirror_restart_iter(s, bdrv_get_dirty_count(s->dirty_bitmap));
-        assert(offset >= 0);
-    }
+    offset = mirror_next_dirty(s);
     bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
 
     /*
@@ -595,8 +766,9 @@ static void coroutine_fn GRAPH_RDLOCK mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
+            s->window_full = true;
             mirror_wait_for_free_in_flight_slot(s);
         }
 
@@ -624,14 +796,11 @@ fail:
     g_free(pseudo_op);
 }
 
-static void mirror_free_init(MirrorBlockJob *s)
+static void mirror_free_add(MirrorBlockJob *s, uint8_t *buf, size_t buf_size)
 {
     int granularity = s->granularity;
-    size_t buf_size = s->buf_size;
-    uint8_t *buf = s->buf;
 
-    assert(s->buf_free_count == 0);
-    QSIMPLEQ_INIT(&s->buf_free);
+    s->buf_total += buf_size;
     while (buf_size != 0) {
         MirrorBuffer *cur = (MirrorBuffer *)buf;
         QSIMPLEQ_INSERT_TAIL(&s->buf_free, cur, next);
@@ -641,6 +810,99 @@ static void mirror_free_init(MirrorBlockJob *s)
     }
 }
 
+static void mirror_free_init(MirrorBlockJob *s)
+{
+    assert(s->buf_free_count == 0);
+    QSIMPLEQ_INIT(&s->buf_free);
+    s->buf_total = 0;
+    mirror_free_add(s, s->buf, s->buf_size);
+}
+
+/* Grow the default buffer so that it can back the whole in-flight window */
+static void mirror_grow_buffer(MirrorBlockJob *s)
+{
+    size_t want = MIN((size_t)s->max_in_flight * MAX_IO_BYTES,
+                      MAX_MIRROR_BUF_SIZE);
+    size_t size;
+    uint8_t *buf;
+
+    if (!s->grow_buf || want <= s->buf_total) {
+        return;
+    }
+
+    size = ROUND_UP(want - s->buf_total, s->granularity);
+    buf = qemu_try_memalign(s->buf_align, size);
+    if (!buf) {
+        /* Just keep going with the buffer we have */
+        s->grow_buf = false;
+        return;
+    }
+
+    s->extra_bufs = g_slist_prepend(s->extra_bufs, buf);
+    mirror_free_add(s, buf, size);
+}
+
+/*
+ * Called from the main loop of mirror_run() with the current dirty count.
+ *
+ * Every MIRROR_STATS_WINDOW_NS, compute how fast the guest dirties data and
+ * how fast the remaining work shrinks, and scale the in-flight window: while
+ * operations had to wait for a free slot and throughput keeps improving, the
+ * window does not yet cover the bandwidth-delay product of the target, so
+ * double it; when throughput drops, shrink it again.
+ */
+static void mirror_update_stats(MirrorBlockJob *s, int64_t cnt)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed_ms = (now - s->stats_start_ns) / SCALE_MS;
+    int64_t remaining = cnt + s->bytes_in_flight +
+                        s->active_write_bytes_in_flight;
+    uint64_t copied = s->bytes_copied - s->stats_bytes_copied;
+    int64_t dirtied = remaining - s->stats_remaining + copied;
+    uint64_t bw;
+
+    if (now - s->stats_start_ns < MIRROR_STATS_WINDOW_NS) {
+        return;
+    }
+
+    bw = copied * 1000 / elapsed_ms;
+    qatomic_set_u64(&s->dirty_rate, MAX(dirtied, 0) * 1000 / elapsed_ms);
+    qatomic_set_i64(&s->convergence_rate,
+                    (s->stats_remaining - remaining) * 1000 / elapsed_ms);
+    qatomic_set(&s->stats_valid, true);
+
+    if (s->window_full && bw > s->stats_bw + s->stats_bw / 16 &&
+        s->max_in_flight < MAX_IN_FLIGHT_LIMIT) {
+        s->max_in_flight = MIN(s->max_in_flight * 2, MAX_IN_FLIGHT_LIMIT);
+        mirror_grow_buffer(s);
+    } else if (bw < s->stats_bw - s->stats_bw / 8 &&
+               s->max_in_flight > MAX_IN_FLIGHT) {
+        s->max_in_flight = MAX(s->max_in_flight * 3 / 4, MAX_IN_FLIGHT);
+    }
+
+    trace_mirror_update_stats(s, bw, qatomic_read_u64(&s->dirty_rate),
+                              qatomic_read_i64(&s->convergence_rate),
+                              s->max_in_flight);
+
+    s->stats_bw = bw;
+    s->window_full = false;
+    s->stats_start_ns = now;
+    s->stats_bytes_copied = s->bytes_copied;
+    s->stats_remaining = remaining;
+}
+
+static void mirror_release_iothreads(MirrorBlockJob *s)
+{
+    int i;
+
+    for (i = 0; i < s->nr_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
+    s->iothreads = NULL;
+    s->nr_iothreads = 0;
+}
+
 /* This is also used for the .pause callback. There is no matching
  * mirror_resume() because mirror_run() will begin iterating again
  * when the job is resumed.
@@ -857,7 +1119,7 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1002,13 +1264,22 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
     bdrv_graph_co_rdunlock();
 
-    s->buf = qemu_try_blockalign(bs, s->buf_size);
+    s->buf_align = bdrv_opt_mem_align(bs);
+    s->buf = qemu_try_memalign(s->buf_align, s->buf_size);
     if (s->buf == NULL) {
         ret = -ENOMEM;
         goto immediate_exit;
     }
 
     mirror_free_init(s);
+    s->max_in_flight = MAX_IN_FLIGHT;
+
+    s->heat_shift = MAX(MIRROR_HEAT_REGION_BITS, ctz32(s->granularity));
+    s->heat = g_try_malloc0(DIV_ROUND_UP(s->bdev_length, 1ULL << s->heat_shift));
+    if (s->heat == NULL) {
+        ret = -ENOMEM;
+        goto immediate_exit;
+    }
 
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     if (!s->is_none_mode) {
@@ -1026,6 +1297,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
 
     assert(!s->dbi);
     s->dbi = bdrv_dirty_iter_new(s->dirty_bitmap);
+    s->stats_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->stats_remaining = bdrv_get_dirty_count(s->dirty_bitmap);
     for (;;) {
         int64_t cnt, delta;
         bool should_complete;
@@ -1049,6 +1322,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         job_progress_set_remaining(&s->common.job,
                                    s->bytes_in_flight + cnt +
                                    s->active_write_bytes_in_flight);
+        mirror_update_stats(s, cnt);
 
         /* Note that even when no rate limit is applied we need to yield
          * periodically with no pending I/O so that bdrv_drain_all() returns.
@@ -1060,7 +1334,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1155,6 +1429,8 @@ immediate_exit:
 
     assert(s->in_flight == 0);
     qemu_vfree(s->buf);
+    g_slist_free_full(s->extra_bufs, qemu_vfree);
+    s->extra_bufs = NULL;
     g_free(s->cow_bitmap);
     g_free(s->in_flight_bitmap);
     bdrv_dirty_iter_free(s->dbi);
@@ -1164,6 +1440,11 @@ immediate_exit:
         bdrv_drained_begin(bs);
     }
 
+    /* No more guest writes can come in while drained */
+    g_free(s->heat);
+    qatomic_set(&s->heat, NULL);
+    mirror_release_iothreads(s);
+
     return ret;
 }
 
@@ -1291,6 +1572,15 @@ static void mirror_query(BlockJob *job, BlockJobInfo *info)
     info->u.mirror = (BlockJobInfoMirror) {
         .actively_synced = qatomic_read(&s->actively_synced),
     };
+
+    /* The rates only tell how well the job converges before it is ready */
+    if (qatomic_read(&s->stats_valid) && !job_is_ready(&job->job)) {
+        info->u.mirror.has_dirty_rate = true;
+        info->u.mirror.dirty_rate = qatomic_read_u64(&s->dirty_rate);
+        info->u.mirror.has_convergence_rate = true;
+        info->u.mirror.convergence_rate =
+            qatomic_read_i64(&s->convergence_rate);
+    }
 }
 
 static const BlockJobDriver mirror_job_driver = {
@@ -1553,6 +1843,7 @@ bdrv_mirror_top_do_write(BlockDriverState *bs, MirrorMethod method,
     if (!copy_to_target && s->job && s->job->dirty_bitmap) {
         qatomic_set(&s->job->actively_synced, false);
         bdrv_set_dirty_bitmap(s->job->dirty_bitmap, offset, bytes);
+        mirror_note_write(s->job, offset, bytes);
     }
 
     if (ret < 0) {
@@ -1715,13 +2006,16 @@ static BlockJob *mirror_start_job(
                              bool is_none_mode, BlockDriverState *base,
                              bool auto_complete, const char *filter_node_name,
                              bool is_mirror, MirrorCopyMode copy_mode,
-                             Error **errp)
+                             strList *iothreads, Error **errp)
 {
     MirrorBlockJob *s;
     MirrorBDSOpaque *bs_opaque;
     BlockDriverState *mirror_top_bs;
     bool target_is_backing;
+    bool grow_buf = false;
     uint64_t target_perms, target_shared_perms;
+    strList *iothread_list;
+    int nr_iothreads = 0;
     int ret;
 
     GLOBAL_STATE_CODE();
@@ -1739,6 +2033,16 @@ static BlockJob *mirror_start_job(
 
     if (buf_size == 0) {
         buf_size = DEFAULT_MIRROR_BUF_SIZE;
+        grow_buf = true;
+    }
+
+    for (iothread_list = iothreads; iothread_list;
+         iothread_list = iothread_list->next) {
+        if (!iothread_by_id(iothread_list->value)) {
+            error_setg(errp, "IOThread '%s' not found", iothread_list->value);
+            return NULL;
+        }
+        nr_iothreads++;
     }
 
     bdrv_graph_rdlock_main_loop();
@@ -1799,6 +2103,15 @@ static BlockJob *mirror_start_job(
 
     s->mirror_top_bs = mirror_top_bs;
 
+    s->iothreads = g_new0(IOThread *, nr_iothreads);
+    for (iothread_list = iothreads; iothread_list;
+         iothread_list = iothread_list->next) {
+        IOThread *iothread = iothread_by_id(iothread_list->value);
+
+        object_ref(OBJECT(iothread));
+        s->iothreads[s->nr_iothreads++] = iothread;
+    }
+
     /* No resize for the target either; while the mirror is still running, a
      * consistent read isn't necessarily possible. We could possibly allow
      * writes and graph modifications, though it would likely defeat the
@@ -1877,6 +2190,7 @@ static BlockJob *mirror_start_job(
     s->base_overlay = bdrv_find_overlay(bs, base);
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
+    s->grow_buf = grow_buf;
     s->unmap = unmap;
     if (auto_complete) {
         s->should_complete = true;
@@ -1973,6 +2287,7 @@ fail:
 
         g_free(s->replaces);
         blk_unref(s->target);
+        mirror_release_iothreads(s);
         bs_opaque->job = NULL;
         if (s->dirty_bitmap) {
             bdrv_release_dirty_bitmap(s->dirty_bitmap);
@@ -2004,7 +2319,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp)
+                  MirrorCopyMode copy_mode, strList *iothreads, Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -2027,7 +2342,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                      speed, granularity, buf_size, backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, copy_mode, errp);
+                     filter_node_name, true, copy_mode, iothreads, errp);
 }
 
 BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
@@ -2056,7 +2371,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
                      filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
-                     errp);
+                     NULL, errp);
     if (!job) {
         goto error_restore_flags;
     }
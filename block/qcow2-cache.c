@@ -33,6 +33,7 @@ typedef struct Qcow2CachedTable {
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    bool     referenced;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -44,6 +45,19 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /*
+     * Maps the offset of every cached table to its entry. The keys point
+     * to Qcow2CachedTable.offset, so no separate allocation is needed.
+     */
+    GHashTable             *index;
+    /* Next entry to be considered for eviction (CLOCK algorithm) */
+    int                     clock_hand;
+
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
+    uint64_t                readahead;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +73,65 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static void qcow2_cache_entry_set_offset(Qcow2Cache *c, int i, int64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->offset) {
+        g_hash_table_remove(c->index, &t->offset);
+    }
+    t->offset = offset;
+    if (offset) {
+        assert(!g_hash_table_contains(c->index, &t->offset));
+        g_hash_table_add(c->index, &t->offset);
+    }
+}
+
+/* Returns the index of the entry caching @offset, or -1 if there is none */
+static int qcow2_cache_lookup(Qcow2Cache *c, int64_t offset)
+{
+    int64_t *key = g_hash_table_lookup(c->index, &offset);
+
+    if (!key) {
+        return -1;
+    }
+    return container_of(key, Qcow2CachedTable, offset) - c->entries;
+}
+
+/*
+ * Pick an unused entry to be replaced, using the CLOCK algorithm: entries
+ * that have been used since the clock hand last passed them get a second
+ * chance. Two full sweeps are enough to find a victim if there is one.
+ *
+ * If @clean_only is true, dirty entries are skipped as well.
+ *
+ * Returns the index of the entry, or -1 if all entries are in use.
+ */
+static int qcow2_cache_find_victim(Qcow2Cache *c, bool clean_only)
+{
+    int n;
+
+    for (n = 0; n < 2 * c->size; n++) {
+        int i = c->clock_hand;
+        Qcow2CachedTable *t = &c->entries[i];
+
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
+        }
+
+        if (t->ref != 0 || (clean_only && t->dirty)) {
+            continue;
+        }
+        if (t->offset != 0 && t->referenced) {
+            t->referenced = false;
+            continue;
+        }
+        return i;
+    }
+
+    return -1;
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,7 +179,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_entry_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
             i++;
             to_clean++;
@@ -137,8 +210,10 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
+    c->index = g_hash_table_new(g_int64_hash, g_int64_equal);
 
     if (!c->entries || !c->table_array) {
+        g_hash_table_destroy(c->index);
         qemu_vfree(c->table_array);
         g_free(c->entries);
         g_free(c);
@@ -156,6 +231,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
     }
 
+    g_hash_table_destroy(c->index);
     qemu_vfree(c->table_array);
     g_free(c->entries);
     g_free(c);
@@ -311,11 +387,14 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
         c->entries[i].offset = 0;
         c->entries[i].lru_counter = 0;
+        c->entries[i].referenced = false;
     }
+    g_hash_table_remove_all(c->index);
 
     qcow2_cache_table_release(c, 0, c->size);
 
     c->lru_counter = 0;
+    c->clock_hand = 0;
 
     return 0;
 }
@@ -327,9 +406,6 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -344,29 +420,21 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_lookup(c, offset);
+    if (i >= 0) {
+        c->hits++;
+        goto found;
+    }
+    c->misses++;
 
-    if (min_lru_index == -1) {
+    i = qcow2_cache_find_victim(c, false);
+    if (i < 0) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -377,7 +445,10 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    if (c->entries[i].offset) {
+        c->evictions++;
+    }
+    qcow2_cache_entry_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -390,11 +461,12 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_entry_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
     c->entries[i].ref++;
+    c->entries[i].referenced = true;
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -438,14 +510,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -454,9 +521,109 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_entry_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
+    c->entries[i].referenced = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+/*
+ * Read up to @num_tables tables that are stored contiguously in the image
+ * file starting at @offset into the cache, using a single read request.
+ *
+ * Readahead stops at the first table that is already cached, and only
+ * clean, unused entries are replaced so that no write back is needed.
+ * Prefetched tables start out as not referenced, so they are the first
+ * ones to go if they turn out not to be needed.
+ *
+ * Returns the number of tables that were read, or -errno on failure.
+ */
+int qcow2_cache_readahead(BlockDriverState *bs, Qcow2Cache *c,
+                          uint64_t offset, int num_tables)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree int *slots = NULL;
+    void *buf;
+    int n, ret;
+
+    assert(QEMU_IS_ALIGNED(offset, c->table_size));
+
+    num_tables = MIN(num_tables, c->size / 2);
+    if (num_tables <= 0) {
+        return 0;
+    }
+
+    slots = g_new(int, num_tables);
+    for (n = 0; n < num_tables; n++) {
+        uint64_t table_offset = offset + (uint64_t) n * c->table_size;
+        int i;
+
+        if (qcow2_cache_lookup(c, table_offset) >= 0) {
+            break;
+        }
+        i = qcow2_cache_find_victim(c, true);
+        if (i < 0) {
+            break;
+        }
+
+        /* Mark the entry as in use so that it is not picked twice */
+        if (c->entries[i].offset) {
+            c->evictions++;
+        }
+        qcow2_cache_entry_set_offset(c, i, 0);
+        c->entries[i].ref++;
+        slots[n] = i;
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    buf = qemu_try_blockalign(bs->file->bs, (size_t) n * c->table_size);
+    if (buf) {
+        if (c == s->l2_table_cache) {
+            BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
+        }
+        ret = bdrv_pread(bs->file, offset, (int64_t) n * c->table_size,
+                         buf, 0);
+    } else {
+        ret = -ENOMEM;
+    }
+
+    for (int k = 0; k < n; k++) {
+        Qcow2CachedTable *t = &c->entries[slots[k]];
+        uint64_t table_offset = offset + (uint64_t) k * c->table_size;
+
+        t->ref--;
+        t->referenced = false;
+        if (ret >= 0 && qcow2_cache_lookup(c, table_offset) < 0) {
+            memcpy(qcow2_cache_get_table_addr(c, slots[k]),
+                   (uint8_t *) buf + (size_t) k * c->table_size,
+                   c->table_size);
+            qcow2_cache_entry_set_offset(c, slots[k], table_offset);
+            t->lru_counter = ++c->lru_counter;
+        }
+    }
+
+    qemu_vfree(buf);
+    if (ret < 0) {
+        return ret;
+    }
+
+    c->readahead += n;
+    return n;
+}
+
+void qcow2_cache_get_stats(Qcow2Cache *c, BlockStatsSpecificQcow2Cache *stats)
+{
+    *stats = (BlockStatsSpecificQcow2Cache) {
+        .size = c->size,
+        .used = g_hash_table_size(c->index),
+        .hits = c->hits,
+        .misses = c->misses,
+        .evictions = c->evictions,
+        .readahead = c->readahead,
+    };
+}
@@ -193,6 +193,54 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
     return ret;
 }
 
+/* Offset of the L2 slice covering guest @offset within its L2 table */
+static inline uint64_t l2_slice_start(BDRVQcow2State *s, uint64_t offset)
+{
+    return l2_entry_size(s) *
+        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
+}
+
+/*
+ * l2_readahead
+ *
+ * Loads the L2 slices that cover the guest area starting at @offset into
+ * the L2 cache, as long as they are stored contiguously in the image file
+ * so that a single read request is enough.
+ */
+static void GRAPH_RDLOCK l2_readahead(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t) s->l2_slice_size << s->cluster_bits;
+    uint64_t table_size = (uint64_t) s->l2_slice_size * l2_entry_size(s);
+    uint64_t first = 0;
+    int n;
+
+    for (n = 0; n < QCOW2_L2_READAHEAD; n++, offset += slice_bytes) {
+        uint64_t l1_index = offset_to_l1_index(s, offset);
+        uint64_t l2_offset;
+
+        if (l1_index >= s->l1_size) {
+            break;
+        }
+        l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+        if (!l2_offset || offset_into_cluster(s, l2_offset)) {
+            break;
+        }
+        l2_offset += l2_slice_start(s, offset);
+
+        if (n == 0) {
+            first = l2_offset;
+        } else if (l2_offset != first + n * table_size) {
+            break;
+        }
+    }
+
+    if (n > 0) {
+        /* This is only an optimization, so errors are ignored here */
+        qcow2_cache_readahead(bs, s->l2_table_cache, first, n);
+    }
+}
+
 /*
  * l2_load
  *
@@ -212,11 +260,29 @@ l2_load(BlockDriverState *bs, uint64_t offset,
         uint64_t l2_offset, uint64_t **l2_slice)
 {
     BDRVQcow2State *s = bs->opaque;
-    int start_of_slice = l2_entry_size(s) *
-        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
+    uint64_t slice_offset = l2_offset + l2_slice_start(s, offset);
+    uint64_t slice_bytes = (uint64_t) s->l2_slice_size << s->cluster_bits;
+    uint64_t guest_slice = QEMU_ALIGN_DOWN(offset, slice_bytes);
+    bool readahead = false;
+    int ret;
+
+    /*
+     * A miss on the slice right after the one that was loaded last means
+     * that the guest is most likely scanning the image sequentially, so
+     * fetch the following slices in one go as well.
+     */
+    if (guest_slice != s->l2_readahead_last) {
+        readahead = guest_slice == s->l2_readahead_last + slice_bytes &&
+            !qcow2_cache_is_table_offset(s->l2_table_cache, slice_offset);
+        s->l2_readahead_last = guest_slice;
+    }
 
-    return qcow2_cache_get(bs, s->l2_table_cache, l2_offset + start_of_slice,
-                           (void **)l2_slice);
+    ret = qcow2_cache_get(bs, s->l2_table_cache, slice_offset,
+                          (void **)l2_slice);
+    if (ret == 0 && readahead) {
+        l2_readahead(bs, guest_slice + slice_bytes);
+    }
+    return ret;
 }
 
 /*
@@ -1874,6 +1874,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    s->max_threads = MAX(QCOW2_MAX_THREADS, g_get_num_processors());
+    qemu_co_queue_init(&s->compress_alloc_queue);
 
     return ret;
 
@@ -4661,10 +4663,12 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  QEMUIOVector *qiov, size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret;
+    int ret = 0;
     ssize_t out_len;
     uint8_t *buf, *out_buf;
     uint64_t cluster_offset;
+    /* Requests to one node can run in several threads, s->lock isn't held */
+    uint64_t ticket = qatomic_fetch_inc(&s->compress_alloc_next_ticket);
 
     assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
            (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
@@ -4680,6 +4684,23 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
 
     out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
                                 buf, s->cluster_size);
+
+    qemu_co_mutex_lock(&s->lock);
+    while (s->compress_alloc_ticket != ticket) {
+        qemu_co_queue_wait(&s->compress_alloc_queue, &s->lock);
+    }
+    if (out_len >= 0) {
+        ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
+                                                    &cluster_offset);
+        if (ret == 0) {
+            ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset,
+                                                out_len, true);
+        }
+    }
+    s->compress_alloc_ticket++;
+    qemu_co_queue_restart_all(&s->compress_alloc_queue);
+    qemu_co_mutex_unlock(&s->lock);
+
     if (out_len == -ENOMEM) {
         /* could not compress: write normal cluster */
         ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
@@ -4690,19 +4711,7 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
     } else if (out_len < 0) {
         ret = -EINVAL;
         goto fail;
-    }
-
-    qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
-    if (ret < 0) {
-        qemu_co_mutex_unlock(&s->lock);
-        goto fail;
-    }
-
-    ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
-    qemu_co_mutex_unlock(&s->lock);
-    if (ret < 0) {
+    } else if (ret < 0) {
         goto fail;
     }
 
@@ -4778,7 +4787,8 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         uint64_t chunk_size = MIN(bytes, s->cluster_size);
 
         if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            /* Compression is CPU bound, use as many workers as threads */
+            aio = aio_task_pool_new(MAX(QCOW2_MAX_WORKERS, s->max_threads));
         }
 
         ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
@@ -5311,6 +5321,26 @@ qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2.l2_cache = g_new0(BlockStatsSpecificQcow2Cache, 1);
+    stats->u.qcow2.refcount_cache = g_new0(BlockStatsSpecificQcow2Cache, 1);
+
+    if (s->l2_table_cache) {
+        qcow2_cache_get_stats(s->l2_table_cache, stats->u.qcow2.l2_cache);
+    }
+    if (s->refcount_block_cache) {
+        qcow2_cache_get_stats(s->refcount_block_cache,
+                              stats->u.qcow2.refcount_cache);
+    }
+
+    return stats;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_has_zero_init(BlockDriverState *bs)
 {
@@ -6160,6 +6190,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure                       = qcow2_measure,
     .bdrv_co_get_info                   = qcow2_co_get_info,
     .bdrv_get_specific_info             = qcow2_get_specific_info,
+    .bdrv_get_specific_stats            = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate               = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate               = qcow2_co_load_vmstate,
@@ -114,6 +114,9 @@
 /* Must be at least 2 to cover COW */
 #define MIN_L2_CACHE_SIZE 2 /* cache entries */
 
+/* Maximum number of L2 slices read ahead on a sequential L2 cache miss */
+#define QCOW2_L2_READAHEAD 8 /* cache entries */
+
 /* Must be at least 4 to cover all cases of refcount table growth */
 #define MIN_REFCOUNT_CACHE_SIZE 4 /* clusters */
 
@@ -322,6 +325,7 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+/* Minimum number of compression/encryption threads per image */
 #define QCOW2_MAX_THREADS 4
 
 typedef struct BDRVQcow2State {
@@ -347,6 +351,8 @@ typedef struct BDRVQcow2State {
     Qcow2Cache *refcount_block_cache;
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
+    /* Guest offset of the L2 slice last loaded, for readahead detection */
+    uint64_t l2_readahead_last;
 
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
@@ -410,6 +416,16 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
+
+    /*
+     * Compressed clusters get their host offset in the order in which
+     * their write requests were started, even though they are compressed
+     * in parallel, so that the image is filled sequentially.
+     */
+    CoQueue compress_alloc_queue;
+    uint64_t compress_alloc_next_ticket;
+    uint64_t compress_alloc_ticket;
 
     BdrvChild *data_file;
 
@@ -1018,9 +1034,14 @@ int GRAPH_RDLOCK
 qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
                       void **table);
 
+int GRAPH_RDLOCK
+qcow2_cache_readahead(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
+                      int num_tables);
+
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_get_stats(Qcow2Cache *c, BlockStatsSpecificQcow2Cache *stats);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
@@ -0,0 +1,537 @@
+/*
+ * Shared read cache filter block driver
+ *
+ * Keeps the data read from a read-only node, typically the template image
+ * that the backing files of many VMs point to, in a file that every QEMU
+ * process using the cache maps into its address space, for example in
+ * /dev/shm.  Once one VM has read a block of the template, the others find
+ * it in memory instead of reading it from storage again.
+ *
+ * Blocks are identified by the image they belong to and their index in it,
+ * and are placed in a set-associative table.  Each slot is protected by a
+ * sequence lock in the shared mapping, so that processes never wait for
+ * each other: a reader that sees a slot change while it copies the data
+ * simply treats the lookup as a miss.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include <sys/file.h>
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/atomic.h"
+#include "qemu/memalign.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "qemu/xxhash.h"
+#include "trace.h"
+
+#define SHARED_CACHE_MAGIC          0x4548434143444853ULL /* "SHDCACHE" */
+#define SHARED_CACHE_VERSION        1
+#define SHARED_CACHE_BLOCK_SIZE     (64 * KiB)
+#define SHARED_CACHE_WAYS           8
+#define SHARED_CACHE_HEADER_SIZE    4096
+
+#define SHARED_CACHE_OPT_PATH       "path"
+#define SHARED_CACHE_OPT_SIZE       "size"
+#define SHARED_CACHE_OPT_IMAGE_ID   "image-id"
+
+typedef struct SharedCacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t nb_sets;
+    uint64_t clock;             /* for LRU replacement within a set */
+    uint64_t hits;              /* of all processes */
+    uint64_t misses;
+} SharedCacheHeader;
+
+/*
+ * seq is odd while a process fills the slot.  Readers check that it is
+ * even and unchanged around their copy of the data.
+ */
+typedef struct SharedCacheSlot {
+    uint32_t seq;
+    uint32_t length;            /* shorter than a block at the image end */
+    uint64_t image;             /* 0 if the slot is empty */
+    uint64_t block;
+    uint64_t last_used;
+} SharedCacheSlot;
+
+typedef struct BDRVSharedCacheState {
+    char *path;
+    uint64_t image;
+    int64_t image_size;
+
+    void *map;
+    size_t map_size;
+    SharedCacheHeader *header;
+    SharedCacheSlot *slots;
+    uint8_t *data;
+    uint64_t nb_sets;
+
+    /* Statistics of this node */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+} BDRVSharedCacheState;
+
+static QemuOptsList runtime_opts = {
+    .name = "shared-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = SHARED_CACHE_OPT_PATH,
+            .type = QEMU_OPT_STRING,
+            .help = "file that holds the cache, shared by all its users",
+        },
+        {
+            .name = SHARED_CACHE_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "capacity of the cache if it is created, default 1G",
+        },
+        {
+            .name = SHARED_CACHE_OPT_IMAGE_ID,
+            .type = QEMU_OPT_STRING,
+            .help = "identifier of the image contents",
+        },
+        { /* end of list */ }
+    },
+};
+
+static size_t shared_cache_slots_size(uint64_t nb_sets)
+{
+    return ROUND_UP(nb_sets * SHARED_CACHE_WAYS * sizeof(SharedCacheSlot),
+                    SHARED_CACHE_HEADER_SIZE);
+}
+
+static size_t shared_cache_map_size(uint64_t nb_sets)
+{
+    return SHARED_CACHE_HEADER_SIZE + shared_cache_slots_size(nb_sets) +
+           nb_sets * SHARED_CACHE_WAYS * SHARED_CACHE_BLOCK_SIZE;
+}
+
+/* 64-bit FNV-1a; 0 is reserved for empty slots */
+static uint64_t shared_cache_hash(const char *str)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (; *str; str++) {
+        h = (h ^ (uint8_t)*str) * 0x100000001b3ULL;
+    }
+    return h ?: 1;
+}
+
+/*
+ * Unless the user names the image contents, identify them by the file of
+ * the child node, including its inode and modification time so that an
+ * image that is replaced does not hit on stale data.
+ */
+static uint64_t shared_cache_image_key(BlockDriverState *child_bs,
+                                       const char *image_id)
+{
+    g_autofree char *id = NULL;
+    struct stat st;
+
+    if (image_id) {
+        return shared_cache_hash(image_id);
+    }
+
+    if (stat(child_bs->filename, &st) == 0) {
+        id = g_strdup_printf("%s:%" PRIu64 ":%" PRIu64 ":%" PRId64 ":%" PRId64,
+                             child_bs->filename, (uint64_t)st.st_dev,
+                             (uint64_t)st.st_ino, (int64_t)st.st_size,
+                             (int64_t)st.st_mtime);
+    } else {
+        id = g_strdup(child_bs->filename);
+    }
+    return shared_cache_hash(id);
+}
+
+static int shared_cache_map(BDRVSharedCacheState *s, uint64_t size,
+                            Error **errp)
+{
+    SharedCacheHeader h;
+    struct stat st;
+    bool create;
+    void *map;
+    int fd, ret;
+
+    fd = qemu_create(s->path, O_RDWR, 0600, errp);
+    if (fd < 0) {
+        return fd;
+    }
+
+    /* Serialize the setup of a new cache with other processes */
+    if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0) {
+        ret = -errno;
+        error_setg_errno(errp, errno, "Could not lock '%s'", s->path);
+        goto out;
+    }
+
+    create = st.st_size == 0;
+    if (create) {
+        s->nb_sets = MAX(size / (SHARED_CACHE_WAYS * SHARED_CACHE_BLOCK_SIZE),
+                         1);
+        s->map_size = shared_cache_map_size(s->nb_sets);
+        if (ftruncate(fd, s->map_size) < 0) {
+            ret = -errno;
+            error_setg_errno(errp, errno, "Could not resize '%s'", s->path);
+            goto out;
+        }
+    } else {
+        if (pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+            h.magic != SHARED_CACHE_MAGIC ||
+            h.version != SHARED_CACHE_VERSION ||
+            h.block_size != SHARED_CACHE_BLOCK_SIZE ||
+            h.nb_sets == 0 ||
+            h.nb_sets > st.st_size / SHARED_CACHE_BLOCK_SIZE ||
+            shared_cache_map_size(h.nb_sets) > st.st_size) {
+            ret = -EINVAL;
+            error_setg(errp, "'%s' is not a shared cache", s->path);
+            goto out;
+        }
+        s->nb_sets = h.nb_sets;
+        s->map_size = shared_cache_map_size(s->nb_sets);
+    }
+
+    map = mmap(NULL, s->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        ret = -errno;
+        error_setg_errno(errp, errno, "Could not map '%s'", s->path);
+        goto out;
+    }
+
+    s->map = map;
+    s->header = map;
+    s->slots = map + SHARED_CACHE_HEADER_SIZE;
+    s->data = map + SHARED_CACHE_HEADER_SIZE +
+              shared_cache_slots_size(s->nb_sets);
+
+    /* The file was zero-filled by ftruncate(), so all slots are empty */
+    if (create) {
+        s->header->version = SHARED_CACHE_VERSION;
+        s->header->block_size = SHARED_CACHE_BLOCK_SIZE;
+        s->header->nb_sets = s->nb_sets;
+        qatomic_store_release(&s->header->magic, SHARED_CACHE_MAGIC);
+    }
+
+    trace_shared_cache_map(s->path, s->nb_sets * SHARED_CACHE_WAYS, create);
+    ret = 0;
+
+out:
+    flock(fd, LOCK_UN);
+    close(fd);
+    return ret;
+}
+
+static int shared_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                             Error **errp)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+    QemuOpts *opts;
+    uint64_t size;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    if (flags & BDRV_O_RDWR) {
+        error_setg(errp, "The shared-cache filter only supports read-only "
+                   "nodes");
+        return -EINVAL;
+    }
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    s->path = g_strdup(qemu_opt_get(opts, SHARED_CACHE_OPT_PATH));
+    if (!s->path) {
+        error_setg(errp, "Parameter '" SHARED_CACHE_OPT_PATH "' is required");
+        ret = -EINVAL;
+        goto out;
+    }
+    size = qemu_opt_get_size(opts, SHARED_CACHE_OPT_SIZE, 1 * GiB);
+
+    bdrv_graph_rdlock_main_loop();
+    s->image = shared_cache_image_key(bs->file->bs,
+                                      qemu_opt_get(opts,
+                                                   SHARED_CACHE_OPT_IMAGE_ID));
+    s->image_size = bdrv_getlength(bs->file->bs);
+    bdrv_graph_rdunlock_main_loop();
+    if (s->image_size < 0) {
+        ret = s->image_size;
+        error_setg_errno(errp, -ret, "Could not get the image size");
+        goto out;
+    }
+
+    ret = shared_cache_map(s, size, errp);
+
+out:
+    qemu_opts_del(opts);
+    if (ret < 0) {
+        g_free(s->path);
+    }
+    return ret;
+}
+
+static void shared_cache_close(BlockDriverState *bs)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+
+    munmap(s->map, s->map_size);
+    g_free(s->path);
+}
+
+static SharedCacheSlot *shared_cache_set(BDRVSharedCacheState *s,
+                                         uint64_t block)
+{
+    uint64_t set = qemu_xxhash4(s->image, block) % s->nb_sets;
+
+    return &s->slots[set * SHARED_CACHE_WAYS];
+}
+
+static uint8_t *shared_cache_slot_data(BDRVSharedCacheState *s,
+                                       SharedCacheSlot *slot)
+{
+    return s->data + (slot - s->slots) * SHARED_CACHE_BLOCK_SIZE;
+}
+
+/*
+ * Copy @bytes at @offset in @block to @qiov if the block is cached.  The
+ * copy may be partial if the slot was replaced meanwhile, but then false
+ * is returned and the caller reads the data again.
+ */
+static bool shared_cache_lookup(BDRVSharedCacheState *s, uint64_t block,
+                                size_t offset, size_t bytes,
+                                QEMUIOVector *qiov, size_t qiov_offset)
+{
+    SharedCacheSlot *set = shared_cache_set(s, block);
+    int i;
+
+    for (i = 0; i < SHARED_CACHE_WAYS; i++) {
+        SharedCacheSlot *slot = &set[i];
+        uint32_t seq = qatomic_load_acquire(&slot->seq);
+
+        if ((seq & 1) ||
+            qatomic_read(&slot->image) != s->image ||
+            qatomic_read(&slot->block) != block ||
+            qatomic_read(&slot->length) < offset + bytes) {
+            continue;
+        }
+
+        qemu_iovec_from_buf(qiov, qiov_offset,
+                            shared_cache_slot_data(s, slot) + offset, bytes);
+        smp_rmb();
+        if (qatomic_read(&slot->seq) != seq) {
+            return false;
+        }
+
+        qatomic_set(&slot->last_used, qatomic_fetch_inc(&s->header->clock));
+        return true;
+    }
+
+    return false;
+}
+
+/* Store @length bytes of @block from @buf, unless another process is faster */
+static void shared_cache_insert(BDRVSharedCacheState *s, uint64_t block,
+                                const uint8_t *buf, size_t length)
+{
+    SharedCacheSlot *set = shared_cache_set(s, block);
+    SharedCacheSlot *victim = NULL;
+    uint64_t victim_image = 0, victim_last_used = 0;
+    uint32_t seq;
+    int i;
+
+    for (i = 0; i < SHARED_CACHE_WAYS; i++) {
+        SharedCacheSlot *slot = &set[i];
+        uint64_t image, last_used;
+
+        /*
+         * Skip slots that are being filled.  A process that died while
+         * filling one leaves it odd for good; since nothing else changes
+         * in such a slot, picking it as the victim would block the whole
+         * set.  The set then only loses that way.
+         */
+        if (qatomic_read(&slot->seq) & 1) {
+            continue;
+        }
+
+        image = qatomic_read(&slot->image);
+        last_used = qatomic_read(&slot->last_used);
+        if (image == s->image && qatomic_read(&slot->block) == block) {
+            return;
+        }
+        if (!victim || (victim_image &&
+                        (!image || last_used < victim_last_used))) {
+            victim = slot;
+            victim_image = image;
+            victim_last_used = last_used;
+        }
+    }
+    if (!victim) {
+        return;
+    }
+
+    seq = qatomic_read(&victim->seq);
+    if ((seq & 1) || qatomic_cmpxchg(&victim->seq, seq, seq + 1) != seq) {
+        return;
+    }
+
+    if (qatomic_read(&victim->image)) {
+        qatomic_inc(&s->evictions);
+    }
+    qatomic_set(&victim->image, s->image);
+    qatomic_set(&victim->block, block);
+    qatomic_set(&victim->length, length);
+    memcpy(shared_cache_slot_data(s, victim), buf, length);
+    qatomic_set(&victim->last_used, qatomic_fetch_inc(&s->header->clock));
+    qatomic_store_release(&victim->seq, seq + 2);
+
+    qatomic_inc(&s->inserts);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+shared_cache_co_preadv_part(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, QEMUIOVector *qiov,
+                            size_t qiov_offset, BdrvRequestFlags flags)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+    uint8_t *bounce = NULL;
+    int ret = 0;
+
+    while (bytes > 0) {
+        uint64_t block = offset / SHARED_CACHE_BLOCK_SIZE;
+        int64_t block_start = block * SHARED_CACHE_BLOCK_SIZE;
+        size_t block_len, in_block, n;
+
+        if (block_start >= s->image_size) {
+            /* Past the size the image had when we opened it */
+            ret = bdrv_co_preadv_part(bs->file, offset, bytes, qiov,
+                                      qiov_offset, flags);
+            break;
+        }
+
+        block_len = MIN(SHARED_CACHE_BLOCK_SIZE, s->image_size - block_start);
+        in_block = offset - block_start;
+        n = MIN(bytes, SHARED_CACHE_BLOCK_SIZE - in_block);
+
+        if (in_block + n <= block_len &&
+            shared_cache_lookup(s, block, in_block, n, qiov, qiov_offset)) {
+            qatomic_inc(&s->hits);
+            qatomic_inc(&s->header->hits);
+            goto next;
+        }
+
+        qatomic_inc(&s->misses);
+        qatomic_inc(&s->header->misses);
+
+        /*
+         * Always read through a private buffer: the caller's buffer may be
+         * guest memory, which the guest could modify before we copy it to
+         * the cache that other VMs read from.
+         */
+        if (!bounce) {
+            bounce = qemu_try_blockalign(bs->file->bs,
+                                         SHARED_CACHE_BLOCK_SIZE);
+            if (!bounce) {
+                ret = -ENOMEM;
+                break;
+            }
+        }
+
+        ret = bdrv_co_pread(bs->file, block_start, block_len, bounce, 0);
+        if (ret < 0) {
+            break;
+        }
+        shared_cache_insert(s, block, bounce, block_len);
+
+        if (in_block + n > block_len) {
+            /* The image has grown, which should not happen for templates */
+            ret = bdrv_co_preadv_part(bs->file, offset, n, qiov, qiov_offset,
+                                      flags);
+            if (ret < 0) {
+                break;
+            }
+        } else {
+            qemu_iovec_from_buf(qiov, qiov_offset, bounce + in_block, n);
+        }
+
+next:
+        offset += n;
+        qiov_offset += n;
+        bytes -= n;
+    }
+
+    qemu_vfree(bounce);
+    return ret < 0 ? ret : 0;
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+shared_cache_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static BlockStatsSpecific *shared_cache_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+    BDRVSharedCacheState *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_SHARED_CACHE;
+    stats->u.shared_cache = (BlockStatsSpecificSharedCache) {
+        .size = s->nb_sets * SHARED_CACHE_WAYS * SHARED_CACHE_BLOCK_SIZE,
+        .hits = qatomic_read(&s->hits),
+        .misses = qatomic_read(&s->misses),
+        .inserts = qatomic_read(&s->inserts),
+        .evictions = qatomic_read(&s->evictions),
+        .host_hits = qatomic_read(&s->header->hits),
+        .host_misses = qatomic_read(&s->header->misses),
+    };
+
+    return stats;
+}
+
+static const char *const shared_cache_strong_runtime_opts[] = {
+    SHARED_CACHE_OPT_PATH,
+    SHARED_CACHE_OPT_IMAGE_ID,
+
+    NULL
+};
+
+static BlockDriver bdrv_shared_cache = {
+    .format_name                        = "shared-cache",
+    .instance_size                      = sizeof(BDRVSharedCacheState),
+
+    .bdrv_open                          = shared_cache_open,
+    .bdrv_close                         = shared_cache_close,
+    .bdrv_child_perm                    = bdrv_default_perms,
+
+    .bdrv_co_getlength                  = shared_cache_co_getlength,
+    .bdrv_co_preadv_part                = shared_cache_co_preadv_part,
+
+    .bdrv_get_specific_stats            = shared_cache_get_specific_stats,
+
+    .strong_runtime_opts                = shared_cache_strong_runtime_opts,
+    .is_filter                          = true,
+};
+
+static void bdrv_shared_cache_init(void)
+{
+    bdrv_register(&bdrv_shared_cache);
+}
+
+block_init(bdrv_shared_cache_init);
@@ -14,12 +14,16 @@
 #include "qemu/osdep.h"
 #include "qom/object_interfaces.h"
 #include "qapi/error.h"
+#include "qapi/qapi-builtin-visit.h"
+#include "qapi/visitor.h"
+#include "qemu/bitmap.h"
 #include "block/thread-pool.h"
 #include "sysemu/event-loop-base.h"
 
 typedef struct {
     const char *name;
     ptrdiff_t offset; /* field's byte offset in EventLoopBase struct */
+    int64_t min;
 } EventLoopBaseParamInfo;
 
 static void event_loop_base_instance_init(Object *obj)
@@ -27,11 +31,22 @@ static void event_loop_base_instance_init(Object *obj)
     EventLoopBase *base = EVENT_LOOP_BASE(obj);
 
     base->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    base->io_uring_sqpoll_cpu = -1;
+}
+
+static void event_loop_base_instance_finalize(Object *obj)
+{
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+
+    g_free(base->thread_pool_cpus);
 }
 
 static EventLoopBaseParamInfo aio_max_batch_info = {
     "aio-max-batch", offsetof(EventLoopBase, aio_max_batch),
 };
+static EventLoopBaseParamInfo io_uring_sqpoll_cpu_info = {
+    "io-uring-sqpoll-cpu", offsetof(EventLoopBase, io_uring_sqpoll_cpu), -1,
+};
 static EventLoopBaseParamInfo thread_pool_min_info = {
     "thread-pool-min", offsetof(EventLoopBase, thread_pool_min),
 };
@@ -62,9 +77,9 @@ static void event_loop_base_set_param(Object *obj, Visitor *v,
         return;
     }
 
-    if (value < 0) {
-        error_setg(errp, "%s value must be in range [0, %" PRId64 "]",
-                   info->name, INT64_MAX);
+    if (value < info->min) {
+        error_setg(errp, "%s value must be in range [%" PRId64 ", %" PRId64 "]",
+                   info->name, info->min, INT64_MAX);
         return;
     }
 
@@ -77,6 +92,57 @@ static void event_loop_base_set_param(Object *obj, Visitor *v,
     return;
 }
 
+static void event_loop_base_get_thread_pool_cpus(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+    uint16List *host_cpus = NULL;
+    uint16List **tail = &host_cpus;
+    unsigned long value;
+
+    if (base->thread_pool_cpus) {
+        value = find_first_bit(base->thread_pool_cpus,
+                               base->thread_pool_cpus_nbits);
+        while (value < base->thread_pool_cpus_nbits) {
+            QAPI_LIST_APPEND(tail, value);
+            value = find_next_bit(base->thread_pool_cpus,
+                                  base->thread_pool_cpus_nbits, value + 1);
+        }
+    }
+
+    visit_type_uint16List(v, name, &host_cpus, errp);
+    qapi_free_uint16List(host_cpus);
+}
+
+static void event_loop_base_set_thread_pool_cpus(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(obj);
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+    uint16List *l, *host_cpus = NULL;
+    unsigned long nbits = 0;
+
+    if (!visit_type_uint16List(v, name, &host_cpus, errp)) {
+        return;
+    }
+
+    for (l = host_cpus; l; l = l->next) {
+        nbits = MAX(nbits, l->value + 1);
+    }
+
+    g_free(base->thread_pool_cpus);
+    base->thread_pool_cpus = nbits ? bitmap_new(nbits) : NULL;
+    base->thread_pool_cpus_nbits = nbits;
+    for (l = host_cpus; l; l = l->next) {
+        set_bit(l->value, base->thread_pool_cpus);
+    }
+    qapi_free_uint16List(host_cpus);
+
+    if (bc->update_params) {
+        bc->update_params(base, errp);
+    }
+}
+
 static void event_loop_base_complete(UserCreatable *uc, Error **errp)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(uc);
@@ -109,6 +175,10 @@ static void event_loop_base_class_init(ObjectClass *klass, void *class_data)
                               event_loop_base_get_param,
                               event_loop_base_set_param,
                               NULL, &aio_max_batch_info);
+    object_class_property_add(klass, "io-uring-sqpoll-cpu", "int",
+                              event_loop_base_get_param,
+                              event_loop_base_set_param,
+                              NULL, &io_uring_sqpoll_cpu_info);
     object_class_property_add(klass, "thread-pool-min", "int",
                               event_loop_base_get_param,
                               event_loop_base_set_param,
@@ -117,6 +187,10 @@ static void event_loop_base_class_init(ObjectClass *klass, void *class_data)
                               event_loop_base_get_param,
                               event_loop_base_set_param,
                               NULL, &thread_pool_max_info);
+    object_class_property_add(klass, "thread-pool-cpu-affinity", "int",
+                              event_loop_base_get_thread_pool_cpus,
+                              event_loop_base_set_thread_pool_cpus,
+                              NULL, NULL);
 }
 
 static const TypeInfo event_loop_base_info = {
@@ -124,6 +198,7 @@ static const TypeInfo event_loop_base_info = {
     .parent = TYPE_OBJECT,
     .instance_size = sizeof(EventLoopBase),
     .instance_init = event_loop_base_instance_init,
+    .instance_finalize = event_loop_base_instance_finalize,
     .class_size = sizeof(EventLoopBaseClass),
     .class_init = event_loop_base_class_init,
     .abstract = true,
@@ -17,6 +17,7 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/defer-call.h"
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
@@ -1883,6 +1884,17 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+/*
+ * Backends that deliver a burst of packets inside a
+ * defer_call_begin()/defer_call_end() section get one interrupt per burst.
+ */
+static void virtio_net_rx_notify_deferred_fn(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    virtio_notify(VIRTIO_DEVICE(q->n), q->rx_vq);
+}
+
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                       size_t size, bool no_rss)
 {
@@ -2013,7 +2025,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    defer_call(virtio_net_rx_notify_deferred_fn, q);
 
     return size;
 
@@ -2678,7 +2690,11 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *elems[VIRTQUEUE_POP_BATCH_SIZE];
+    unsigned int lens[VIRTQUEUE_POP_BATCH_SIZE] = {};
+    unsigned int i, num, sent;
     int32_t num_packets = 0;
+    int32_t ret = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
@@ -2689,83 +2705,115 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
-    for (;;) {
-        ssize_t ret;
-        unsigned int out_num;
-        struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
+    /* Let the backend submit the whole burst at once */
+    defer_call_begin();
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
+    while (num_packets < n->tx_burst) {
+        num = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                  (void **)elems,
+                                  MIN(ARRAY_SIZE(elems),
+                                      n->tx_burst - num_packets));
+        if (!num) {
             break;
         }
 
-        out_num = elem->out_num;
-        out_sg = elem->out_sg;
-        if (out_num < 1) {
-            virtio_error(vdev, "virtio-net header not in first element");
-            virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
-            return -EINVAL;
-        }
-
-        if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
-                n->guest_hdr_len) {
-                virtio_error(vdev, "virtio-net header incorrect");
-                virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
-                return -EINVAL;
+        for (sent = 0; sent < num; sent++) {
+            ssize_t len;
+            unsigned int out_num;
+            struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1];
+            struct iovec *out_sg;
+            struct virtio_net_hdr_mrg_rxbuf mhdr;
+
+            elem = elems[sent];
+            out_num = elem->out_num;
+            out_sg = elem->out_sg;
+            if (out_num < 1) {
+                virtio_error(vdev, "virtio-net header not in first element");
+                ret = -EINVAL;
+                break;
             }
-            if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
-                sg2[0].iov_len = n->guest_hdr_len;
-                out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
-                                   out_sg, out_num,
-                                   n->guest_hdr_len, -1);
-                if (out_num == VIRTQUEUE_MAX_SIZE) {
-                    goto drop;
+
+            if (n->has_vnet_hdr) {
+                if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+                    n->guest_hdr_len) {
+                    virtio_error(vdev, "virtio-net header incorrect");
+                    ret = -EINVAL;
+                    break;
                 }
-                out_num += 1;
-                out_sg = sg2;
-            }
-        }
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                if (n->needs_vnet_hdr_swap) {
+                    virtio_net_hdr_swap(vdev, (void *) &mhdr);
+                    sg2[0].iov_base = &mhdr;
+                    sg2[0].iov_len = n->guest_hdr_len;
+                    out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
                                        out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
+                                       n->guest_hdr_len, -1);
+                    if (out_num == VIRTQUEUE_MAX_SIZE) {
+                        continue; /* drop */
+                    }
+                    out_num += 1;
+                    out_sg = sg2;
+                }
+            }
+            /*
+             * If host wants to see the guest header as is, we can
+             * pass it on unchanged. Otherwise, copy just the parts
+             * that host is interested in.
+             */
+            assert(n->host_hdr_len <= n->guest_hdr_len);
+            if (n->host_hdr_len != n->guest_hdr_len) {
+                unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                                           out_sg, out_num,
+                                           0, n->host_hdr_len);
+                sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
+                                 out_sg, out_num,
+                                 n->guest_hdr_len, -1);
+                out_num = sg_num;
+                out_sg = sg;
+            }
+
+            len = qemu_sendv_packet_async(qemu_get_subqueue(n->nic,
+                                                            queue_index),
+                                          out_sg, out_num,
+                                          virtio_net_tx_complete);
+            if (len == 0) {
+                virtio_queue_set_notification(q->tx_vq, 0);
+                q->async_tx.elem = elem;
+                ret = -EBUSY;
+                break;
+            }
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
-        if (ret == 0) {
-            virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
-            return -EBUSY;
+        /* Packets that were sent or dropped are completed together */
+        if (sent) {
+            virtqueue_push_batch(q->tx_vq, elems, lens, sent);
+            virtio_notify(vdev, q->tx_vq);
+            for (i = 0; i < sent; i++) {
+                g_free(elems[i]);
+            }
+            num_packets += sent;
         }
 
-drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        if (ret == -EBUSY) {
+            /* The rest of the batch is fetched again once the queue drains */
+            virtqueue_unpop_batch(q->tx_vq, elems + sent + 1,
+                                  num - sent - 1);
+            for (i = sent + 1; i < num; i++) {
+                g_free(elems[i]);
+            }
+            break;
+        }
 
-        if (++num_packets >= n->tx_burst) {
+        if (ret == -EINVAL) {
+            for (i = sent; i < num; i++) {
+                virtqueue_detach_element(q->tx_vq, elems[i], 0);
+                g_free(elems[i]);
+            }
             break;
         }
     }
-    return num_packets;
+
+    defer_call_end();
+    return ret < 0 ? ret : num_packets;
 }
 
 static void virtio_net_tx_timer(void *opaque);
@@ -196,6 +196,7 @@
 #include "qemu/log.h"
 #include "qemu/units.h"
 #include "qemu/range.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
 #include "sysemu/sysemu.h"
@@ -254,6 +255,8 @@ static const uint32_t nvme_feature_cap[NVME_FID_MAX] = {
     [NVME_ERROR_RECOVERY]           = NVME_FEAT_CAP_CHANGE | NVME_FEAT_CAP_NS,
     [NVME_VOLATILE_WRITE_CACHE]     = NVME_FEAT_CAP_CHANGE,
     [NVME_NUMBER_OF_QUEUES]         = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_COALESCING]     = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_VECTOR_CONF]    = NVME_FEAT_CAP_CHANGE,
     [NVME_ASYNCHRONOUS_EVENT_CONF]  = NVME_FEAT_CAP_CHANGE,
     [NVME_TIMESTAMP]                = NVME_FEAT_CAP_CHANGE,
     [NVME_HOST_BEHAVIOR_SUPPORT]    = NVME_FEAT_CAP_CHANGE,
@@ -1482,12 +1485,61 @@ static void nvme_update_cq_head(NvmeCQueue *cq)
     trace_pci_nvme_update_cq_head(cq->cqid, cq->head);
 }
 
+/*
+ * Interrupt coalescing (Feature Identifier 08h) applies to I/O completion
+ * queues whose vector does not have Coalescing Disable set.  The admin
+ * queue's vector always reports Coalescing Disable, so I/O queues sharing it
+ * are not coalesced either.  The interrupt is raised once more than THR
+ * entries were posted, or when TIME (in 100 microsecond units) has elapsed
+ * since the first of them.  A TIME of zero disables the delay and thus
+ * coalescing.
+ *
+ * Returns true if the interrupt for the entries just posted was delayed.
+ */
+static bool nvme_cq_coalesce(NvmeCtrl *n, NvmeCQueue *cq, uint32_t posted)
+{
+    uint8_t thr = NVME_INTC_THR(n->features.int_coalescing);
+    uint8_t time = NVME_INTC_TIME(n->features.int_coalescing);
+
+    if (!cq->cqid || !cq->irq_enabled || !thr || !time ||
+        cq->vector == n->admin_cq.vector ||
+        test_bit(cq->vector, n->features.int_vc_cd)) {
+        return false;
+    }
+
+    cq->coalesced += posted;
+    if (cq->coalesced > thr) {
+        cq->coalesced = 0;
+        timer_del(cq->coalesce_timer);
+        return false;
+    }
+
+    if (!timer_pending(cq->coalesce_timer)) {
+        timer_mod(cq->coalesce_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + time * 100 * SCALE_US);
+    }
+
+    trace_pci_nvme_irq_coalesced(cq->cqid, cq->coalesced);
+    return true;
+}
+
+static void nvme_cq_coalesce_timer(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    cq->coalesced = 0;
+    if (cq->tail != cq->head) {
+        nvme_irq_assert(cq->ctrl, cq);
+    }
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
     bool pending = cq->head != cq->tail;
+    uint32_t posted = 0;
     int ret;
 
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
@@ -1520,12 +1572,17 @@ static void nvme_post_cqes(void *opaque)
         nvme_inc_cq_tail(cq);
         nvme_sg_unmap(&req->sg);
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
+        posted++;
     }
     if (cq->tail != cq->head) {
         if (cq->irq_enabled && !pending) {
             n->cq_pending++;
         }
 
+        if (posted && nvme_cq_coalesce(n, cq, posted)) {
+            return;
+        }
+
         nvme_irq_assert(n, cq);
     }
 }
@@ -5216,6 +5273,7 @@ static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 
     n->cq[cq->cqid] = NULL;
     qemu_bh_delete(cq->bh);
+    timer_free(cq->coalesce_timer);
     if (cq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &cq->notifier);
@@ -5289,6 +5347,9 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     n->cq[cqid] = cq;
     cq->bh = qemu_bh_new_guarded(nvme_post_cqes, cq,
                                  &DEVICE(cq->ctrl)->mem_reentrancy_guard);
+    cq->coalesced = 0;
+    cq->coalesce_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                      nvme_cq_coalesce_timer, cq);
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -5978,6 +6039,21 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeRequest *req)
         }
         trace_pci_nvme_getfeat_vwcache(result ? "enabled" : "disabled");
         goto out;
+    case NVME_INTERRUPT_COALESCING:
+        result = n->features.int_coalescing;
+        goto out;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->conf_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        result = iv;
+        if (iv == n->admin_cq.vector ||
+            test_bit(iv, n->features.int_vc_cd)) {
+            result |= NVME_INTVC_NOCOALESCING;
+        }
+        goto out;
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         result = n->features.async_config;
         goto out;
@@ -6141,6 +6217,7 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     uint8_t fid = NVME_GETSETFEAT_FID(dw10);
     uint8_t save = NVME_SETFEAT_SAVE(dw10);
     uint16_t status;
+    uint16_t iv;
     int i;
 
     trace_pci_nvme_setfeat(nvme_cid(req), nsid, fid, save, dw11);
@@ -6257,6 +6334,22 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
         req->cqe.result = cpu_to_le32((n->conf_ioqpairs - 1) |
                                       ((n->conf_ioqpairs - 1) << 16));
         break;
+    case NVME_INTERRUPT_COALESCING:
+        n->features.int_coalescing = dw11 & 0xffff;
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->conf_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        /* Interrupt coalescing never applies to the admin queue */
+        if (dw11 & NVME_INTVC_NOCOALESCING || iv == n->admin_cq.vector) {
+            set_bit(iv, n->features.int_vc_cd);
+        } else {
+            clear_bit(iv, n->features.int_vc_cd);
+        }
+        break;
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         n->features.async_config = dw11;
         break;
@@ -7922,6 +8015,7 @@ static void nvme_init_state(NvmeCtrl *n)
     n->features.temp_thresh_hi = NVME_TEMPERATURE_WARNING;
     n->starttime_ms = qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL);
     n->aer_reqs = g_new0(NvmeRequest *, n->params.aerl + 1);
+    n->features.int_vc_cd = bitmap_new(PCI_MSIX_FLAGS_QSIZE + 1);
     QTAILQ_INIT(&n->aer_queue);
 
     list->numcntl = cpu_to_le16(max_vfs);
@@ -8365,6 +8459,7 @@ static void nvme_exit(PCIDevice *pci_dev)
     g_free(n->cq);
     g_free(n->sq);
     g_free(n->aer_reqs);
+    g_free(n->features.int_vc_cd);
 
     if (n->params.cmb_size_mb) {
         g_free(n->cmb.buf);
@@ -494,6 +494,9 @@ typedef struct NvmeCQueue {
     QEMUBH      *bh;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
+    /* entries posted since the last interrupt while coalescing */
+    uint32_t    coalesced;
+    QEMUTimer   *coalesce_timer;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
@@ -594,6 +597,9 @@ typedef struct NvmeCtrl {
 
         uint32_t                async_config;
         NvmeHostBehaviorSupport hbs;
+        uint32_t                int_coalescing;
+        /* vectors with Coalescing Disable set, indexed by vector */
+        unsigned long           *int_vc_cd;
     } features;
 
     NvmePriCtrlCap  pri_ctrl_cap;
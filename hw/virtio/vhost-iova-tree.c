@@ -28,8 +28,36 @@ struct VhostIOVATree {
 
     /* IOVA address to qemu memory maps. */
     IOVATree *iova_taddr_map;
+
+    /*
+     * Copies of the maps indexed by qemu memory address, for reverse
+     * translations.  Only valid while no two maps overlap in qemu memory;
+     * reverse translations walk iova_taddr_map once that happened.
+     */
+    GTree *taddr_iova_map;
+    bool taddr_overlap;
+
+    /* Incremented every time a map is removed */
+    uint64_t generation;
 };
 
+static gint vhost_iova_tree_taddr_compare(gconstpointer a, gconstpointer b,
+                                          gpointer data)
+{
+    const DMAMap *m1 = a, *m2 = b;
+
+    if (m1->translated_addr > m2->translated_addr + m2->size) {
+        return 1;
+    }
+
+    if (m1->translated_addr + m1->size < m2->translated_addr) {
+        return -1;
+    }
+
+    /* Overlapped */
+    return 0;
+}
+
 /**
  * Create a new IOVA tree
  *
@@ -44,6 +72,10 @@ VhostIOVATree *vhost_iova_tree_new(hwaddr iova_first, hwaddr iova_last)
     tree->iova_last = iova_last;
 
     tree->iova_taddr_map = iova_tree_new();
+    tree->taddr_iova_map = g_tree_new_full(vhost_iova_tree_taddr_compare,
+                                           NULL, g_free, NULL);
+    tree->taddr_overlap = false;
+    tree->generation = 0;
     return tree;
 }
 
@@ -53,6 +85,7 @@ VhostIOVATree *vhost_iova_tree_new(hwaddr iova_first, hwaddr iova_last)
 void vhost_iova_tree_delete(VhostIOVATree *iova_tree)
 {
     iova_tree_destroy(iova_tree->iova_taddr_map);
+    g_tree_destroy(iova_tree->taddr_iova_map);
     g_free(iova_tree);
 }
 
@@ -67,9 +100,24 @@ void vhost_iova_tree_delete(VhostIOVATree *iova_tree)
 const DMAMap *vhost_iova_tree_find_iova(const VhostIOVATree *tree,
                                         const DMAMap *map)
 {
+    if (likely(!tree->taddr_overlap)) {
+        return g_tree_lookup(tree->taddr_iova_map, map);
+    }
+
     return iova_tree_find_iova(tree->iova_taddr_map, map);
 }
 
+/**
+ * Return a number that changes every time a map is removed from @tree, so
+ * that translations cached by the caller can be checked for staleness.
+ *
+ * @tree: The iova tree
+ */
+uint64_t vhost_iova_tree_generation(const VhostIOVATree *tree)
+{
+    return tree->generation;
+}
+
 /**
  * Allocate a new mapping
  *
@@ -87,6 +135,7 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
 {
     /* Some vhost devices do not like addr 0. Skip first page */
     hwaddr iova_first = tree->iova_first ?: qemu_real_host_page_size();
+    int r;
 
     if (map->translated_addr + map->size < map->translated_addr ||
         map->perm == IOMMU_NONE) {
@@ -94,8 +143,20 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
     }
 
     /* Allocate a node in IOVA address */
-    return iova_tree_alloc_map(tree->iova_taddr_map, map, iova_first,
-                               tree->iova_last);
+    r = iova_tree_alloc_map(tree->iova_taddr_map, map, iova_first,
+                            tree->iova_last);
+    if (r != IOVA_OK || tree->taddr_overlap) {
+        return r;
+    }
+
+    if (g_tree_lookup(tree->taddr_iova_map, map)) {
+        tree->taddr_overlap = true;
+    } else {
+        DMAMap *copy = g_memdup2(map, sizeof(*map));
+
+        g_tree_insert(tree->taddr_iova_map, copy, copy);
+    }
+    return r;
 }
 
 /**
@@ -106,5 +167,11 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
  */
 void vhost_iova_tree_remove(VhostIOVATree *iova_tree, DMAMap map)
 {
+    const DMAMap *indexed = g_tree_lookup(iova_tree->taddr_iova_map, &map);
+
+    if (indexed && indexed->iova == map.iova) {
+        g_tree_remove(iova_tree->taddr_iova_map, indexed);
+    }
     iova_tree_remove(iova_tree->iova_taddr_map, map);
+    iova_tree->generation++;
 }
@@ -71,6 +71,45 @@ uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
     return svq->num_free;
 }
 
+/**
+ * Find the map of the iova tree that contains the start of a guest buffer,
+ * looking at the maps that translated the previous buffers first.
+ *
+ * @svq: Shadow VirtQueue
+ * @needle: The qemu's VA range of the buffer
+ */
+static const DMAMap *vhost_svq_find_map(VhostShadowVirtqueue *svq,
+                                        const DMAMap *needle)
+{
+    uint64_t gen = vhost_iova_tree_generation(svq->iova_tree);
+    const DMAMap *map;
+
+    if (unlikely(gen != svq->map_cache_gen)) {
+        for (unsigned i = 0; i < SVQ_MAP_CACHE_SIZE; ++i) {
+            svq->map_cache[i].perm = IOMMU_NONE;
+        }
+        svq->map_cache_gen = gen;
+    }
+
+    for (unsigned i = 0; i < SVQ_MAP_CACHE_SIZE; ++i) {
+        map = &svq->map_cache[i];
+        if (map->perm != IOMMU_NONE &&
+            needle->translated_addr >= map->translated_addr &&
+            needle->translated_addr - map->translated_addr <= map->size) {
+            return map;
+        }
+    }
+
+    map = vhost_iova_tree_find_iova(svq->iova_tree, needle);
+    if (!map) {
+        return NULL;
+    }
+
+    svq->map_cache_next = (svq->map_cache_next + 1) % SVQ_MAP_CACHE_SIZE;
+    svq->map_cache[svq->map_cache_next] = *map;
+    return &svq->map_cache[svq->map_cache_next];
+}
+
 /**
  * Translate addresses between the qemu's virtual address and the SVQ IOVA
  *
@@ -79,7 +118,7 @@ uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
  * @iovec: Source qemu's VA addresses
  * @num: Length of iovec and minimum length of vaddr
  */
-static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
+static bool vhost_svq_translate_addr(VhostShadowVirtqueue *svq,
                                      hwaddr *addrs, const struct iovec *iovec,
                                      size_t num)
 {
@@ -95,7 +134,7 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
         Int128 needle_last, map_last;
         size_t off;
 
-        const DMAMap *map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
+        const DMAMap *map = vhost_svq_find_map(svq, &needle);
         /*
          * Map cannot be NULL since iova map contains all guest space and
          * qemu already has a physical address mapped
@@ -210,17 +249,23 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     avail->ring[avail_idx] = cpu_to_le16(*head);
     svq->shadow_avail_idx++;
 
-    /* Update the avail index after write the descriptor */
-    smp_wmb();
-    avail->idx = cpu_to_le16(svq->shadow_avail_idx);
-
     return true;
 }
 
+/*
+ * Expose the descriptors added since the last call to the device, and
+ * notify it if it asked for it.
+ */
 static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 {
+    uint16_t old = svq->kicked_avail_idx;
     bool needs_kick;
 
+    /* Update the avail index after write the descriptors */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+    svq->kicked_avail_idx = svq->shadow_avail_idx;
+
     /*
      * We need to expose the available array entries before checking the used
      * flags
@@ -229,7 +274,7 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 
     if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t avail_event = *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]);
-        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, old);
     } else {
         needs_kick = !(svq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
     }
@@ -266,7 +311,9 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
     svq->num_free -= ndescs;
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
+    if (!svq->batching) {
+        vhost_svq_kick(svq);
+    }
     return 0;
 }
 
@@ -293,33 +340,58 @@ static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
  */
 static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
 {
+    VirtQueueElement *elems[VIRTQUEUE_POP_BATCH_SIZE];
+
     /* Clear event notifier */
     event_notifier_test_and_clear(&svq->svq_kick);
 
+    /*
+     * Guest buffers forwarded without an owner callback are exposed to the
+     * device together, with a single kick.  Callbacks may need the device
+     * to see each buffer at once, so they keep kicking on every add.
+     */
+    svq->batching = !svq->ops;
+
     /* Forward to the device as many available buffers as possible */
     do {
         virtio_queue_set_notification(svq->vq, false);
 
         while (true) {
-            g_autofree VirtQueueElement *elem = NULL;
-            int r;
+            unsigned n = 0, i;
+            int r = 0;
 
             if (svq->next_guest_avail_elem) {
-                elem = g_steal_pointer(&svq->next_guest_avail_elem);
-            } else {
-                elem = virtqueue_pop(svq->vq, sizeof(*elem));
+                elems[n++] = g_steal_pointer(&svq->next_guest_avail_elem);
             }
-
-            if (!elem) {
+            n += virtqueue_pop_batch(svq->vq, sizeof(VirtQueueElement),
+                                     (void **)&elems[n],
+                                     VIRTQUEUE_POP_BATCH_SIZE - n);
+            if (!n) {
                 break;
             }
 
-            if (svq->ops) {
-                r = svq->ops->avail_handler(svq, elem, svq->ops_opaque);
-            } else {
-                r = vhost_svq_add_element(svq, elem);
+            for (i = 0; i < n; i++) {
+                if (svq->ops) {
+                    r = svq->ops->avail_handler(svq, elems[i],
+                                                svq->ops_opaque);
+                } else {
+                    r = vhost_svq_add_element(svq, elems[i]);
+                }
+                if (unlikely(r != 0)) {
+                    break;
+                }
+                /* elem belongs to SVQ or external caller now */
             }
+
             if (unlikely(r != 0)) {
+                g_autofree VirtQueueElement *elem = elems[i];
+
+                /* Give back the buffers that were not tried yet */
+                virtqueue_unpop_batch(svq->vq, &elems[i + 1], n - i - 1);
+                for (unsigned j = i + 1; j < n; j++) {
+                    g_free(elems[j]);
+                }
+
                 if (r == -ENOSPC) {
                     /*
                      * This condition is possible since a contiguous buffer in
@@ -336,14 +408,20 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
                 }
 
                 /* VQ is full or broken, just return and ignore kicks */
-                return;
+                goto out;
             }
-            /* elem belongs to SVQ or external caller now */
-            elem = NULL;
         }
 
         virtio_queue_set_notification(svq->vq, true);
     } while (!virtio_queue_empty(svq->vq));
+
+out:
+    if (svq->batching) {
+        svq->batching = false;
+        if (svq->kicked_avail_idx != svq->shadow_avail_idx) {
+            vhost_svq_kick(svq);
+        }
+    }
 }
 
 /**
@@ -501,7 +579,10 @@ static void vhost_svq_flush(VhostShadowVirtqueue *svq,
         }
 
         virtqueue_flush(vq, i);
-        event_notifier_set(&svq->svq_call);
+        if (i) {
+            /* A single guest notification for all the buffers of the round */
+            event_notifier_set(&svq->svq_call);
+        }
 
         if (check_for_avail_queue && svq->next_guest_avail_elem) {
             /*
@@ -662,11 +743,18 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
     svq->next_guest_avail_elem = NULL;
     svq->shadow_avail_idx = 0;
+    svq->kicked_avail_idx = 0;
+    svq->batching = false;
     svq->shadow_used_idx = 0;
     svq->last_used_idx = 0;
     svq->vdev = vdev;
     svq->vq = vq;
     svq->iova_tree = iova_tree;
+    for (unsigned i = 0; i < SVQ_MAP_CACHE_SIZE; ++i) {
+        svq->map_cache[i].perm = IOMMU_NONE;
+    }
+    svq->map_cache_gen = vhost_iova_tree_generation(iova_tree);
+    svq->map_cache_next = 0;
 
     svq->vring.num = virtio_queue_get_num(vdev, virtio_get_queue_index(vq));
     svq->num_free = svq->vring.num;
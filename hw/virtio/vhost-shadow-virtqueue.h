@@ -27,6 +27,9 @@ typedef struct SVQDescState {
 
 typedef struct VhostShadowVirtqueue VhostShadowVirtqueue;
 
+/* Number of recent guest memory translations kept by each SVQ */
+#define SVQ_MAP_CACHE_SIZE 4
+
 /**
  * Callback to handle an avail buffer.
  *
@@ -78,6 +81,15 @@ typedef struct VhostShadowVirtqueue {
     /* IOVA mapping */
     VhostIOVATree *iova_tree;
 
+    /*
+     * Maps of iova_tree that recently translated guest buffers, valid while
+     * the iova_tree generation is map_cache_gen.  Unused entries have
+     * perm == IOMMU_NONE.
+     */
+    DMAMap map_cache[SVQ_MAP_CACHE_SIZE];
+    uint64_t map_cache_gen;
+    unsigned int map_cache_next;
+
     /* SVQ vring descriptors state */
     SVQDescState *desc_state;
 
@@ -99,6 +111,12 @@ typedef struct VhostShadowVirtqueue {
     /* Next head to expose to the device */
     uint16_t shadow_avail_idx;
 
+    /* Avail idx when the device notification was last considered */
+    uint16_t kicked_avail_idx;
+
+    /* Forwarding a batch of guest buffers, kick the device at the end */
+    bool batching;
+
     /* Next free descriptor */
     uint16_t free_head;
 
@@ -31,6 +31,7 @@
 #include "hw/virtio/virtio-access.h"
 #include "sysemu/dma.h"
 #include "sysemu/runstate.h"
+#include "sysemu/xen.h"
 #include "virtio-qmp.h"
 
 #include "standard-headers/linux/virtio_ids.h"
@@ -821,6 +822,32 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_detach_element(vq, elem, len);
 }
 
+/* virtqueue_unpop_batch:
+ * @vq: The #VirtQueue
+ * @elems: The most recently popped elements, oldest first
+ * @count: Number of elements
+ *
+ * Pretend that the most recent @count elements, e.g. the unused tail of a
+ * virtqueue_pop_batch() array, weren't popped from the virtqueue.  The next
+ * pop will refetch @elems[0].  Nothing has been written to the elements.
+ */
+void virtqueue_unpop_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                           unsigned int count)
+{
+    unsigned int i, ndescs = 0;
+
+    for (i = 0; i < count; i++) {
+        ndescs += elems[i]->ndescs;
+        virtqueue_detach_element(vq, elems[i], 0);
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        virtqueue_packed_rewind(vq, ndescs);
+    } else {
+        virtqueue_split_rewind(vq, count);
+    }
+}
+
 /* virtqueue_rewind:
  * @vq: The #VirtQueue
  * @num: Number of elements to push back
@@ -995,6 +1022,31 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/* virtqueue_push_batch:
+ * @vq: The #VirtQueue
+ * @elems: Elements to return to the guest
+ * @lens: Number of bytes written to each element
+ * @count: Number of elements
+ *
+ * Equivalent to calling virtqueue_push() for each element, but the used
+ * index is only published once for the whole batch.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1377,10 +1429,58 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
+/*
+ * Translation of the guest RAM region that the previous buffer of a batch
+ * was mapped from, indexed by direction.  Consecutive buffers that live in
+ * the same region are mapped without another address space lookup.  Only
+ * valid within a single RCU critical section.
+ */
+typedef struct VirtQueueMapCache {
+    MemoryRegion *mr;
+    hwaddr addr;
+    hwaddr len;
+    uint8_t *ptr;
+} VirtQueueMapCache;
+
+/* Called within rcu_read_lock().  */
+static void *virtqueue_map_cached(VirtIODevice *vdev,
+                                  VirtQueueMapCache *map_cache,
+                                  hwaddr pa, hwaddr *plen, bool is_write)
+{
+    VirtQueueMapCache *c = &map_cache[is_write];
+
+    if (!c->mr || pa < c->addr || pa - c->addr >= c->len) {
+        MemoryRegion *mr;
+        hwaddr xlat, len = HWADDR_MAX - pa;
+
+        mr = address_space_translate(vdev->dma_as, pa, &xlat, &len, is_write,
+                                     MEMTXATTRS_UNSPECIFIED);
+        if (!memory_access_is_direct(mr, is_write) || !len) {
+            c->mr = NULL;
+            return dma_memory_map(vdev->dma_as, pa, plen,
+                                  is_write ? DMA_DIRECTION_FROM_DEVICE :
+                                  DMA_DIRECTION_TO_DEVICE,
+                                  MEMTXATTRS_UNSPECIFIED);
+        }
+
+        c->mr = mr;
+        c->addr = pa;
+        c->len = len;
+        c->ptr = memory_region_get_ram_ptr(mr) + xlat;
+    }
+
+    /* Same reference that address_space_map() takes and unmap drops */
+    memory_region_ref(c->mr);
+    *plen = MIN(*plen, c->len - (pa - c->addr));
+    fuzz_dma_read_cb(pa, *plen, c->mr);
+    return c->ptr + (pa - c->addr);
+}
+
 static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
-                               hwaddr pa, size_t sz)
+                               hwaddr pa, size_t sz,
+                               VirtQueueMapCache *map_cache)
 {
     bool ok = false;
     unsigned num_sg = *p_num_sg;
@@ -1400,11 +1500,16 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE,
-                                              MEMTXATTRS_UNSPECIFIED);
+        if (map_cache) {
+            iov[num_sg].iov_base = virtqueue_map_cached(vdev, map_cache, pa,
+                                                        &len, is_write);
+        } else {
+            iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
+                                                  is_write ?
+                                                  DMA_DIRECTION_FROM_DEVICE :
+                                                  DMA_DIRECTION_TO_DEVICE,
+                                                  MEMTXATTRS_UNSPECIFIED);
+        }
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1495,7 +1600,10 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/* Called within rcu_read_lock().  */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz,
+                                     VirtQueueMapCache *map_cache,
+                                     bool set_avail_event)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1512,14 +1620,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1534,7 +1634,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (set_avail_event &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -1581,7 +1682,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
             map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len, map_cache);
         } else {
             if (in_num) {
                 virtio_error(vdev, "Incorrect order for descriptors");
@@ -1589,7 +1690,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
             }
             map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len, map_cache);
         }
         if (!map_ok) {
             goto err_undo_map;
@@ -1634,7 +1735,58 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    return virtqueue_split_pop_rcu(vq, sz, NULL, true);
+}
+
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max,
+                                              VirtQueueMapCache *map_cache)
+{
+    uint16_t last_avail_idx = vq->last_avail_idx;
+    unsigned int count = 0;
+    int num_heads;
+
+    RCU_READ_LOCK_GUARD();
+    if (unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    /* A single avail index read and barrier covers the whole batch */
+    num_heads = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (num_heads <= 0) {
+        return 0;
+    }
+
+    max = MIN(max, num_heads);
+    while (count < max) {
+        elems[count] = virtqueue_split_pop_rcu(vq, sz, map_cache, false);
+        if (!elems[count]) {
+            break;
+        }
+        count++;
+    }
+
+    if (vq->last_avail_idx != last_avail_idx &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    return count;
+}
+
+/* Called within rcu_read_lock().  */
+static void *virtqueue_packed_pop_rcu(VirtQueue *vq, size_t sz,
+                                      VirtQueueMapCache *map_cache)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1652,11 +1804,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_packed_empty_rcu(vq)) {
-        goto done;
-    }
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1711,7 +1858,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
             map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len, map_cache);
         } else {
             if (in_num) {
                 virtio_error(vdev, "Incorrect order for descriptors");
@@ -1719,7 +1866,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
             }
             map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len, map_cache);
         }
         if (!map_ok) {
             goto err_undo_map;
@@ -1771,6 +1918,34 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+{
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_packed_empty_rcu(vq)) {
+        return NULL;
+    }
+
+    return virtqueue_packed_pop_rcu(vq, sz, NULL);
+}
+
+static unsigned int virtqueue_packed_pop_batch(VirtQueue *vq, size_t sz,
+                                               void **elems, unsigned int max,
+                                               VirtQueueMapCache *map_cache)
+{
+    unsigned int count = 0;
+
+    RCU_READ_LOCK_GUARD();
+    while (count < max && !virtio_queue_packed_empty_rcu(vq)) {
+        elems[count] = virtqueue_packed_pop_rcu(vq, sz, map_cache);
+        if (!elems[count]) {
+            break;
+        }
+        count++;
+    }
+
+    return count;
+}
+
 void *virtqueue_pop(VirtQueue *vq, size_t sz)
 {
     if (virtio_device_disabled(vq->vdev)) {
@@ -1784,6 +1959,42 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+/* virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: Size of each element, as for virtqueue_pop()
+ * @elems: Array that receives the popped elements
+ * @max: Maximum number of elements to pop
+ *
+ * Pop up to @max elements from the virtqueue.  This behaves like calling
+ * virtqueue_pop() until it returns NULL or @max elements were popped, but
+ * the ring state is only looked up once for the batch and buffers in the
+ * same guest RAM region share one address space translation.  Elements
+ * are freed with g_free() as usual.
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    VirtQueueMapCache map_cache[2] = {};
+    unsigned int count;
+
+    if (virtio_device_disabled(vq->vdev) || !max) {
+        return 0;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        count = virtqueue_packed_pop_batch(vq, sz, elems, max,
+                                           xen_enabled() ? NULL : map_cache);
+    } else {
+        count = virtqueue_split_pop_batch(vq, sz, elems, max,
+                                          xen_enabled() ? NULL : map_cache);
+    }
+
+    trace_virtqueue_pop_batch(vq, count, max);
+    return count;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -60,6 +60,21 @@ struct LuringState;
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Completion handler for io_uring requests submitted with aio_add_sqe().  @res
+ * and @flags are copied from the cqe before @cb is called from aio_poll() in
+ * the AioContext's home thread.
+ */
+typedef struct CqeHandler CqeHandler;
+struct CqeHandler {
+    void (*cb)(CqeHandler *cqe_handler);
+    int res;
+    unsigned flags;
+    QSIMPLEQ_ENTRY(CqeHandler) next;
+};
+#endif
+
 /* Callbacks for file descriptor monitoring implementations */
 typedef struct {
     /*
@@ -105,6 +120,69 @@ typedef struct {
      * Returns: true if ->wait() should be called, false otherwise.
      */
     bool (*need_wait)(AioContext *ctx);
+
+    /*
+     * gsource_prepare:
+     * @ctx: the AioContext
+     *
+     * Prepare for the glib main loop to wait for events instead of ->wait(),
+     * e.g. by submitting pending changes to the monitored file descriptors.
+     * See glib's GSourceFuncs->prepare().  May be NULL, in which case glib
+     * polls the file descriptors of the AioHandlers itself.
+     */
+    void (*gsource_prepare)(AioContext *ctx);
+
+    /*
+     * gsource_check:
+     * @ctx: the AioContext
+     *
+     * See glib's GSourceFuncs->check().  NULL if ->gsource_prepare() is NULL.
+     *
+     * Returns: true if ->gsource_dispatch() has events to process.
+     */
+    bool (*gsource_check)(AioContext *ctx);
+
+    /*
+     * gsource_dispatch:
+     * @ctx: the AioContext
+     * @ready_list: list for handlers that become ready
+     *
+     * Place the handlers whose events the glib main loop waited for on
+     * ready_list, like ->wait() does.  NULL if ->gsource_prepare() is NULL.
+     *
+     * Called with ctx->list_lock incremented but not locked.
+     */
+    void (*gsource_dispatch)(AioContext *ctx, AioHandlerList *ready_list);
+
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * add_sqe:
+     * @ctx: the AioContext
+     * @sqe: the request to submit
+     * @cqe_handler: the handler to call when the request completes
+     *
+     * Queue an io_uring request on the ring used for file descriptor
+     * monitoring.  It is submitted by the next ->wait() or ->gsource_prepare()
+     * call.  NULL if the implementation does not use io_uring.
+     *
+     * Called from the AioContext's home thread.
+     */
+    void (*add_sqe)(AioContext *ctx, const struct io_uring_sqe *sqe,
+                    CqeHandler *cqe_handler);
+
+    /*
+     * dispatch:
+     * @ctx: the AioContext
+     *
+     * Call the handlers of requests that ->wait() found completed.  May be
+     * NULL.
+     *
+     * Called with ctx->list_lock incremented but not locked.
+     *
+     * Returns: true if a handler was called, false otherwise.
+     */
+    bool (*dispatch)(AioContext *ctx);
+#endif
 } FDMonOps;
 
 /*
@@ -203,6 +281,8 @@ struct AioContext {
 
     int thread_pool_min;
     int thread_pool_max;
+    unsigned long *thread_pool_cpus; /* worker CPU affinity, NULL for any */
+    unsigned long thread_pool_cpus_nbits;
     /* Thread pool for performing work and receiving completion callbacks.
      * Has its own locking.
      */
@@ -217,6 +297,10 @@ struct AioContext {
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+    bool fdmon_io_uring_disabled; /* ring must be enabled in home thread */
+    bool fdmon_io_uring_multishot; /* kernel supports multishot poll */
+    gpointer io_uring_fd_tag; /* ring fd polled by the glib main loop */
+    QSIMPLEQ_HEAD(, CqeHandler) cqe_handler_ready_list;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -235,6 +319,7 @@ struct AioContext {
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
+    int64_t io_uring_sqpoll_cpu; /* io_uring SQPOLL thread CPU, -1 if off */
 
     /*
      * List of handlers participating in userspace polling.  Protected by
@@ -508,6 +593,34 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_has_io_uring:
+ * @ctx: the AioContext
+ *
+ * Returns: true if @ctx monitors file descriptors with io_uring, so that
+ * aio_add_sqe() can be used.  The result does not change until @ctx is
+ * destroyed, whether @ctx is run by aio_poll() or by the glib main loop.
+ */
+bool aio_has_io_uring(AioContext *ctx);
+
+/**
+ * aio_add_sqe:
+ * @ctx: the AioContext, which must be the current thread's
+ * @sqe: the request to submit, its user_data field is ignored
+ * @cqe_handler: the handler to call when the request completes
+ *
+ * Submit an io_uring request on the ring that @ctx uses for file descriptor
+ * monitoring, so that it is submitted and reaped by the same io_uring_enter(2)
+ * calls as file descriptor events.  Must only be used if aio_has_io_uring()
+ * returns true.
+ *
+ * @cqe_handler must stay valid until its callback has been called.
+ */
+void aio_add_sqe(AioContext *ctx, const struct io_uring_sqe *sqe,
+                 CqeHandler *cqe_handler);
+#endif
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -701,6 +814,18 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
  */
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
 
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @sqpoll_cpu: host CPU that runs the kernel submission queue polling
+ *              thread of the io_uring AIO engine, -1 disables SQPOLL mode
+ *
+ * The parameters only take effect when the io_uring ring of @ctx is created,
+ * i.e. before the first request is submitted through it.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, int64_t sqpoll_cpu,
+                                     Error **errp);
+
 /**
  * aio_context_set_thread_pool_params:
  * @ctx: the aio context
@@ -709,4 +834,19 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
  */
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp);
+
+/**
+ * aio_context_set_thread_pool_affinity:
+ * @ctx: the aio context
+ * @host_cpus: bitmap of the host CPUs the thread pool workers may run on,
+ *             or NULL for no pinning
+ * @nbits: number of bits in @host_cpus
+ *
+ * Workers that are already running pick up the new affinity before they
+ * process their next request.  Without pinning, they get back the affinity
+ * of the AioContext's thread.
+ */
+void aio_context_set_thread_pool_affinity(AioContext *ctx,
+                                          const unsigned long *host_cpus,
+                                          unsigned long nbits);
 #endif
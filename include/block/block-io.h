@@ -319,6 +319,10 @@ bdrv_can_store_new_dirty_bitmap(BlockDriverState *bs, const char *name,
  *                               recursion.
  *         BDRV_REQ_NO_SERIALISING - do not serialize with other overlapping
  *                                   requests currently in flight.
+ *         BDRV_REQ_NO_FALLBACK - (write flags only) fail with -ENOTSUP
+ *                                instead of letting the host fall back to
+ *                                a buffered copy, e.g. when copy_file_range(2)
+ *                                would have to copy across filesystems.
  *
  * Returns: 0 if succeeded; negative error code if failed.
  **/
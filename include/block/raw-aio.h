@@ -48,6 +48,7 @@
 #define QEMU_AIO_MISALIGNED   0x1000
 #define QEMU_AIO_BLKDEV       0x2000
 #define QEMU_AIO_NO_FALLBACK  0x4000
+#define QEMU_AIO_REGISTERED_BUF 0x8000 /* buffer registered with io_uring */
 
 
 /* linux-aio.c - Linux native implementation */
@@ -66,14 +67,29 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(AioContext *ctx, int64_t sqpoll_cpu, Error **errp);
 void luring_cleanup(LuringState *s);
 
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type);
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext.
+ * @fixed_file is the index returned by luring_register_file() for @fd, or -1.
+ */
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, int fixed_file,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
+
+/*
+ * Fixed files and buffers are registered with all io_uring rings, current
+ * and future ones, except for those shared with the AioContext's file
+ * descriptor monitoring.  luring_register_file() returns the fixed file index
+ * to pass to luring_co_submit(), or -1 on error.
+ */
+int luring_register_file(int fd, Error **errp);
+void luring_unregister_file(int index);
+bool luring_register_buf(void *host, size_t size, Error **errp);
+void luring_unregister_buf(void *host, size_t size);
 #endif
 
 #ifdef _WIN32
@@ -1701,6 +1701,7 @@ typedef struct elf64_shdr {
 
 /* Defined note types for GNU systems.  */
 
+#define NT_GNU_BUILD_ID         3       /* Unique build ID bitstring */
 #define NT_GNU_PROPERTY_TYPE_0  5       /* Program property */
 
 /* Values used in GNU .note.gnu.property notes (NT_GNU_PROPERTY_TYPE_0).  */
@@ -1109,6 +1109,13 @@ struct MemoryListener {
 /**
  * struct AddressSpace: describes a mapping of addresses to #MemoryRegion objects
  */
+typedef struct AddressSpaceMapClient {
+    QEMUBH *bh;
+    QLIST_ENTRY(AddressSpaceMapClient) link;
+} AddressSpaceMapClient;
+
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE (4096)
+
 struct AddressSpace {
     /* private: */
     struct rcu_head rcu;
@@ -1123,6 +1130,19 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /*
+     * Maximum total size of the bounce buffers used by address_space_map()
+     * for memory that cannot be mapped directly.
+     */
+    size_t max_bounce_buffer_size;
+    /* Total size of bounce buffers currently allocated, atomically accessed */
+    size_t bounce_buffer_size;
+    /* Number of address_space_map() calls that failed for lack of space */
+    unsigned int bounce_wait_count;
+    /* List of callbacks to invoke when buffers free up */
+    QemuMutex map_client_list_lock;
+    QLIST_HEAD(, AddressSpaceMapClient) map_client_list;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -2926,8 +2946,8 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
  * May return %NULL and set *@plen to zero(0), if resources needed to perform
  * the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -2938,6 +2958,24 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
 void *address_space_map(AddressSpace *as, hwaddr addr,
                         hwaddr *plen, bool is_write, MemTxAttrs attrs);
 
+/* address_space_register_map_client: be notified when mapping may succeed
+ *
+ * Schedules @bh once address_space_map() of memory that needs a bounce
+ * buffer may succeed again for @as, i.e. when some of its bounce buffers
+ * are released.  @bh is scheduled at once if space is available now.
+ *
+ * @as: #AddressSpace on which address_space_map() failed
+ * @bh: bottom half to schedule
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/* address_space_unregister_map_client: cancel a pending notification
+ *
+ * @as: #AddressSpace given to address_space_register_map_client()
+ * @bh: bottom half given to address_space_register_map_client()
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 /* address_space_unmap: Unmaps a memory region previously mapped by address_space_map()
  *
  * Will also mark the memory as dirty if @is_write == %true.  @access_len gives
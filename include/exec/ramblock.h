@@ -46,6 +46,26 @@ struct RAMBlock {
     unsigned long *bmap;
     /* bitmap of already received pages in postcopy */
     unsigned long *receivedmap;
+    /* bitmap of pages present in the migration file (mapped-ram) */
+    unsigned long *file_bmap;
+    /*
+     * Offsets in the migration file of this block's bitmap and pages,
+     * only used by mapped-ram migration.
+     */
+    off_t bitmap_offset;
+    uint64_t pages_offset;
+    /*
+     * XBZRLE statistics for the current rate period and the state of
+     * the adaptive policy that turns XBZRLE off for this block when it
+     * does not pay off.
+     */
+    uint64_t xbzrle_pages;
+    uint64_t xbzrle_cache_miss;
+    uint64_t xbzrle_bytes;
+    unsigned int xbzrle_strikes;
+    /* number of rate periods left with XBZRLE off, 0 if enabled */
+    unsigned int xbzrle_disabled;
+    unsigned int xbzrle_backoff;
 
     /*
      * bitmap to track already cleared dirty bitmap.  When the bit is
@@ -87,6 +87,10 @@ struct TranslationBlock {
     /* size of target code for this block (1 <= size <= TARGET_PAGE_SIZE) */
     uint16_t size;
     uint16_t icount;
+    /* number of insns that end on the first page */
+    uint16_t icount_page0;
+    /* entries from the main loop, counted for TBs spanning two pages */
+    uint16_t exec_count;
 
     struct tb_tc tc;
 
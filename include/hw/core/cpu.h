@@ -199,8 +199,14 @@ struct CPUClass {
  */
 #define NB_MMU_MODES 16
 
-/* Use a fully associative victim tlb of 8 entries. */
-#define CPU_VTLB_SIZE 8
+/*
+ * Entries evicted from the fast tlb move to a second level tlb with
+ * 1 << CPU_TLB_L2_SET_BITS sets of CPU_TLB_L2_WAYS entries, which is
+ * searched before calling tlb_fill.
+ */
+#define CPU_TLB_L2_SET_BITS 7
+#define CPU_TLB_L2_WAYS     4
+#define CPU_TLB_L2_SIZE     (CPU_TLB_L2_WAYS << CPU_TLB_L2_SET_BITS)
 
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
@@ -280,19 +286,36 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
-    size_t vindex;
-    /* The tlb victim table, in two parts.  */
-    CPUTLBEntry vtable[CPU_VTLB_SIZE];
-    CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
+    /* Rotates the way replaced when a second level tlb set is full. */
+    size_t l2_index;
+    /* Entries added to the second level tlb since the last flush. */
+    size_t l2_used;
+    /* The second level tlb, in two parts; allocated on first use. */
+    CPUTLBEntry *l2table;
+    CPUTLBEntryFull *l2fulltlb;
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
+/*
+ * Invalidations requested by other vCPUs are queued in the target's
+ * CPUTLBCommon and applied the next time it leaves the execution loop.
+ * Overlapping requests are merged; once the queue is full, further
+ * requests become full flushes of their mmu_idx.
+ */
+#define CPU_TLB_PENDING_FLUSHES 16
+
+typedef struct CPUTLBPendingFlush {
+    vaddr addr;
+    vaddr len;
+    uint16_t idxmap;
+    uint16_t bits;
+} CPUTLBPendingFlush;
+
 /*
  * Data elements that are shared between all MMU modes.
  */
 typedef struct CPUTLBCommon {
-    /* Serialize updates to f.table and d.vtable, and others as noted. */
+    /* Serialize updates to f.table and d.l2table, and others as noted. */
     QemuSpin lock;
     /*
      * Within dirty, for each bit N, modifications have been made to
@@ -300,6 +323,15 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Queued invalidations: mmu_idx to flush entirely, and ranges.
+     * pending_scheduled is set while the work draining the queue is
+     * outstanding.  Protected by tlb_c.lock.
+     */
+    uint16_t pending_full;
+    bool pending_scheduled;
+    unsigned int n_pending;
+    CPUTLBPendingFlush pending[CPU_TLB_PENDING_FLUSHES];
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -308,6 +340,9 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t coalesced_flush_count;
+    size_t l2_hit_count;
+    size_t l2_miss_count;
 } CPUTLBCommon;
 
 /*
@@ -445,6 +480,12 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @dirty_ring_full_exits: Number of exits because the KVM dirty ring of
+ *    this CPU was full.
+ * @dirty_ring_reap_ns: Total time spent reaping the KVM dirty ring of this
+ *    CPU, in nanoseconds.
+ * @dirty_ring_reap_max_ns: Longest single reap of the KVM dirty ring of
+ *    this CPU, in nanoseconds.
  *
  * State of one CPU core or thread.
  *
@@ -524,6 +565,9 @@ struct CPUState {
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
     uint64_t dirty_pages;
+    uint64_t dirty_ring_full_exits;
+    uint64_t dirty_ring_reap_ns;
+    uint64_t dirty_ring_reap_max_ns;
     int kvm_vcpu_stats_fd;
 
     /* Use by accel-block: CPU is executing an ioctl() */
@@ -89,6 +89,8 @@ struct PCIDevice {
     AddressSpace bus_master_as;
     MemoryRegion bus_master_container_region;
     MemoryRegion bus_master_enable_region;
+    /* Bounce buffer quota of bus_master_as for DMA to non-RAM memory */
+    uint64_t max_bounce_buffer_size;
 
     /* do not access the following fields */
     PCIConfigReadFunc *config_read;
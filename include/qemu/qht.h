@@ -181,6 +181,8 @@ bool qht_resize(struct qht *ht, size_t n_elems);
  * Each time it is called, user-provided @func is passed a pointer-hash pair,
  * plus @userp.
  *
+ * An ongoing auto-resize of @ht is completed before iterating.
+ *
  * Note: @ht cannot be accessed from @func
  * See also: qht_iter_remove()
  */
@@ -32,9 +32,12 @@ struct EventLoopBase {
 
     /* AioContext AIO engine parameters */
     int64_t aio_max_batch;
+    int64_t io_uring_sqpoll_cpu;
 
     /* AioContext thread pool parameters */
     int64_t thread_pool_min;
     int64_t thread_pool_max;
+    unsigned long *thread_pool_cpus;
+    unsigned long thread_pool_cpus_nbits;
 };
 #endif
@@ -56,6 +56,18 @@ enum KVMDirtyRingReaperState {
     KVM_DIRTY_RING_REAPER_REAPING,
 };
 
+/*
+ * Helper thread that reaps the rings of every nr_threads-th vCPU, starting
+ * at vCPU index "share", whenever all rings are reaped.
+ */
+typedef struct KVMDirtyRingHelper {
+    QemuThread thread;
+    QemuSemaphore sem;
+    struct KVMState *s;
+    unsigned int share;
+    uint64_t reaped;
+} KVMDirtyRingHelper;
+
 /*
  * KVM reaper instance, responsible for collecting the KVM dirty bits
  * via the dirty ring.
@@ -65,6 +77,10 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* Threads sharing the work of a full reap, including the caller */
+    uint32_t nr_threads;
+    KVMDirtyRingHelper *helpers;    /* nr_threads - 1 helpers */
+    QemuSemaphore helpers_done;
 };
 struct KVMState
 {
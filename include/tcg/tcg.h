@@ -30,6 +30,7 @@
 #include "qemu/bitops.h"
 #include "qemu/plugin.h"
 #include "qemu/queue.h"
+#include "qemu/stats64.h"
 #include "tcg/tcg-mo.h"
 #include "tcg-target-reg-bits.h"
 #include "tcg-target.h"
@@ -170,6 +171,10 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_v256             0
 #endif
 
+#ifndef TCG_TARGET_HAS_TB_CACHE
+#define TCG_TARGET_HAS_TB_CACHE         0
+#endif
+
 typedef enum TCGOpcode {
 #define DEF(name, oargs, iargs, cargs, flags) INDEX_op_ ## name,
 #include "tcg/tcg-opc.h"
@@ -203,6 +208,26 @@ struct TCGRelocation {
     int type;
 };
 
+/*
+ * Host addresses outside of a TB that the persistent TB cache has to patch
+ * when it loads the TB's code back, possibly at a different address and in
+ * a process where QEMU itself is mapped at a different address.
+ */
+typedef enum TCGTBCacheRelocKind {
+    /* 64-bit absolute address of QEMU code, relative to tcg_tbc_anchor() */
+    TCG_TBC_RELOC_ABS64,
+    /* 32-bit pc-relative branch, relative to tcg_code_gen_epilogue */
+    TCG_TBC_RELOC_PC32_EPILOGUE,
+} TCGTBCacheRelocKind;
+
+typedef struct TCGTBCacheReloc {
+    uint32_t offset;  /* from the start of the TB's code */
+    uint32_t kind;    /* TCGTBCacheRelocKind */
+    int64_t addend;
+} TCGTBCacheReloc;
+
+#define TCG_TBC_MAX_RELOCS 256
+
 typedef struct TCGOp TCGOp;
 typedef struct TCGLabelUse TCGLabelUse;
 struct TCGLabelUse {
@@ -476,6 +501,20 @@ static inline TCGRegSet output_pref(const TCGOp *op, unsigned i)
     return i < ARRAY_SIZE(op->output_pref) ? op->output_pref[i] : 0;
 }
 
+/*
+ * Per-context translation statistics.  Only the owning thread updates
+ * them; tcg_dump_op_stats() sums them over all contexts.
+ */
+typedef struct TCGOpStats {
+    Stat64 tb_count;            /* TBs passed to tcg_gen_code */
+    Stat64 ops_in;              /* ops emitted by the front end */
+    Stat64 ops_out;             /* ops left after optimization and liveness */
+    Stat64 env_ld_fwd;          /* env loads replaced by a known value */
+    Stat64 env_st_dead;         /* env stores removed as overwritten */
+    Stat64 opt_time;            /* ns spent in optimization and liveness */
+    Stat64 gen_time;            /* ns spent in tcg_gen_code overall */
+} TCGOpStats;
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -502,6 +541,16 @@ struct TCGContext {
     tcg_insn_unit *code_buf;      /* pointer for start of tb */
     tcg_insn_unit *code_ptr;      /* pointer for running end of tb */
 
+    /*
+     * Persistent TB cache: set tbc_record to generate relocatable code.
+     * tbc_unsafe is set if the TB embeds host addresses that cannot be
+     * relocated, in which case it must not be saved.
+     */
+    bool tbc_record;
+    bool tbc_unsafe;
+    int tbc_nb_relocs;
+    TCGTBCacheReloc tbc_relocs[TCG_TBC_MAX_RELOCS];
+
 #ifdef CONFIG_DEBUG_TCG
     int goto_tb_issue_mask;
     const TCGOpcode *vecop_list;
@@ -522,6 +571,8 @@ struct TCGContext {
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
+    TCGOpStats op_stats;
+
     /* These structures are private to tcg-target.c.inc.  */
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_HEAD(, TCGLabelQemuLdst) ldst_labels;
@@ -575,6 +626,9 @@ extern bool tcg_use_softmmu;
 #define tcg_use_softmmu  true
 #endif
 
+/* Collect TCGOpStats; set with -accel tcg,op-stats=on */
+extern bool tcg_op_stats_enabled;
+
 extern __thread TCGContext *tcg_ctx;
 extern const void *tcg_code_gen_epilogue;
 extern uintptr_t tcg_splitwx_diff;
@@ -758,6 +812,7 @@ void tcg_region_reset_all(void);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
+void tcg_dump_op_stats(GString *buf);
 
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
@@ -788,6 +843,12 @@ void tcg_func_start(TCGContext *s);
 
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start);
 
+/* Base of TCG_TBC_RELOC_ABS64 relocations, anywhere in QEMU's text.  */
+static inline uintptr_t tcg_tbc_anchor(void)
+{
+    return (uintptr_t)tcg_gen_code;
+}
+
 void tb_target_set_jmp_target(const TranslationBlock *, int,
                               uintptr_t, uintptr_t);
 
@@ -172,6 +172,15 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
     aio_context_set_aio_params(iothread->ctx,
                                iothread->parent_obj.aio_max_batch);
 
+    aio_context_set_io_uring_params(iothread->ctx, base->io_uring_sqpoll_cpu,
+                                    errp);
+    if (*errp) {
+        return;
+    }
+
+    aio_context_set_thread_pool_affinity(iothread->ctx, base->thread_pool_cpus,
+                                         base->thread_pool_cpus_nbits);
+
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
 }
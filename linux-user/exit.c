@@ -18,6 +18,7 @@
  */
 #include "qemu/osdep.h"
 #include "accel/tcg/perf.h"
+#include "accel/tcg/tb-cache.h"
 #include "gdbstub/syscalls.h"
 #include "qemu.h"
 #include "user-internals.h"
@@ -35,4 +36,8 @@ void preexit_cleanup(CPUArchState *env, int code)
         gdb_exit(code);
         qemu_plugin_user_exit();
         perf_exit();
+        /* exit_group() does not run atexit handlers */
+        if (tb_cache_enabled) {
+            tb_cache_save();
+        }
 }
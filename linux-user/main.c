@@ -69,6 +69,7 @@ char *exec_path;
 char real_exec_path[PATH_MAX];
 
 static bool opt_one_insn_per_tb;
+static const char *opt_tb_cache;
 static const char *argv0;
 static const char *gdbstub;
 static envlist_t *envlist;
@@ -411,6 +412,11 @@ static void handle_arg_one_insn_per_tb(const char *arg)
     opt_one_insn_per_tb = true;
 }
 
+static void handle_arg_tb_cache(const char *arg)
+{
+    opt_tb_cache = arg;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     enable_strace = true;
@@ -502,6 +508,8 @@ static const struct qemu_argument arg_table[] = {
      "",           "run with one guest instruction per emulated TB"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_one_insn_per_tb,
      "",           "deprecated synonym for -one-insn-per-tb"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "file",       "keep translated code in 'file' across runs"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
@@ -791,6 +799,10 @@ int main(int argc, char **argv, char **envp)
         accel_init_interfaces(ac);
         object_property_set_bool(OBJECT(accel), "one-insn-per-tb",
                                  opt_one_insn_per_tb, &error_abort);
+        if (opt_tb_cache) {
+            object_property_set_str(OBJECT(accel), "tb-cache",
+                                    opt_tb_cache, &error_abort);
+        }
         ac->init_machine(NULL);
     }
     cpu = cpu_create(cpu_type);
@@ -8,15 +8,22 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qapi/error.h"
+#include "qemu/error-report.h"
 #include "channel.h"
+#include "exec/ramblock.h"
 #include "file.h"
 #include "migration.h"
 #include "io/channel-file.h"
 #include "io/channel-util.h"
+#include "options.h"
 #include "trace.h"
 
 #define OFFSET_OPTION ",offset="
 
+static struct FileOutgoingArgs {
+    char *fname;
+} outgoing_args;
+
 /* Remove the offset option from @filespec and return it in @offsetp. */
 
 int file_parse_offset(char *filespec, uint64_t *offsetp, Error **errp)
@@ -36,6 +43,125 @@ int file_parse_offset(char *filespec, uint64_t *offsetp, Error **errp)
     return 0;
 }
 
+/*
+ * Open an additional channel on the migration file, to be used by a
+ * multifd send thread.  Each channel has its own file descriptor so the
+ * channels never share a file position.
+ */
+static QIOChannelFile *file_open_multifd_channel(const char *filename,
+                                                 int flags, Error **errp)
+{
+    QIOChannelFile *fioc;
+
+#ifdef O_DIRECT
+    if (migrate_direct_io()) {
+        flags |= O_DIRECT;
+    }
+#endif
+
+    fioc = qio_channel_file_new_path(filename, flags, 0, errp);
+    if (!fioc) {
+        return NULL;
+    }
+
+    if (!qio_channel_has_feature(QIO_CHANNEL(fioc),
+                                 QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg(errp, "Migration file %s does not support random access",
+                   filename);
+        object_unref(OBJECT(fioc));
+        return NULL;
+    }
+
+    return fioc;
+}
+
+void file_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelFile *fioc;
+    QIOTask *task;
+    Error *err = NULL;
+
+    fioc = file_open_multifd_channel(outgoing_args.fname, O_WRONLY, &err);
+
+    task = qio_task_new(OBJECT(fioc), f, data, NULL);
+    if (!fioc) {
+        qio_task_set_error(task, err);
+    }
+    qio_task_complete(task);
+}
+
+int file_send_channel_destroy(QIOChannel *ioc)
+{
+    object_unref(OBJECT(ioc));
+    g_free(outgoing_args.fname);
+    outgoing_args.fname = NULL;
+    return 0;
+}
+
+/*
+ * Write the pages described by @iov, which all belong to @block, to
+ * their fixed location in the migration file.  Runs of pages that are
+ * contiguous in guest memory are written with a single pwritev().
+ */
+int file_write_ramblock_iov(QIOChannel *ioc, const struct iovec *iov,
+                            int niov, RAMBlock *block, Error **errp)
+{
+    int slice_idx = 0;
+
+    while (slice_idx < niov) {
+        uint8_t *start = iov[slice_idx].iov_base;
+        size_t len = iov[slice_idx].iov_len;
+        int slice_num = 1;
+        ssize_t ret;
+        off_t offset;
+
+        while (slice_idx + slice_num < niov &&
+               iov[slice_idx + slice_num].iov_base == start + len) {
+            len += iov[slice_idx + slice_num].iov_len;
+            slice_num++;
+        }
+
+        offset = block->pages_offset + (start - block->host);
+        ret = qio_channel_pwritev(ioc, &iov[slice_idx], slice_num, offset,
+                                  errp);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret != len) {
+            error_setg(errp, "Short write to migration file at offset %"
+                       PRId64 ": %zd of %zu bytes", (int64_t)offset, ret, len);
+            return -1;
+        }
+
+        slice_idx += slice_num;
+    }
+
+    return 0;
+}
+
+/* Read @len bytes at @offset of the migration file into @buf */
+int file_read_ramblock(QIOChannel *ioc, void *buf, size_t len, off_t offset,
+                       Error **errp)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t ret = qio_channel_pread(ioc, (char *)buf + done, len - done,
+                                        offset + done, errp);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Unexpected end of migration file at offset %"
+                       PRId64, (int64_t)(offset + done));
+            return -1;
+        }
+        done += ret;
+    }
+
+    return 0;
+}
+
 void file_start_outgoing_migration(MigrationState *s,
                                    FileMigrationArgs *file_args, Error **errp)
 {
@@ -52,6 +178,9 @@ void file_start_outgoing_migration(MigrationState *s,
         return;
     }
 
+    g_free(outgoing_args.fname);
+    outgoing_args.fname = g_strdup(filename);
+
     ioc = QIO_CHANNEL(fioc);
     if (offset && qio_channel_io_seek(ioc, offset, SEEK_SET, errp) < 0) {
         return;
@@ -92,4 +221,27 @@ void file_start_incoming_migration(FileMigrationArgs *file_args, Error **errp)
                                file_accept_incoming_migration,
                                NULL, NULL,
                                g_main_context_get_thread_default());
+
+    if (!migrate_multifd()) {
+        return;
+    }
+
+    /*
+     * The multifd channels only do positional reads of RAM, so they
+     * don't need to be seeked to @offset.  They are processed after the
+     * main channel, which is the first one to be watched.
+     */
+    for (int i = 0; i < migrate_multifd_channels(); i++) {
+        fioc = file_open_multifd_channel(filename, O_RDONLY, errp);
+        if (!fioc) {
+            return;
+        }
+
+        ioc = QIO_CHANNEL(fioc);
+        qio_channel_set_name(ioc, "migration-file-incoming");
+        qio_channel_add_watch_full(ioc, G_IO_IN,
+                                   file_accept_incoming_migration,
+                                   NULL, NULL,
+                                   g_main_context_get_thread_default());
+    }
 }
@@ -146,6 +146,20 @@ migration_channels_and_transport_compatible(MigrationAddress *addr,
         return false;
     }
 
+    if (migrate_mapped_ram() &&
+        addr->transport != MIGRATION_ADDRESS_TYPE_FILE) {
+        error_setg(errp, "Migration requires a transport that allows for "
+                   "random access (e.g. file)");
+        return false;
+    }
+
+    if (migrate_multifd() && !migrate_mapped_ram() &&
+        addr->transport == MIGRATION_ADDRESS_TYPE_FILE) {
+        error_setg(errp, "Multifd migration to a file requires the "
+                   "mapped-ram capability");
+        return false;
+    }
+
     return true;
 }
 
@@ -11,6 +11,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/rcu.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
@@ -24,6 +25,7 @@
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
+#include "file.h"
 #include "multifd.h"
 #include "threadinfo.h"
 #include "options.h"
@@ -264,6 +266,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->normal_pages = cpu_to_be32(p->normal_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -277,6 +280,12 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
         packet->offset[i] = cpu_to_be64(temp);
     }
+
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t temp = p->zero[i];
+
+        packet->offset[p->normal_num + i] = cpu_to_be64(temp);
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -322,10 +331,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->normal_num) {
+        error_setg(errp, "multifd: received packet "
+                   "with %u zero pages and expected maximum zero pages are %u",
+                   p->zero_num, packet->pages_alloc - p->normal_num);
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->normal_num == 0) {
+    if (p->normal_num == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -351,6 +368,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->normal[i] = offset;
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num + i]);
+
+        if (offset > (p->block->used_length - p->page_size)) {
+            error_setg(errp, "multifd: offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, p->block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+
     return 0;
 }
 
@@ -510,6 +539,9 @@ static void multifd_send_terminate_threads(Error *err)
 
 static int multifd_send_channel_destroy(QIOChannel *send)
 {
+    if (migrate_mapped_ram()) {
+        return file_send_channel_destroy(send);
+    }
     return socket_send_channel_destroy(send);
 }
 
@@ -551,6 +583,8 @@ void multifd_save_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_send_state->ops->send_cleanup(p, &local_err);
         if (local_err) {
             migrate_set_error(migrate_get_current(), local_err);
@@ -646,6 +680,59 @@ int multifd_send_sync_main(void)
     return 0;
 }
 
+/**
+ * multifd_send_zero_page_detect: split the pages to send
+ *
+ * Sort the pages queued for @p into normal pages, whose contents are
+ * sent, and zero pages, of which only the offset is sent.  Doing this
+ * here instead of in the migration thread spreads the cost of scanning
+ * guest memory over all channels.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    bool detect = migrate_zero_page_detection() == ZERO_PAGE_DETECTION_MULTIFD;
+
+    for (int i = 0; i < pages->num; i++) {
+        ram_addr_t offset = pages->offset[i];
+
+        if (detect &&
+            buffer_is_zero(pages->block->host + offset, p->page_size)) {
+            p->zero[p->zero_num++] = offset;
+        } else {
+            p->normal[p->normal_num++] = offset;
+        }
+    }
+}
+
+/**
+ * multifd_file_prepare: queue the pages of a mapped-ram channel
+ *
+ * With mapped-ram there are no packets: each normal page is written
+ * straight to its slot in the migration file and zero pages are only
+ * dropped from the file bitmap.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_file_prepare(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+
+    p->iovs_num = 0;
+    for (int i = 0; i < p->normal_num; i++) {
+        p->iov[p->iovs_num].iov_base = pages->block->host + p->normal[i];
+        p->iov[p->iovs_num].iov_len = p->page_size;
+        p->iovs_num++;
+        ramblock_set_file_bmap_atomic(pages->block, p->normal[i], true);
+    }
+    for (int i = 0; i < p->zero_num; i++) {
+        ramblock_set_file_bmap_atomic(pages->block, p->zero[i], false);
+    }
+    p->next_packet_size = p->normal_num * p->page_size;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -653,18 +740,21 @@ static void *multifd_send_thread(void *opaque)
     Error *local_err = NULL;
     int ret = 0;
     bool use_zero_copy_send = migrate_zero_copy_send();
+    bool use_packets = !migrate_mapped_ram();
 
     thread = migration_threads_add(p->name, qemu_get_thread_id());
 
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
-        ret = -1;
-        goto out;
+    if (use_packets) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_post(&multifd_send_state->channels_ready);
@@ -677,8 +767,10 @@ static void *multifd_send_thread(void *opaque)
 
         if (p->pending_job) {
             uint64_t packet_num = p->packet_num;
+            RAMBlock *block = p->pages->block;
             uint32_t flags;
             p->normal_num = 0;
+            p->zero_num = 0;
 
             if (use_zero_copy_send) {
                 p->iovs_num = 0;
@@ -686,51 +778,65 @@ static void *multifd_send_thread(void *opaque)
                 p->iovs_num = 1;
             }
 
-            for (int i = 0; i < p->pages->num; i++) {
-                p->normal[p->normal_num] = p->pages->offset[i];
-                p->normal_num++;
-            }
+            multifd_send_zero_page_detect(p);
 
-            if (p->normal_num) {
-                ret = multifd_send_state->ops->send_prepare(p, &local_err);
-                if (ret != 0) {
-                    qemu_mutex_unlock(&p->mutex);
-                    break;
+            if (!use_packets) {
+                multifd_file_prepare(p);
+            } else {
+                if (p->normal_num) {
+                    ret = multifd_send_state->ops->send_prepare(p, &local_err);
+                    if (ret != 0) {
+                        qemu_mutex_unlock(&p->mutex);
+                        break;
+                    }
                 }
+                multifd_send_fill_packet(p);
             }
-            multifd_send_fill_packet(p);
             flags = p->flags;
             p->flags = 0;
             p->num_packets++;
             p->total_normal_pages += p->normal_num;
+            p->total_zero_pages += p->zero_num;
             p->pages->num = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, p->normal_num, flags,
-                               p->next_packet_size);
+            stat64_add(&mig_stats.normal_pages, p->normal_num);
+            stat64_add(&mig_stats.zero_pages, p->zero_num);
 
-            if (use_zero_copy_send) {
-                /* Send header first, without zerocopy */
-                ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                            p->packet_len, &local_err);
+            trace_multifd_send(p->id, packet_num, p->normal_num, p->zero_num,
+                               flags, p->next_packet_size);
+
+            if (!use_packets) {
+                ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
+                                              block, &local_err);
                 if (ret != 0) {
                     break;
                 }
             } else {
-                /* Send header using the same writev call */
-                p->iov[0].iov_len = p->packet_len;
-                p->iov[0].iov_base = p->packet;
-            }
+                if (use_zero_copy_send) {
+                    /* Send header first, without zerocopy */
+                    ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                                p->packet_len, &local_err);
+                    if (ret != 0) {
+                        break;
+                    }
+                } else {
+                    /* Send header using the same writev call */
+                    p->iov[0].iov_len = p->packet_len;
+                    p->iov[0].iov_base = p->packet;
+                }
 
-            ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num, NULL,
-                                              0, p->write_flags, &local_err);
-            if (ret != 0) {
-                break;
+                ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
+                                                  NULL, 0, p->write_flags,
+                                                  &local_err);
+                if (ret != 0) {
+                    break;
+                }
+                p->next_packet_size += p->packet_len;
             }
 
-            stat64_add(&mig_stats.multifd_bytes,
-                       p->next_packet_size + p->packet_len);
+            stat64_add(&mig_stats.multifd_bytes, p->next_packet_size);
             p->next_packet_size = 0;
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
@@ -761,7 +867,8 @@ out:
 
     rcu_unregister_thread();
     migration_threads_remove(thread);
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -896,6 +1003,10 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
 
 static void multifd_new_send_channel_create(gpointer opaque)
 {
+    if (migrate_mapped_ram()) {
+        file_send_channel_create(multifd_new_send_channel_async, opaque);
+        return;
+    }
     socket_send_channel_create(multifd_new_send_channel_async, opaque);
 }
 
@@ -936,6 +1047,7 @@ int multifd_save_setup(Error **errp)
         /* We need one extra place for the packet header */
         p->iov = g_new0(struct iovec, page_count + 1);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->page_size = qemu_target_page_size();
         p->page_count = page_count;
 
@@ -966,6 +1078,8 @@ struct {
     int count;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* recv channels ready (mapped-ram only) */
+    QemuSemaphore channels_ready;
     /* global number of generated multifd packets */
     uint64_t packet_num;
     /* multifd ops */
@@ -993,6 +1107,7 @@ static void multifd_recv_terminate_threads(Error *err)
 
         qemu_mutex_lock(&p->mutex);
         p->quit = true;
+        qemu_sem_post(&p->sem);
         /*
          * We could arrive here for two reasons:
          *  - normal quit, i.e. everything went fine, just finished
@@ -1042,6 +1157,7 @@ void multifd_load_cleanup(void)
         p->c = NULL;
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem_sync);
+        qemu_sem_destroy(&p->sem);
         g_free(p->name);
         p->name = NULL;
         p->packet_len = 0;
@@ -1051,9 +1167,12 @@ void multifd_load_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    qemu_sem_destroy(&multifd_recv_state->channels_ready);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state);
@@ -1064,7 +1183,11 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_multifd()) {
+    /*
+     * With mapped-ram there are no packets to synchronize with, the
+     * loader waits for the channels itself with multifd_file_recv_sync().
+     */
+    if (!migrate_multifd() || migrate_mapped_ram()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1087,6 +1210,161 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/**
+ * multifd_file_recv_data: read a range of a mapped-ram migration file
+ *
+ * Hand the read of @len bytes at @offset of the migration file into
+ * @buf to the next idle multifd channel.
+ *
+ * Returns 0 on success, -1 if the channels have quit.
+ */
+int multifd_file_recv_data(void *buf, size_t len, off_t offset)
+{
+    static int next_recv_channel;
+    MultiFDRecvParams *p = NULL;
+    int i;
+
+    qemu_sem_wait(&multifd_recv_state->channels_ready);
+
+    next_recv_channel %= migrate_multifd_channels();
+    for (i = next_recv_channel;; i = (i + 1) % migrate_multifd_channels()) {
+        p = &multifd_recv_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit) {
+            error_report("%s: channel %d has already quit!", __func__, i);
+            qemu_mutex_unlock(&p->mutex);
+            return -1;
+        }
+        if (!p->pending_job) {
+            p->pending_job++;
+            next_recv_channel = (i + 1) % migrate_multifd_channels();
+            break;
+        }
+        qemu_mutex_unlock(&p->mutex);
+    }
+
+    p->file_buf = buf;
+    p->file_len = len;
+    p->file_offset = offset;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+
+    return 0;
+}
+
+/**
+ * multifd_file_recv_sync: wait for the reads of all channels
+ *
+ * Returns 0 once every read handed out by multifd_file_recv_data() has
+ * completed, -1 if any channel has quit.
+ */
+int multifd_file_recv_sync(void)
+{
+    int i;
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        trace_multifd_recv_sync_main_signal(p->id);
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit) {
+            error_report("%s: channel %d has already quit", __func__, i);
+            qemu_mutex_unlock(&p->mutex);
+            return -1;
+        }
+        p->flags |= MULTIFD_FLAG_SYNC;
+        p->pending_job++;
+        qemu_mutex_unlock(&p->mutex);
+        qemu_sem_post(&p->sem);
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        qemu_sem_wait(&multifd_recv_state->channels_ready);
+        trace_multifd_recv_sync_main_wait(p->id);
+        qemu_sem_wait(&multifd_recv_state->sem_sync);
+    }
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        WITH_QEMU_LOCK_GUARD(&p->mutex) {
+            if (p->quit) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Body of the receive thread for mapped-ram: wait for the main thread
+ * to hand over a range of the file and read it in place.
+ *
+ * Returns 0 when the thread should finish, -1 on error.
+ */
+static int multifd_file_recv_loop(MultiFDRecvParams *p, Error **errp)
+{
+    while (true) {
+        uint32_t flags;
+        void *buf;
+        size_t len;
+        off_t offset;
+
+        qemu_sem_post(&multifd_recv_state->channels_ready);
+        qemu_sem_wait(&p->sem);
+
+        if (p->quit) {
+            return 0;
+        }
+
+        qemu_mutex_lock(&p->mutex);
+        if (!p->pending_job) {
+            /* sometimes there are spurious wakeups */
+            qemu_mutex_unlock(&p->mutex);
+            continue;
+        }
+        flags = p->flags;
+        p->flags = 0;
+        buf = p->file_buf;
+        len = p->file_len;
+        offset = p->file_offset;
+        p->file_len = 0;
+        qemu_mutex_unlock(&p->mutex);
+
+        if (len) {
+            if (file_read_ramblock(p->c, buf, len, offset, errp) < 0) {
+                return -1;
+            }
+            p->num_packets++;
+            p->total_normal_pages += len / p->page_size;
+        }
+
+        qemu_mutex_lock(&p->mutex);
+        p->pending_job--;
+        qemu_mutex_unlock(&p->mutex);
+
+        if (flags & MULTIFD_FLAG_SYNC) {
+            qemu_sem_post(&multifd_recv_state->sem_sync);
+        }
+    }
+}
+
+/**
+ * multifd_recv_zero_page_process: clear the pages received as zero pages
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_recv_zero_page_process(MultiFDRecvParams *p)
+{
+    for (int i = 0; i < p->zero_num; i++) {
+        ram_handle_zero(p->host + p->zero[i], p->page_size);
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1096,6 +1374,14 @@ static void *multifd_recv_thread(void *opaque)
     trace_multifd_recv_thread_start(p->id);
     rcu_register_thread();
 
+    if (migrate_mapped_ram()) {
+        multifd_file_recv_loop(p, &local_err);
+        /* Don't leave the main thread waiting for this channel */
+        qemu_sem_post(&multifd_recv_state->channels_ready);
+        qemu_sem_post(&multifd_recv_state->sem_sync);
+        goto out;
+    }
+
     while (true) {
         uint32_t flags;
 
@@ -1119,10 +1405,11 @@ static void *multifd_recv_thread(void *opaque)
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, p->normal_num, flags,
-                           p->next_packet_size);
+        trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->zero_num,
+                           flags, p->next_packet_size);
         p->num_packets++;
         p->total_normal_pages += p->normal_num;
+        p->total_zero_pages += p->zero_num;
         qemu_mutex_unlock(&p->mutex);
 
         if (p->normal_num) {
@@ -1132,12 +1419,15 @@ static void *multifd_recv_thread(void *opaque)
             }
         }
 
+        multifd_recv_zero_page_process(p);
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
         }
     }
 
+out:
     if (local_err) {
         multifd_recv_terminate_threads(local_err);
         error_free(local_err);
@@ -1147,7 +1437,8 @@ static void *multifd_recv_thread(void *opaque)
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -1171,6 +1462,7 @@ int multifd_load_setup(Error **errp)
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
     qatomic_set(&multifd_recv_state->count, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    qemu_sem_init(&multifd_recv_state->channels_ready, 0);
     multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
@@ -1178,7 +1470,9 @@ int multifd_load_setup(Error **errp)
 
         qemu_mutex_init(&p->mutex);
         qemu_sem_init(&p->sem_sync, 0);
+        qemu_sem_init(&p->sem, 0);
         p->quit = false;
+        p->pending_job = 0;
         p->id = i;
         p->packet_len = sizeof(MultiFDPacket_t)
                       + sizeof(uint64_t) * page_count;
@@ -1186,6 +1480,7 @@ int multifd_load_setup(Error **errp)
         p->name = g_strdup_printf("multifdrecv_%d", i);
         p->iov = g_new0(struct iovec, page_count);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->page_count = page_count;
         p->page_size = qemu_target_page_size();
     }
@@ -1228,7 +1523,12 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp)
     Error *local_err = NULL;
     int id;
 
-    id = multifd_recv_initial_packet(ioc, &local_err);
+    if (migrate_mapped_ram()) {
+        /* No initial packet, the channels are numbered as they are opened */
+        id = qatomic_read(&multifd_recv_state->count);
+    } else {
+        id = multifd_recv_initial_packet(ioc, &local_err);
+    }
     if (id < 0) {
         multifd_recv_terminate_threads(local_err);
         error_propagate_prepend(errp, local_err,
@@ -1250,7 +1550,7 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp)
     p->c = ioc;
     object_ref(OBJECT(ioc));
     /* initial packet */
-    p->num_packets = 1;
+    p->num_packets = migrate_mapped_ram() ? 0 : 1;
 
     p->running = true;
     qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
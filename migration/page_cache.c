@@ -17,6 +17,7 @@
 #include "qapi/qmp/qerror.h"
 #include "qapi/error.h"
 #include "qemu/host-utils.h"
+#include "qemu/rcu.h"
 #include "page_cache.h"
 #include "trace.h"
 
@@ -32,6 +33,7 @@ struct CacheItem {
 };
 
 struct PageCache {
+    struct rcu_head rcu;
     CacheItem *page_cache;
     size_t page_size;
     size_t max_num_items;
@@ -103,6 +105,11 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
+void cache_fini_rcu(PageCache *cache)
+{
+    call_rcu(cache, cache_fini, rcu);
+}
+
 static size_t cache_get_cache_pos(const PageCache *cache,
                                   uint64_t address)
 {
@@ -173,3 +180,17 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
 
     return 0;
 }
+
+void cache_invalidate_range(PageCache *cache, uint64_t start, uint64_t length)
+{
+    int64_t i;
+
+    for (i = 0; i < cache->max_num_items; i++) {
+        CacheItem *it = &cache->page_cache[i];
+
+        if (it->it_addr >= start && it->it_addr - start < length) {
+            it->it_addr = -1;
+            it->it_age = 0;
+        }
+    }
+}
@@ -35,6 +35,16 @@ PageCache *cache_init(uint64_t cache_size, size_t page_size, Error **errp);
  */
 void cache_fini(PageCache *cache);
 
+/**
+ * cache_fini_rcu: free all cache resources after an RCU grace period
+ *
+ * Use this instead of cache_fini() when the cache may still be in use
+ * by a reader that fetched it with qatomic_rcu_read().
+ *
+ * @cache pointer to the PageCache struct
+ */
+void cache_fini_rcu(PageCache *cache);
+
 /**
  * cache_is_cached: Checks to see if the page is cached
  *
@@ -71,4 +81,17 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age);
 
+/**
+ * cache_invalidate_range: drop the cached pages in an address range
+ *
+ * The data buffers are kept for reuse, but no page in the range will
+ * be reported as cached until it is inserted again.
+ *
+ * @cache pointer to the PageCache struct
+ * @start: first page address of the range
+ * @length: length of the range in bytes
+ */
+void cache_invalidate_range(PageCache *cache, uint64_t start,
+                            uint64_t length);
+
 #endif
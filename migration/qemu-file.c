@@ -834,3 +834,118 @@ int qemu_file_get_to_fd(QEMUFile *f, int fd, size_t size)
 
     return 0;
 }
+
+/*
+ * Move the position of the underlying channel.  Any data buffered for
+ * writing is flushed first and any data buffered for reading is
+ * dropped, so the next sequential access happens at the new position.
+ */
+void qemu_set_offset(QEMUFile *f, off_t off, int whence)
+{
+    Error *err = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        /* Drop all cached buffers if existed; will trigger a re-fill later */
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    ret = qio_channel_io_seek(f->ioc, off, whence, &err);
+    if (ret == (off_t)-1) {
+        qemu_file_set_error_obj(f, -EIO, err);
+    }
+}
+
+/* Return the position of the next sequential access to @f */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *err = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    }
+
+    ret = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &err);
+    if (ret == (off_t)-1) {
+        qemu_file_set_error_obj(f, -EIO, err);
+        return ret;
+    }
+
+    if (!qemu_file_is_writable(f)) {
+        /* Account for data already read ahead into the buffer */
+        ret -= f->buf_size - f->buf_index;
+    }
+    return ret;
+}
+
+/*
+ * Write @buflen bytes from @buf at offset @pos of the channel, bypassing
+ * the buffered stream.  The stream position is not changed.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos)
+{
+    Error *err = NULL;
+
+    if (f->last_error) {
+        return;
+    }
+
+    while (buflen) {
+        ssize_t ret = qio_channel_pwrite(f->ioc, (char *)buf, buflen, pos,
+                                         &err);
+
+        if (err) {
+            qemu_file_set_error_obj(f, -EIO, err);
+            return;
+        }
+        if (ret <= 0) {
+            qemu_file_set_error(f, -EIO);
+            return;
+        }
+
+        stat64_add(&mig_stats.qemu_file_transferred, ret);
+        buf += ret;
+        buflen -= ret;
+        pos += ret;
+    }
+}
+
+/*
+ * Read @buflen bytes into @buf from offset @pos of the channel, bypassing
+ * the buffered stream.  The stream position is not changed.
+ *
+ * Returns the number of bytes read, which is less than @buflen only on
+ * error or end of file; the error is recorded in @f.
+ */
+size_t qemu_get_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                          off_t pos)
+{
+    Error *err = NULL;
+    size_t done = 0;
+
+    if (f->last_error) {
+        return 0;
+    }
+
+    while (done < buflen) {
+        ssize_t ret = qio_channel_pread(f->ioc, (char *)buf + done,
+                                        buflen - done, pos + done, &err);
+
+        if (err) {
+            qemu_file_set_error_obj(f, -EIO, err);
+            break;
+        }
+        if (ret <= 0) {
+            qemu_file_set_error(f, -EIO);
+            break;
+        }
+        done += ret;
+    }
+
+    return done;
+}
@@ -52,6 +52,7 @@
 #include "exec/ram_addr.h"
 #include "exec/target_page.h"
 #include "qemu/rcu_queue.h"
+#include "file.h"
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
@@ -94,6 +95,31 @@
 #define RAM_SAVE_FLAG_MULTIFD_FLUSH    0x200
 /* We can't use any flag that is bigger than 0x200 */
 
+/*
+ * With mapped-ram each RAMBlock is stored in the migration file as a
+ * header, a bitmap of the pages present and a region with one slot per
+ * guest page, at the page's offset in the block.  The page region is
+ * aligned to 1M, which keeps the file offsets aligned to the page size
+ * and to the block size of most devices, as needed for O_DIRECT.  The
+ * block size can't be queried, since the file may be restored on a
+ * different host.
+ */
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
+/* Amount of the page region read at a time when loading */
+#define MAPPED_RAM_LOAD_BUF_SIZE 0x100000
+
+#define MAPPED_RAM_HDR_VERSION 1
+typedef struct MappedRamHeader {
+    uint32_t version;
+    /* The target's page size, to know how many pages are in the bitmap */
+    uint64_t page_size;
+    /* Offset in the migration file of the bitmap of pages present */
+    uint64_t bitmap_offset;
+    /* Offset in the migration file of the page region */
+    uint64_t pages_offset;
+} QEMU_PACKED MappedRamHeader;
+
 XBZRLECacheStats xbzrle_counters;
 
 /* used by the search for pages to send */
@@ -123,7 +149,10 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
+    /*
+     * Cache for XBZRLE.  The save path reads it under RCU; replacing
+     * or freeing it is serialized by lock.
+     */
     PageCache *cache;
     QemuMutex lock;
     /* it will store a page full of zeros */
@@ -151,8 +180,10 @@ static void XBZRLE_cache_unlock(void)
  *
  * This function is called from migrate_params_apply in main
  * thread, possibly while a migration is in progress.  A running
- * migration may be using the cache and might finish during this call,
- * hence changes to the cache are protected by XBZRLE.lock().
+ * migration may finish during this call, hence replacing the cache is
+ * serialized with xbzrle_cleanup() by XBZRLE.lock().  The migration
+ * thread may still be using the old cache, so it is freed after an
+ * RCU grace period.
  *
  * Returns 0 for success or -1 for error
  *
@@ -161,7 +192,7 @@ static void XBZRLE_cache_unlock(void)
  */
 int xbzrle_cache_resize(uint64_t new_size, Error **errp)
 {
-    PageCache *new_cache;
+    PageCache *new_cache, *old_cache;
     int64_t ret = 0;
 
     /* Check for truncation */
@@ -185,8 +216,9 @@ int xbzrle_cache_resize(uint64_t new_size, Error **errp)
             goto out;
         }
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+        old_cache = XBZRLE.cache;
+        qatomic_rcu_set(&XBZRLE.cache, new_cache);
+        cache_fini_rcu(old_cache);
     }
 out:
     XBZRLE_cache_unlock();
@@ -257,6 +289,21 @@ void ramblock_recv_bitmap_set_range(RAMBlock *rb, void *host_addr,
                       nr);
 }
 
+/*
+ * Record whether the page at @offset of @block is stored in the
+ * mapped-ram migration file.  Zero pages are not stored, the loader
+ * leaves them untouched.  May be called from the multifd threads.
+ */
+void ramblock_set_file_bmap_atomic(RAMBlock *block, ram_addr_t offset,
+                                   bool set)
+{
+    if (set) {
+        set_bit_atomic(offset >> TARGET_PAGE_BITS, block->file_bmap);
+    } else {
+        clear_bit_atomic(offset >> TARGET_PAGE_BITS, block->file_bmap);
+    }
+}
+
 #define  RAMBLOCK_RECV_BITMAP_ENDING  (0x0123456789abcdefULL)
 
 /*
@@ -572,7 +619,8 @@ static void xbzrle_cache_zero_page(ram_addr_t current_addr)
 {
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
-    cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
+    cache_insert(qatomic_rcu_read(&XBZRLE.cache), current_addr,
+                 XBZRLE.zero_target_page,
                  stat64_get(&mig_stats.dirty_sync_count));
 }
 
@@ -599,18 +647,21 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
     int encoded_len = 0, bytes_xbzrle;
     uint8_t *prev_cached_page;
     QEMUFile *file = pss->pss_channel;
+    PageCache *cache = qatomic_rcu_read(&XBZRLE.cache);
     uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
 
-    if (!cache_is_cached(XBZRLE.cache, current_addr, generation)) {
+    block->xbzrle_pages++;
+    if (!cache_is_cached(cache, current_addr, generation)) {
         xbzrle_counters.cache_miss++;
+        block->xbzrle_cache_miss++;
         if (!rs->last_stage) {
-            if (cache_insert(XBZRLE.cache, current_addr, *current_data,
+            if (cache_insert(cache, current_addr, *current_data,
                              generation) == -1) {
                 return -1;
             } else {
                 /* update *current_data when the page has been
                    inserted into cache */
-                *current_data = get_cached_data(XBZRLE.cache, current_addr);
+                *current_data = get_cached_data(cache, current_addr);
             }
         }
         return -1;
@@ -628,7 +679,7 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
      * guest page is good for xbzrle encoding.
      */
     xbzrle_counters.pages++;
-    prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
+    prev_cached_page = get_cached_data(cache, current_addr);
 
     /* save current buffer into memory */
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
@@ -659,6 +710,7 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
         trace_save_xbzrle_page_overflow();
         xbzrle_counters.overflow++;
         xbzrle_counters.bytes += TARGET_PAGE_SIZE;
+        block->xbzrle_bytes += TARGET_PAGE_SIZE;
         return -1;
     }
 
@@ -675,6 +727,7 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
      * RAM_SAVE_FLAG_CONTINUE.
      */
     xbzrle_counters.bytes += bytes_xbzrle - 8;
+    block->xbzrle_bytes += bytes_xbzrle - 8;
     ram_transferred_add(bytes_xbzrle);
 
     return 1;
@@ -932,6 +985,91 @@ uint64_t ram_get_total_transferred_pages(void)
         compress_ram_pages() + xbzrle_counters.pages;
 }
 
+/*
+ * Adaptive XBZRLE: once per rate period each block is judged on the
+ * cache lookups it made in that period.  A period is bad if nearly all
+ * lookups missed the cache, or if the hits did not compress enough to
+ * pay for copying pages into the cache and encoding them.  After
+ * XBZRLE_ADAPT_STRIKES bad periods in a row XBZRLE is turned off for
+ * the block, and retried after a number of periods that doubles every
+ * time it gets turned off again.
+ */
+#define XBZRLE_ADAPT_MIN_PAGES          256
+#define XBZRLE_ADAPT_MAX_MISS_RATE      0.9
+#define XBZRLE_ADAPT_MIN_ENCODING_RATE  1.5
+#define XBZRLE_ADAPT_STRIKES            2
+#define XBZRLE_ADAPT_BACKOFF_MIN        2
+#define XBZRLE_ADAPT_BACKOFF_MAX        64
+
+static void xbzrle_block_reset(RAMBlock *block)
+{
+    block->xbzrle_pages = 0;
+    block->xbzrle_cache_miss = 0;
+    block->xbzrle_bytes = 0;
+    block->xbzrle_strikes = 0;
+    block->xbzrle_disabled = 0;
+    block->xbzrle_backoff = XBZRLE_ADAPT_BACKOFF_MIN;
+}
+
+static void xbzrle_update_block(RAMBlock *block)
+{
+    uint64_t hits = block->xbzrle_pages - block->xbzrle_cache_miss;
+    double miss_rate, encoding_rate;
+
+    if (block->xbzrle_disabled) {
+        if (--block->xbzrle_disabled == 0) {
+            /*
+             * Pages of this block were sent in full while XBZRLE was
+             * off, so whatever the cache holds for it is stale.
+             */
+            cache_invalidate_range(qatomic_rcu_read(&XBZRLE.cache),
+                                   block->offset, block->used_length);
+            trace_ram_xbzrle_block_enable(block->idstr);
+        }
+        return;
+    }
+
+    if (block->xbzrle_pages < XBZRLE_ADAPT_MIN_PAGES) {
+        return;
+    }
+
+    miss_rate = (double)block->xbzrle_cache_miss / block->xbzrle_pages;
+    if (block->xbzrle_bytes) {
+        encoding_rate = (double)hits * TARGET_PAGE_SIZE / block->xbzrle_bytes;
+    } else {
+        /* unchanged pages are skipped and cost nothing on the wire */
+        encoding_rate = XBZRLE_ADAPT_MIN_ENCODING_RATE;
+    }
+
+    if (miss_rate <= XBZRLE_ADAPT_MAX_MISS_RATE &&
+        encoding_rate >= XBZRLE_ADAPT_MIN_ENCODING_RATE) {
+        block->xbzrle_strikes = 0;
+        block->xbzrle_backoff = XBZRLE_ADAPT_BACKOFF_MIN;
+    } else if (++block->xbzrle_strikes >= XBZRLE_ADAPT_STRIKES) {
+        trace_ram_xbzrle_block_disable(block->idstr, miss_rate, encoding_rate,
+                                       block->xbzrle_backoff);
+        block->xbzrle_strikes = 0;
+        block->xbzrle_disabled = block->xbzrle_backoff;
+        block->xbzrle_backoff = MIN(block->xbzrle_backoff * 2,
+                                    XBZRLE_ADAPT_BACKOFF_MAX);
+    }
+
+    block->xbzrle_pages = 0;
+    block->xbzrle_cache_miss = 0;
+    block->xbzrle_bytes = 0;
+}
+
+static void xbzrle_update_blocks(void)
+{
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        xbzrle_update_block(block);
+    }
+}
+
 static void migration_update_rates(RAMState *rs, int64_t end_time)
 {
     uint64_t page_count = rs->target_page_count - rs->target_page_count_prev;
@@ -961,6 +1099,10 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
         }
         rs->xbzrle_pages_prev = xbzrle_counters.pages;
         rs->xbzrle_bytes_prev = xbzrle_counters.bytes;
+
+        if (rs->xbzrle_started) {
+            xbzrle_update_blocks();
+        }
     }
     compress_update_rates(page_count);
 }
@@ -1123,10 +1265,27 @@ static int save_zero_page(RAMState *rs, PageSearchStatus *pss,
     QEMUFile *file = pss->pss_channel;
     int len = 0;
 
+    if (migrate_zero_page_detection() == ZERO_PAGE_DETECTION_NONE) {
+        return 0;
+    }
+
+    /* Leave the scan to the multifd send threads when they are in use */
+    if (migrate_zero_page_detection() == ZERO_PAGE_DETECTION_MULTIFD &&
+        migrate_multifd() && !migration_in_postcopy()) {
+        return 0;
+    }
+
     if (!buffer_is_zero(p, TARGET_PAGE_SIZE)) {
         return 0;
     }
 
+    if (migrate_mapped_ram()) {
+        /* Zero pages are left as holes in the file */
+        ramblock_set_file_bmap_atomic(pss->block, offset, false);
+        stat64_add(&mig_stats.zero_pages, 1);
+        return 1;
+    }
+
     len += save_page_header(pss, file, pss->block, offset | RAM_SAVE_FLAG_ZERO);
     qemu_put_byte(file, 0);
     len += 1;
@@ -1139,10 +1298,8 @@ static int save_zero_page(RAMState *rs, PageSearchStatus *pss,
      * Must let xbzrle know, otherwise a previous (now 0'd) cached
      * page would be stale.
      */
-    if (rs->xbzrle_started) {
-        XBZRLE_cache_lock();
+    if (rs->xbzrle_started && !pss->block->xbzrle_disabled) {
         xbzrle_cache_zero_page(pss->block->offset + offset);
-        XBZRLE_cache_unlock();
     }
 
     return len;
@@ -1190,6 +1347,14 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
 {
     QEMUFile *file = pss->pss_channel;
 
+    if (migrate_mapped_ram()) {
+        qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
+                           block->pages_offset + offset);
+        ramblock_set_file_bmap_atomic(block, offset, true);
+        stat64_add(&mig_stats.normal_pages, 1);
+        return 1;
+    }
+
     ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
                                          offset | RAM_SAVE_FLAG_PAGE));
     if (async) {
@@ -1228,8 +1393,8 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss)
     p = block->host + offset;
     trace_ram_save_page(block->idstr, (uint64_t)offset, p);
 
-    XBZRLE_cache_lock();
-    if (rs->xbzrle_started && !migration_in_postcopy()) {
+    if (rs->xbzrle_started && !migration_in_postcopy() &&
+        !block->xbzrle_disabled) {
         pages = save_xbzrle_page(rs, pss, &p, current_addr,
                                  block, offset);
         if (!rs->last_stage) {
@@ -1245,8 +1410,6 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss)
         pages = save_normal_page(pss, block, offset, p, send_async);
     }
 
-    XBZRLE_cache_unlock();
-
     return pages;
 }
 
@@ -1255,7 +1418,6 @@ static int ram_save_multifd_page(RAMBlock *block, ram_addr_t offset)
     if (multifd_queue_page(block, offset) < 0) {
         return -1;
     }
-    stat64_add(&mig_stats.normal_pages, 1);
 
     return 1;
 }
@@ -2375,7 +2537,7 @@ static void xbzrle_cleanup(void)
 {
     XBZRLE_cache_lock();
     if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
+        cache_fini_rcu(XBZRLE.cache);
         g_free(XBZRLE.encoded_buf);
         g_free(XBZRLE.current_buf);
         g_free(XBZRLE.zero_target_page);
@@ -2412,6 +2574,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2671,6 +2835,7 @@ int ram_discard_range(const char *rbname, uint64_t start, size_t length)
 static int xbzrle_init(void)
 {
     Error *local_err = NULL;
+    RAMBlock *block;
 
     if (!migrate_xbzrle()) {
         return 0;
@@ -2703,6 +2868,12 @@ static int xbzrle_init(void)
         goto free_encoded_buf;
     }
 
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            xbzrle_block_reset(block);
+        }
+    }
+
     /* We are all good */
     XBZRLE_cache_unlock();
     return 0;
@@ -2923,6 +3094,51 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * granularity of these critical sections.
  */
 
+/*
+ * Write the mapped-ram header of @block and reserve the space for its
+ * bitmap and pages.  The pages are written to their slot as they are
+ * sent, the bitmap once all of them are written, by ram_save_complete.
+ */
+static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
+{
+    MappedRamHeader header = {};
+    long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+
+    block->file_bmap = bitmap_new(num_pages);
+    block->bitmap_offset = qemu_get_offset(file) + sizeof(header);
+    block->pages_offset = ROUND_UP(block->bitmap_offset + bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    header.version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    header.page_size = cpu_to_be64(TARGET_PAGE_SIZE);
+    header.bitmap_offset = cpu_to_be64(block->bitmap_offset);
+    header.pages_offset = cpu_to_be64(block->pages_offset);
+
+    qemu_put_buffer(file, (uint8_t *)&header, sizeof(header));
+
+    /* The stream continues after the page region */
+    qemu_set_offset(file, block->pages_offset + block->used_length, SEEK_SET);
+}
+
+/* Write the bitmap of pages present in the file for each RAMBlock */
+static void mapped_ram_save_bitmaps(QEMUFile *file)
+{
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+        g_autofree unsigned long *le_bitmap = bitmap_new(num_pages);
+
+        bitmap_to_le(le_bitmap, block->file_bmap, num_pages);
+        qemu_put_buffer_at(file, (uint8_t *)le_bitmap, bitmap_size,
+                           block->bitmap_offset);
+    }
+}
+
 /**
  * ram_save_setup: Setup RAM for migration
  *
@@ -2965,6 +3181,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -3187,6 +3406,11 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         return ret;
     }
 
+    if (migrate_mapped_ram()) {
+        /* All pages are in the file now, the bitmaps are final */
+        mapped_ram_save_bitmaps(f);
+    }
+
     if (migrate_multifd() && !migrate_multifd_flush_after_each_section()) {
         qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_FLUSH);
     }
@@ -3788,6 +4012,155 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
+                                   Error **errp)
+{
+    size_t ret;
+
+    ret = qemu_get_buffer(file, (uint8_t *)header, sizeof(*header));
+    if (ret != sizeof(*header)) {
+        error_setg(errp, "Could not read whole mapped-ram migration header "
+                   "(expected %zd, got %zd bytes)", sizeof(*header), ret);
+        return false;
+    }
+
+    header->version = be32_to_cpu(header->version);
+    if (header->version > MAPPED_RAM_HDR_VERSION) {
+        error_setg(errp, "Migration mapped-ram capability version not "
+                   "supported (expected <= %d, got %d)",
+                   MAPPED_RAM_HDR_VERSION, header->version);
+        return false;
+    }
+
+    header->page_size = be64_to_cpu(header->page_size);
+    header->bitmap_offset = be64_to_cpu(header->bitmap_offset);
+    header->pages_offset = be64_to_cpu(header->pages_offset);
+
+    return true;
+}
+
+/*
+ * Read the pages of @block that are set in @bitmap from the page
+ * region of the file.  With multifd, the reads are handed out to the
+ * multifd channels in chunks of MAPPED_RAM_LOAD_BUF_SIZE.
+ */
+static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                     long num_pages, unsigned long *bitmap,
+                                     Error **errp)
+{
+    unsigned long set_bit_idx, clear_bit_idx;
+    ram_addr_t offset;
+    void *host;
+    size_t read, unread, size;
+
+    for (set_bit_idx = find_first_bit(bitmap, num_pages);
+         set_bit_idx < num_pages;
+         set_bit_idx = find_next_bit(bitmap, num_pages, clear_bit_idx + 1)) {
+
+        clear_bit_idx = find_next_zero_bit(bitmap, num_pages, set_bit_idx + 1);
+
+        unread = TARGET_PAGE_SIZE * (clear_bit_idx - set_bit_idx);
+        offset = set_bit_idx << TARGET_PAGE_BITS;
+
+        while (unread > 0) {
+            host = host_from_ram_block_offset(block, offset);
+            if (!host) {
+                error_setg(errp, "page outside of ramblock %s range",
+                           block->idstr);
+                return false;
+            }
+
+            size = MIN(unread, MAPPED_RAM_LOAD_BUF_SIZE);
+
+            if (migrate_multifd()) {
+                if (multifd_file_recv_data(host, size,
+                                           block->pages_offset + offset) < 0) {
+                    error_setg(errp, "multifd channel failed while loading "
+                               "ramblock %s", block->idstr);
+                    return false;
+                }
+                read = size;
+            } else {
+                read = qemu_get_buffer_at(f, host, size,
+                                          block->pages_offset + offset);
+                if (!read) {
+                    goto err;
+                }
+            }
+            offset += read;
+            unread -= read;
+        }
+    }
+
+    if (migrate_multifd() && multifd_file_recv_sync() < 0) {
+        error_setg(errp, "multifd channel failed while loading ramblock %s",
+                   block->idstr);
+        return false;
+    }
+
+    return true;
+
+err:
+    qemu_file_get_error_obj(f, errp);
+    error_prepend(errp, "(%s) failed to read page " RAM_ADDR_FMT
+                  " from file offset %" PRIx64 ": ", block->idstr, offset,
+                  block->pages_offset + offset);
+    return false;
+}
+
+static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                      ram_addr_t length, Error **errp)
+{
+    g_autofree unsigned long *bitmap = NULL;
+    MappedRamHeader header;
+    size_t bitmap_size;
+    long num_pages;
+
+    if (!mapped_ram_read_header(f, &header, errp)) {
+        return;
+    }
+
+    if (header.page_size != TARGET_PAGE_SIZE) {
+        error_setg(errp, "Mapped-ram page size mismatch for ramblock %s "
+                   "(expected 0x%x, got 0x%" PRIx64 ")", block->idstr,
+                   (unsigned)TARGET_PAGE_SIZE, header.page_size);
+        return;
+    }
+
+    block->pages_offset = header.pages_offset;
+
+    /*
+     * Check the alignment of the file region that contains pages. We
+     * don't enforce MAPPED_RAM_FILE_OFFSET_ALIGNMENT to allow that
+     * value to change in the future. Do only a sanity check with page
+     * size alignment.
+     */
+    if (!QEMU_IS_ALIGNED(block->pages_offset, TARGET_PAGE_SIZE)) {
+        error_setg(errp,
+                   "Error reading ramblock %s pages, region has bad alignment",
+                   block->idstr);
+        return;
+    }
+
+    num_pages = length / header.page_size;
+    bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+
+    bitmap = g_malloc0(bitmap_size);
+    if (qemu_get_buffer_at(f, (uint8_t *)bitmap, bitmap_size,
+                           header.bitmap_offset) != bitmap_size) {
+        error_setg(errp, "Error reading dirty bitmap");
+        return;
+    }
+    bitmap_from_le(bitmap, bitmap, num_pages);
+
+    if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
+        return;
+    }
+
+    /* Skip pages array */
+    qemu_set_offset(f, block->pages_offset + length, SEEK_SET);
+}
+
 static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
 {
     int ret = 0;
@@ -3831,6 +4204,16 @@ static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
             return -EINVAL;
         }
     }
+    if (migrate_mapped_ram()) {
+        Error *local_err = NULL;
+
+        parse_ramblock_mapped_ram(f, block, length, &local_err);
+        if (local_err) {
+            error_report_err(local_err);
+            return -EINVAL;
+        }
+        return 0;
+    }
     ret = rdma_block_notification_handle(f, block->idstr);
     if (ret < 0) {
         qemu_file_set_error(f, ret);
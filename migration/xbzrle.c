@@ -15,13 +15,39 @@
 #include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
 #include <immintrin.h>
 #include "host/cpuinfo.h"
+#define XBZRLE_ACCEL
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define XBZRLE_ACCEL
+#endif
 
-static int __attribute__((target("avx512bw")))
-xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                            uint8_t *dst, int dlen)
+#ifdef XBZRLE_ACCEL
+/*
+ * The vector encoders compare 64 bytes at a time and work on the
+ * resulting bit mask, where bit i is set if byte i is unchanged.
+ * Bits at and above @len are ignored by the caller.
+ */
+typedef uint64_t (*XBZRLECompareFunc)(const uint8_t *old_buf,
+                                      const uint8_t *new_buf, int len);
+
+static inline uint64_t xbzrle_compare_bytes(const uint8_t *old_buf,
+                                            const uint8_t *new_buf, int len)
+{
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        mask |= (uint64_t)(old_buf[i] == new_buf[i]) << i;
+    }
+    return mask;
+}
+
+static inline __attribute__((always_inline)) int
+xbzrle_encode_buffer_mask(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                          uint8_t *dst, int dlen, XBZRLECompareFunc compare)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0, num = 0;
@@ -31,23 +57,13 @@ xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
     /* countResidual is tail of data, i.e., countResidual = slen % 64 */
     uint32_t count_residual = slen & 0b111111;
     bool never_same = true;
-    uint64_t mask_residual = 1;
-    mask_residual <<= count_residual;
-    mask_residual -= 1;
-    __m512i r = _mm512_set1_epi32(0);
 
     while (count512s) {
         int bytes_to_check = 64;
-        uint64_t mask = 0xffffffffffffffff;
         if (count512s == 1) {
             bytes_to_check = count_residual;
-            mask = mask_residual;
         }
-        __m512i old_data = _mm512_mask_loadu_epi8(r,
-                                                  mask, old_buf + i);
-        __m512i new_data = _mm512_mask_loadu_epi8(r,
-                                                  mask, new_buf + i);
-        uint64_t comp = _mm512_cmpeq_epi8_mask(old_data, new_data);
+        uint64_t comp = compare(old_buf + i, new_buf + i, bytes_to_check);
         count512s--;
 
         bool is_same = (comp & 0x1);
@@ -137,19 +153,119 @@ xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
-static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
-                                    int slen, uint8_t *dst, int dlen);
+#ifdef CONFIG_AVX512BW_OPT
+static inline uint64_t __attribute__((target("avx512bw")))
+xbzrle_compare_avx512(const uint8_t *old_buf, const uint8_t *new_buf, int len)
+{
+    uint64_t mask = len == 64 ? UINT64_MAX : (1ULL << len) - 1;
+    __m512i r = _mm512_set1_epi32(0);
+    __m512i old_data = _mm512_mask_loadu_epi8(r, mask, old_buf);
+    __m512i new_data = _mm512_mask_loadu_epi8(r, mask, new_buf);
+
+    return _mm512_cmpeq_epi8_mask(old_data, new_data);
+}
+
+static int __attribute__((target("avx512bw")))
+xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                            uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_mask(old_buf, new_buf, slen, dst, dlen,
+                                     xbzrle_compare_avx512);
+}
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+static inline uint64_t __attribute__((target("avx2")))
+xbzrle_compare_avx2(const uint8_t *old_buf, const uint8_t *new_buf, int len)
+{
+    __m256i old0, old1, new0, new1;
+    uint32_t lo, hi;
+
+    if (unlikely(len < 64)) {
+        return xbzrle_compare_bytes(old_buf, new_buf, len);
+    }
+
+    old0 = _mm256_loadu_si256((const __m256i *)old_buf);
+    old1 = _mm256_loadu_si256((const __m256i *)(old_buf + 32));
+    new0 = _mm256_loadu_si256((const __m256i *)new_buf);
+    new1 = _mm256_loadu_si256((const __m256i *)(new_buf + 32));
+    lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(old0, new0));
+    hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(old1, new1));
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static int __attribute__((target("avx2")))
+xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                          uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_mask(old_buf, new_buf, slen, dst, dlen,
+                                     xbzrle_compare_avx2);
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+static inline uint64_t
+xbzrle_compare_neon(const uint8_t *old_buf, const uint8_t *new_buf, int len)
+{
+    static const uint8_t bits[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    uint8x16_t w, m0, m1, m2, m3;
+
+    if (unlikely(len < 64)) {
+        return xbzrle_compare_bytes(old_buf, new_buf, len);
+    }
+
+    /*
+     * Weight each byte of the comparison result by its bit position
+     * and fold the four vectors with pairwise adds, so that byte k of
+     * the result holds the mask for bytes 8k..8k+7.
+     */
+    w = vld1q_u8(bits);
+    m0 = vandq_u8(vceqq_u8(vld1q_u8(old_buf), vld1q_u8(new_buf)), w);
+    m1 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + 16),
+                           vld1q_u8(new_buf + 16)), w);
+    m2 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + 32),
+                           vld1q_u8(new_buf + 32)), w);
+    m3 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + 48),
+                           vld1q_u8(new_buf + 48)), w);
+    m0 = vpaddq_u8(vpaddq_u8(m0, m1), vpaddq_u8(m2, m3));
+    m0 = vpaddq_u8(m0, m0);
+
+    return vgetq_lane_u64(vreinterpretq_u64_u8(m0), 0);
+}
+
+static int xbzrle_encode_buffer_neon(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_mask(old_buf, new_buf, slen, dst, dlen,
+                                     xbzrle_compare_neon);
+}
+#endif
 
 static int (*accel_func)(uint8_t *, uint8_t *, int, uint8_t *, int);
 
 static void __attribute__((constructor)) init_accel(void)
 {
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
     unsigned info = cpuinfo_init();
+#endif
+
+    accel_func = xbzrle_encode_buffer_int;
+#ifdef CONFIG_AVX2_OPT
+    if (info & CPUINFO_AVX2) {
+        accel_func = xbzrle_encode_buffer_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512BW_OPT
     if (info & CPUINFO_AVX512BW) {
         accel_func = xbzrle_encode_buffer_avx512;
-    } else {
-        accel_func = xbzrle_encode_buffer_int;
     }
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    accel_func = xbzrle_encode_buffer_neon;
+#endif
 }
 
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
@@ -273,6 +389,14 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+#ifndef XBZRLE_ACCEL
+int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                             uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer(old_buf, new_buf, slen, dst, dlen);
+}
+#endif
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
@@ -17,6 +17,13 @@
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
 
+/*
+ * Portable encoder, which xbzrle_encode_buffer() replaces with a vector one
+ * on hosts that have it.  Both produce the same output.
+ */
+int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                             uint8_t *dst, int dlen);
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 
 #endif
@@ -28,6 +28,7 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -101,6 +102,11 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* IOThreads that client connections are spread over, round-robin */
+    IOThread **iothreads;
+    size_t nr_iothreads;
+    size_t next_iothread;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -128,6 +134,11 @@ struct NBDClient {
     QemuMutex lock;
 
     NBDExport *exp;
+    /*
+     * AioContext the client's coroutines run in if the export spreads
+     * clients over IOThreads, otherwise NULL to follow the export.
+     */
+    AioContext *ctx;
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
@@ -157,6 +168,11 @@ struct NBDClient {
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return client->ctx ?: client->exp->common.ctx;
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -1709,7 +1725,7 @@ static bool nbd_drained_poll(void *opaque)
                  * qio_channel_yield().
                  */
                 if (client->recv_coroutine != NULL && client->read_yielding) {
-                    aio_bh_schedule_oneshot(nbd_export_aio_context(client->exp),
+                    aio_bh_schedule_oneshot(nbd_client_aio_context(client),
                                             nbd_wake_read_bh, client);
                 }
 
@@ -1759,6 +1775,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
     BlockDirtyBitmapOrStrList *bitmaps;
+    strList *iothreads;
     size_t i;
     int ret;
 
@@ -1800,6 +1817,20 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         return ret;
     }
 
+    for (iothreads = arg->iothreads; iothreads; iothreads = iothreads->next) {
+        if (!iothread_by_id(iothreads->value)) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            return -EINVAL;
+        }
+        exp->nr_iothreads++;
+    }
+    exp->iothreads = g_new0(IOThread *, exp->nr_iothreads);
+    for (i = 0, iothreads = arg->iothreads; iothreads;
+         i++, iothreads = iothreads->next) {
+        exp->iothreads[i] = iothread_by_id(iothreads->value);
+        object_ref(OBJECT(exp->iothreads[i]));
+    }
+
     QTAILQ_INIT(&exp->clients);
     exp->name = g_strdup(name);
     exp->description = g_strdup(arg->description);
@@ -1907,6 +1938,10 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
 fail:
     bdrv_graph_rdunlock_main_loop();
+    for (i = 0; i < exp->nr_iothreads; i++) {
+        object_unref(OBJECT(exp->iothreads[i]));
+    }
+    g_free(exp->iothreads);
     g_free(exp->export_bitmaps);
     g_free(exp->name);
     g_free(exp->description);
@@ -1977,6 +2012,11 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    for (i = 0; i < exp->nr_iothreads; i++) {
+        object_unref(OBJECT(exp->iothreads[i]));
+    }
+    g_free(exp->iothreads);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -2382,78 +2422,86 @@ static int coroutine_fn blockalloc_to_extents(BlockBackend *blk,
     return 0;
 }
 
+/*
+ * One NBD_REPLY_TYPE_BLOCK_STATUS(_EXT) chunk of a block status reply.
+ * All chunks of a reply are sent together by nbd_co_send_extents().
+ */
+typedef struct NBDExtentsChunk {
+    NBDReply hdr;
+    NBDStructuredMeta meta;
+    NBDExtendedMeta meta_ext;
+    NBDExtent32 *narrow_extents;
+    NBDExtentArray *ea;
+    uint32_t context_id;
+} NBDExtentsChunk;
+
 /*
  * nbd_co_send_extents
  *
- * @ea is converted to BE by the function
- * @last controls whether NBD_REPLY_FLAG_DONE is sent.
+ * Send @nb_chunks block status chunks in one write.  The extent arrays are
+ * converted to BE by the function.
+ * @last controls whether NBD_REPLY_FLAG_DONE is sent with the last chunk.
  */
 static int coroutine_fn
-nbd_co_send_extents(NBDClient *client, NBDRequest *request, NBDExtentArray *ea,
-                    bool last, uint32_t context_id, Error **errp)
+nbd_co_send_extents(NBDClient *client, NBDRequest *request,
+                    NBDExtentsChunk *chunks, unsigned nb_chunks, bool last,
+                    Error **errp)
 {
-    NBDReply hdr;
-    NBDStructuredMeta meta;
-    NBDExtendedMeta meta_ext;
-    g_autofree NBDExtent32 *extents = NULL;
-    uint16_t type;
-    struct iovec iov[] = { {.iov_base = &hdr}, {0}, {0} };
+    g_autofree struct iovec *iov = g_new0(struct iovec, nb_chunks * 3);
+    unsigned i;
 
-    if (client->mode >= NBD_MODE_EXTENDED) {
-        type = NBD_REPLY_TYPE_BLOCK_STATUS_EXT;
+    for (i = 0; i < nb_chunks; i++) {
+        NBDExtentsChunk *chunk = &chunks[i];
+        NBDExtentArray *ea = chunk->ea;
+        bool done = last && i == nb_chunks - 1;
+        uint16_t type;
 
-        iov[1].iov_base = &meta_ext;
-        iov[1].iov_len = sizeof(meta_ext);
-        stl_be_p(&meta_ext.context_id, context_id);
-        stl_be_p(&meta_ext.count, ea->count);
+        iov[i * 3].iov_base = &chunk->hdr;
+        if (client->mode >= NBD_MODE_EXTENDED) {
+            type = NBD_REPLY_TYPE_BLOCK_STATUS_EXT;
 
-        nbd_extent_array_convert_to_be(ea);
-        iov[2].iov_base = ea->extents;
-        iov[2].iov_len = ea->count * sizeof(ea->extents[0]);
-    } else {
-        type = NBD_REPLY_TYPE_BLOCK_STATUS;
+            iov[i * 3 + 1].iov_base = &chunk->meta_ext;
+            iov[i * 3 + 1].iov_len = sizeof(chunk->meta_ext);
+            stl_be_p(&chunk->meta_ext.context_id, chunk->context_id);
+            stl_be_p(&chunk->meta_ext.count, ea->count);
 
-        iov[1].iov_base = &meta;
-        iov[1].iov_len = sizeof(meta);
-        stl_be_p(&meta.context_id, context_id);
+            nbd_extent_array_convert_to_be(ea);
+            iov[i * 3 + 2].iov_base = ea->extents;
+            iov[i * 3 + 2].iov_len = ea->count * sizeof(ea->extents[0]);
+        } else {
+            type = NBD_REPLY_TYPE_BLOCK_STATUS;
 
-        extents = nbd_extent_array_convert_to_narrow(ea);
-        iov[2].iov_base = extents;
-        iov[2].iov_len = ea->count * sizeof(extents[0]);
-    }
+            iov[i * 3 + 1].iov_base = &chunk->meta;
+            iov[i * 3 + 1].iov_len = sizeof(chunk->meta);
+            stl_be_p(&chunk->meta.context_id, chunk->context_id);
 
-    trace_nbd_co_send_extents(request->cookie, ea->count, context_id,
-                              ea->total_length, last);
-    set_be_chunk(client, iov, 3, last ? NBD_REPLY_FLAG_DONE : 0, type,
-                 request);
+            chunk->narrow_extents = nbd_extent_array_convert_to_narrow(ea);
+            iov[i * 3 + 2].iov_base = chunk->narrow_extents;
+            iov[i * 3 + 2].iov_len =
+                ea->count * sizeof(chunk->narrow_extents[0]);
+        }
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+        trace_nbd_co_send_extents(request->cookie, ea->count,
+                                  chunk->context_id, ea->total_length, done);
+        set_be_chunk(client, &iov[i * 3], 3, done ? NBD_REPLY_FLAG_DONE : 0,
+                     type, request);
+    }
+
+    return nbd_co_send_iov(client, iov, nb_chunks * 3, errp);
 }
 
-/* Get block status from the exported device and send it to the client */
-static int
-coroutine_fn nbd_co_send_block_status(NBDClient *client, NBDRequest *request,
-                                      BlockBackend *blk, uint64_t offset,
-                                      uint64_t length, bool dont_fragment,
-                                      bool last, uint32_t context_id,
-                                      Error **errp)
+/* Get block status from the exported device into @ea */
+static int coroutine_fn nbd_block_status_to_extents(BlockBackend *blk,
+                                                    uint64_t offset,
+                                                    uint64_t length,
+                                                    uint32_t context_id,
+                                                    NBDExtentArray *ea)
 {
-    int ret;
-    unsigned int nb_extents = dont_fragment ? 1 : NBD_MAX_BLOCK_STATUS_EXTENTS;
-    g_autoptr(NBDExtentArray) ea =
-        nbd_extent_array_new(nb_extents, client->mode);
-
     if (context_id == NBD_META_ID_BASE_ALLOCATION) {
-        ret = blockstatus_to_extents(blk, offset, length, ea);
+        return blockstatus_to_extents(blk, offset, length, ea);
     } else {
-        ret = blockalloc_to_extents(blk, offset, length, ea);
+        return blockalloc_to_extents(blk, offset, length, ea);
     }
-    if (ret < 0) {
-        return nbd_co_send_chunk_error(client, request, -ret,
-                                       "can't get block status", errp);
-    }
-
-    return nbd_co_send_extents(client, request, ea, last, context_id, errp);
 }
 
 /* Populate @ea from a dirty bitmap. */
@@ -2489,21 +2537,82 @@ static void bitmap_to_extents(BdrvDirtyBitmap *bitmap,
     bdrv_dirty_bitmap_unlock(bitmap);
 }
 
-static int coroutine_fn nbd_co_send_bitmap(NBDClient *client,
-                                           NBDRequest *request,
-                                           BdrvDirtyBitmap *bitmap,
-                                           uint64_t offset,
-                                           uint64_t length, bool dont_fragment,
-                                           bool last, uint32_t context_id,
-                                           Error **errp)
+/*
+ * Collect the extents of all contexts selected in @request and send them as
+ * one batch of chunks.  If querying the block status fails, the chunks
+ * collected so far are sent, followed by an error chunk that ends the reply.
+ */
+static int coroutine_fn nbd_co_send_block_status(NBDClient *client,
+                                                 NBDRequest *request,
+                                                 Error **errp)
 {
+    NBDExport *exp = client->exp;
+    NBDMetaContexts *contexts = request->contexts;
+    bool dont_fragment = request->flags & NBD_CMD_FLAG_REQ_ONE;
     unsigned int nb_extents = dont_fragment ? 1 : NBD_MAX_BLOCK_STATUS_EXTENTS;
-    g_autoptr(NBDExtentArray) ea =
-        nbd_extent_array_new(nb_extents, client->mode);
+    g_autofree NBDExtentsChunk *chunks = g_new0(NBDExtentsChunk,
+                                                contexts->count);
+    unsigned nb_chunks = 0;
+    size_t i;
+    int ret = 0;
+
+    assert(contexts->exp == exp);
+
+    if (contexts->base_allocation) {
+        chunks[nb_chunks++].context_id = NBD_META_ID_BASE_ALLOCATION;
+    }
+    if (contexts->allocation_depth) {
+        chunks[nb_chunks++].context_id = NBD_META_ID_ALLOCATION_DEPTH;
+    }
+    for (i = 0; i < exp->nr_export_bitmaps; i++) {
+        if (contexts->bitmaps[i]) {
+            chunks[nb_chunks++].context_id = NBD_META_ID_DIRTY_BITMAP + i;
+        }
+    }
+    assert(nb_chunks == contexts->count);
 
-    bitmap_to_extents(bitmap, offset, length, ea);
+    for (i = 0; i < nb_chunks; i++) {
+        uint32_t context_id = chunks[i].context_id;
+
+        chunks[i].ea = nbd_extent_array_new(nb_extents, client->mode);
+        if (context_id >= NBD_META_ID_DIRTY_BITMAP) {
+            bitmap_to_extents(
+                exp->export_bitmaps[context_id - NBD_META_ID_DIRTY_BITMAP],
+                request->from, request->len, chunks[i].ea);
+            continue;
+        }
+
+        ret = nbd_block_status_to_extents(exp->common.blk, request->from,
+                                          request->len, context_id,
+                                          chunks[i].ea);
+        if (ret < 0) {
+            nbd_extent_array_free(chunks[i].ea);
+            chunks[i].ea = NULL;
+            break;
+        }
+    }
+
+    if (i) {
+        int send_ret = nbd_co_send_extents(client, request, chunks, i,
+                                           ret >= 0, errp);
+        if (send_ret < 0) {
+            ret = send_ret;
+            goto out;
+        }
+    }
+    if (ret < 0) {
+        ret = nbd_co_send_chunk_error(client, request, -ret,
+                                      "can't get block status", errp);
+    }
 
-    return nbd_co_send_extents(client, request, ea, last, context_id, errp);
+out:
+    for (i = 0; i < nb_chunks; i++) {
+        if (chunks[i].ea) {
+            nbd_extent_array_free(chunks[i].ea);
+        }
+        g_free(chunks[i].narrow_extents);
+    }
+    return ret;
 }
 
 /*
@@ -2875,7 +2984,6 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
     int flags;
     NBDExport *exp = client->exp;
     char *msg;
-    size_t i;
 
     switch (request->type) {
     case NBD_CMD_CACHE:
@@ -2933,57 +3041,11 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         assert(client->mode >= NBD_MODE_EXTENDED ||
                request->len <= UINT32_MAX);
         if (request->contexts->count) {
-            bool dont_fragment = request->flags & NBD_CMD_FLAG_REQ_ONE;
-            int contexts_remaining = request->contexts->count;
-
             if (!request->len) {
                 return nbd_send_generic_reply(client, request, -EINVAL,
                                               "need non-zero length", errp);
             }
-            if (request->contexts->base_allocation) {
-                ret = nbd_co_send_block_status(client, request,
-                                               exp->common.blk,
-                                               request->from,
-                                               request->len, dont_fragment,
-                                               !--contexts_remaining,
-                                               NBD_META_ID_BASE_ALLOCATION,
-                                               errp);
-                if (ret < 0) {
-                    return ret;
-                }
-            }
-
-            if (request->contexts->allocation_depth) {
-                ret = nbd_co_send_block_status(client, request,
-                                               exp->common.blk,
-                                               request->from, request->len,
-                                               dont_fragment,
-                                               !--contexts_remaining,
-                                               NBD_META_ID_ALLOCATION_DEPTH,
-                                               errp);
-                if (ret < 0) {
-                    return ret;
-                }
-            }
-
-            assert(request->contexts->exp == client->exp);
-            for (i = 0; i < client->exp->nr_export_bitmaps; i++) {
-                if (!request->contexts->bitmaps[i]) {
-                    continue;
-                }
-                ret = nbd_co_send_bitmap(client, request,
-                                         client->exp->export_bitmaps[i],
-                                         request->from, request->len,
-                                         dont_fragment, !--contexts_remaining,
-                                         NBD_META_ID_DIRTY_BITMAP + i, errp);
-                if (ret < 0) {
-                    return ret;
-                }
-            }
-
-            assert(!contexts_remaining);
-
-            return 0;
+            return nbd_co_send_block_status(client, request, errp);
         } else if (client->contexts.count) {
             return nbd_send_generic_reply(client, request, -EINVAL,
                                           "CMD_BLOCK_STATUS payload not valid",
@@ -3147,7 +3209,8 @@ static void nbd_client_receive_next_request(NBDClient *client)
         !client->quiescing) {
         nbd_client_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, client);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client),
+                        client->recv_coroutine);
     }
 }
 
@@ -3166,6 +3229,15 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    if (client->exp->nr_iothreads) {
+        NBDExport *exp = client->exp;
+        IOThread *iothread = exp->iothreads[exp->next_iothread];
+
+        exp->next_iothread = (exp->next_iothread + 1) % exp->nr_iothreads;
+        client->ctx = iothread_get_aio_context(iothread);
+        trace_nbd_client_iothread(exp->name, client->ctx);
+    }
+
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
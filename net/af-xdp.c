@@ -24,6 +24,7 @@
 #include "net/net.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
@@ -44,6 +45,7 @@ typedef struct AFXDPState {
     bool                 read_poll;
     bool                 write_poll;
     uint32_t             outstanding_tx;
+    uint32_t             pending_tx;
 
     uint64_t             *pool;
     uint32_t             n_pool;
@@ -140,6 +142,27 @@ static void af_xdp_writable(void *opaque)
     qemu_flush_queued_packets(&s->nc);
 }
 
+/*
+ * Hand the descriptors filled by af_xdp_receive() to the kernel.  Called
+ * once per burst when the peer transmits inside a defer_call section.
+ */
+static void af_xdp_submit_tx(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    if (!s->pending_tx) {
+        return;
+    }
+
+    xsk_ring_prod__submit(&s->tx, s->pending_tx);
+    s->outstanding_tx += s->pending_tx;
+    s->pending_tx = 0;
+
+    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, true);
+    }
+}
+
 static ssize_t af_xdp_receive(NetClientState *nc,
                               const uint8_t *buf, size_t size)
 {
@@ -172,12 +195,8 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     data = xsk_umem__get_data(s->buffer, desc->addr);
     memcpy(data, buf, size);
 
-    xsk_ring_prod__submit(&s->tx, 1);
-    s->outstanding_tx++;
-
-    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
-        af_xdp_write_poll(s, true);
-    }
+    s->pending_tx++;
+    defer_call(af_xdp_submit_tx, s);
 
     return size;
 }
@@ -227,6 +246,12 @@ static void af_xdp_send(void *opaque)
         return;
     }
 
+    /*
+     * Frames are copied from the umem straight into the peer's buffers;
+     * let it signal the guest once for the whole batch.
+     */
+    defer_call_begin();
+
     for (i = 0; i < n_rx; i++) {
         const struct xdp_desc *desc;
         struct iovec iov;
@@ -253,6 +278,8 @@ static void af_xdp_send(void *opaque)
         }
     }
 
+    defer_call_end();
+
     /* Release actually sent descriptors and try to re-fill. */
     xsk_ring_cons__release(&s->rx, n_rx);
     af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
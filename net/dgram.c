@@ -35,6 +35,10 @@
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
+
+/* Datagrams sent or received with a single sendmmsg/recvmmsg call */
+#define NET_DGRAM_BATCH 16
 
 typedef struct NetDgramState {
     NetClientState nc;
@@ -45,6 +49,13 @@ typedef struct NetDgramState {
     /* contains destination iff connectionless */
     struct sockaddr *dest_addr;
     socklen_t dest_len;
+#ifdef CONFIG_SENDMMSG
+    /* copies of the datagrams waiting for net_dgram_flush_tx() */
+    struct iovec tx_iov[NET_DGRAM_BATCH];
+    unsigned int tx_count;
+    /* receive buffers, allocated on first use */
+    uint8_t *rx_buf;
+#endif
 } NetDgramState;
 
 static void net_dgram_send(void *opaque);
@@ -70,15 +81,101 @@ static void net_dgram_write_poll(NetDgramState *s, bool enable)
     net_dgram_update_fd_handler(s);
 }
 
+#ifdef CONFIG_SENDMMSG
+/*
+ * Send the datagrams queued by net_dgram_receive().  Called once per burst
+ * when the peer transmits inside a defer_call section.  Return false if
+ * the socket could not take all of them; the rest are sent once it
+ * becomes writable.
+ */
+static bool net_dgram_flush_tx(NetDgramState *s)
+{
+    struct mmsghdr msgs[NET_DGRAM_BATCH];
+    unsigned int i, sent = 0;
+    int ret;
+
+    while (sent < s->tx_count) {
+        unsigned int n = s->tx_count - sent;
+
+        for (i = 0; i < n; i++) {
+            msgs[i] = (struct mmsghdr) {
+                .msg_hdr = {
+                    .msg_name = s->dest_addr,
+                    .msg_namelen = s->dest_addr ? s->dest_len : 0,
+                    .msg_iov = &s->tx_iov[sent + i],
+                    .msg_iovlen = 1,
+                },
+            };
+        }
+
+        ret = RETRY_ON_EINTR(sendmmsg(s->fd, msgs, n, 0));
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            /* Like send() errors, drop the datagram that failed */
+            ret = 1;
+        }
+        for (i = 0; i < ret; i++) {
+            g_free(s->tx_iov[sent + i].iov_base);
+        }
+        sent += ret;
+    }
+
+    s->tx_count -= sent;
+    memmove(s->tx_iov, &s->tx_iov[sent], s->tx_count * sizeof(s->tx_iov[0]));
+
+    if (s->tx_count) {
+        net_dgram_write_poll(s, true);
+        return false;
+    }
+    return true;
+}
+
+static void net_dgram_flush_tx_deferred(void *opaque)
+{
+    net_dgram_flush_tx(opaque);
+}
+#endif
+
 static void net_dgram_writable(void *opaque)
 {
     NetDgramState *s = opaque;
 
     net_dgram_write_poll(s, false);
 
+#ifdef CONFIG_SENDMMSG
+    if (!net_dgram_flush_tx(s)) {
+        return;
+    }
+#endif
+
     qemu_flush_queued_packets(&s->nc);
 }
 
+#ifdef CONFIG_SENDMMSG
+static ssize_t net_dgram_receive(NetClientState *nc,
+                                 const uint8_t *buf, size_t size)
+{
+    NetDgramState *s = DO_UPCAST(NetDgramState, nc, nc);
+
+    /*
+     * Datagrams are copied and sent together at the end of the sender's
+     * defer_call section, or right away outside of one.  Once the socket
+     * is full, let the net queue hold the packets.
+     */
+    if (s->tx_count == NET_DGRAM_BATCH && !net_dgram_flush_tx(s)) {
+        return 0;
+    }
+    s->tx_iov[s->tx_count].iov_base = g_memdup2(buf, size);
+    s->tx_iov[s->tx_count].iov_len = size;
+    s->tx_count++;
+    if (!s->write_poll) {
+        defer_call(net_dgram_flush_tx_deferred, s);
+    }
+    return size;
+}
+#else
 static ssize_t net_dgram_receive(NetClientState *nc,
                                  const uint8_t *buf, size_t size)
 {
@@ -99,6 +196,7 @@ static ssize_t net_dgram_receive(NetClientState *nc,
     }
     return ret;
 }
+#endif
 
 static void net_dgram_send_completed(NetClientState *nc, ssize_t len)
 {
@@ -120,6 +218,55 @@ static void net_dgram_rs_finalize(SocketReadState *rs)
     }
 }
 
+#ifdef CONFIG_SENDMMSG
+static void net_dgram_send(void *opaque)
+{
+    NetDgramState *s = opaque;
+    struct mmsghdr msgs[NET_DGRAM_BATCH];
+    struct iovec iov[NET_DGRAM_BATCH];
+    int i, n;
+
+    if (!s->rx_buf) {
+        s->rx_buf = g_malloc(NET_DGRAM_BATCH * NET_BUFSIZE);
+    }
+    for (i = 0; i < NET_DGRAM_BATCH; i++) {
+        iov[i].iov_base = s->rx_buf + i * NET_BUFSIZE;
+        iov[i].iov_len = NET_BUFSIZE;
+        msgs[i] = (struct mmsghdr) {
+            .msg_hdr = {
+                .msg_iov = &iov[i],
+                .msg_iovlen = 1,
+            },
+        };
+    }
+
+    n = RETRY_ON_EINTR(recvmmsg(s->fd, msgs, NET_DGRAM_BATCH, MSG_DONTWAIT,
+                                 NULL));
+    if (n < 0) {
+        return;
+    }
+    if (n == 0) {
+        /* end of connection */
+        net_dgram_read_poll(s, false);
+        net_dgram_write_poll(s, false);
+        return;
+    }
+
+    /* Let the peer signal the guest once for the whole batch */
+    defer_call_begin();
+    for (i = 0; i < n; i++) {
+        /*
+         * Once the peer stops receiving, the remaining datagrams of the
+         * batch are copied to the net queue behind the first one.
+         */
+        if (qemu_send_packet_async(&s->nc, iov[i].iov_base, msgs[i].msg_len,
+                                   net_dgram_send_completed) == 0) {
+            net_dgram_read_poll(s, false);
+        }
+    }
+    defer_call_end();
+}
+#else
 static void net_dgram_send(void *opaque)
 {
     NetDgramState *s = opaque;
@@ -140,6 +287,7 @@ static void net_dgram_send(void *opaque)
         net_dgram_read_poll(s, false);
     }
 }
+#endif
 
 static int net_dgram_mcast_create(struct sockaddr_in *mcastaddr,
                                   struct in_addr *localaddr,
@@ -244,6 +392,13 @@ static void net_dgram_cleanup(NetClientState *nc)
         close(s->fd);
         s->fd = -1;
     }
+#ifdef CONFIG_SENDMMSG
+    while (s->tx_count) {
+        g_free(s->tx_iov[--s->tx_count].iov_base);
+    }
+    g_free(s->rx_buf);
+    s->rx_buf = NULL;
+#endif
     g_free(s->dest_addr);
     s->dest_addr = NULL;
     s->dest_len = 0;
@@ -32,6 +32,7 @@
 #include "qemu/sockets.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
+#include "qemu/defer-call.h"
 
 typedef struct NetSocketState {
     NetClientState nc;
@@ -183,7 +184,10 @@ static void net_socket_send(void *opaque)
     }
     buf = buf1;
 
+    /* A read can hold many packets, signal the guest once for all of them */
+    defer_call_begin();
     ret = net_fill_rstate(&s->rs, buf, size);
+    defer_call_end();
 
     if (ret == -1) {
         goto eoc;
@@ -35,6 +35,7 @@
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "io/channel.h"
 #include "io/channel-socket.h"
 #include "io/net-listener.h"
@@ -182,7 +183,10 @@ static gboolean net_stream_send(QIOChannel *ioc,
     }
     buf = buf1;
 
+    /* A read can hold many packets, signal the guest once for all of them */
+    defer_call_begin();
     ret = net_fill_rstate(&s->rs, (const uint8_t *)buf, size);
+    defer_call_end();
 
     if (ret == -1) {
         goto eoc;
@@ -39,6 +39,7 @@
 #include "sysemu/sysemu.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
@@ -187,6 +188,9 @@ static void tap_send(void *opaque)
     int size;
     int packets = 0;
 
+    /* Let the peer signal the guest once for all the packets read here */
+    defer_call_begin();
+
     while (true) {
         uint8_t *buf = s->buf;
         uint8_t min_pkt[ETH_ZLEN];
@@ -228,6 +232,8 @@ static void tap_send(void *opaque)
             break;
         }
     }
+
+    defer_call_end();
 }
 
 static bool tap_has_ufo(NetClientState *nc)
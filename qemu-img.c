@@ -44,10 +44,12 @@
 #include "qemu/sockets.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/block-backend.h"
 #include "block/block_int.h"
 #include "block/blockjob.h"
+#include "block/thread-pool.h"
 #include "block/dirty-bitmap.h"
 #include "block/qapi.h"
 #include "crypto/init.h"
@@ -1667,6 +1669,30 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/*
+ * Each convert coroutine reads a chunk, splits it into data and zero runs
+ * in the thread pool, and then waits for its turn to write it (or hand it
+ * to the format driver for compression), so that the stages of different
+ * chunks overlap.
+ */
+typedef enum ImgConvertStage {
+    CONVERT_STAGE_READ,
+    CONVERT_STAGE_ZERO_DETECT,
+    CONVERT_STAGE_WRITE,
+    CONVERT_STAGE__MAX,
+} ImgConvertStage;
+
+typedef struct ImgConvertStageStats {
+    uint64_t bytes;
+    int64_t busy_ns;    /* summed over all coroutines */
+} ImgConvertStageStats;
+
+/* A run of sectors in a read buffer that is written in the same way */
+typedef struct ImgConvertRun {
+    int nb_sectors;
+    bool data;          /* false if the sectors can be treated as zeroes */
+} ImgConvertRun;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1699,8 +1725,17 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+    int64_t elapsed_ns;
+    ImgConvertStageStats stats[CONVERT_STAGE__MAX];
 } ImgConvertState;
 
+static void convert_stage_done(ImgConvertState *s, ImgConvertStage stage,
+                               int nb_sectors, int64_t start_ns)
+{
+    s->stats[stage].bytes += (uint64_t)nb_sectors * BDRV_SECTOR_SIZE;
+    s->stats[stage].busy_ns += get_clock() - start_ns;
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -1873,10 +1908,96 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
     return 0;
 }
 
+typedef struct ImgConvertZeroDetect {
+    ImgConvertState *s;
+    const uint8_t *buf;
+    int64_t sector_num;
+    int nb_sectors;
+    ImgConvertRun *runs;
+} ImgConvertZeroDetect;
+
+/* Runs in a thread pool worker */
+static int convert_zero_detect_func(void *opaque)
+{
+    ImgConvertZeroDetect *zd = opaque;
+    ImgConvertState *s = zd->s;
+    const uint8_t *buf = zd->buf;
+    int64_t sector_num = zd->sector_num;
+    int nb_sectors = zd->nb_sectors;
+    int nb_runs = 0;
+
+    while (nb_sectors > 0) {
+        int n = nb_sectors;
+        bool data;
+
+        if (s->compressed) {
+            /*
+             * Compressed clusters need to be written as a whole, so we can
+             * only save the write if the cluster is completely zeroed.
+             */
+            n = MIN(n, s->cluster_sectors);
+            data = !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE);
+        } else {
+            data = is_allocated_sectors_min(buf, n, &n, s->min_sparse,
+                                            sector_num, s->alignment);
+        }
+
+        if (nb_runs && zd->runs[nb_runs - 1].data == data) {
+            zd->runs[nb_runs - 1].nb_sectors += n;
+        } else {
+            zd->runs[nb_runs++] = (ImgConvertRun) {
+                .nb_sectors = n,
+                .data = data,
+            };
+        }
+
+        sector_num += n;
+        nb_sectors -= n;
+        buf += n * BDRV_SECTOR_SIZE;
+    }
+
+    return 0;
+}
+
+/*
+ * Split the data in @buf into runs that must be written and runs that can
+ * be treated as zero sectors.  @runs must have room for @nb_sectors runs.
+ */
+static void coroutine_fn convert_co_zero_detect(ImgConvertState *s,
+                                                int64_t sector_num,
+                                                int nb_sectors,
+                                                const uint8_t *buf,
+                                                ImgConvertRun *runs)
+{
+    ImgConvertZeroDetect zd = {
+        .s = s,
+        .buf = buf,
+        .sector_num = sector_num,
+        .nb_sectors = nb_sectors,
+        .runs = runs,
+    };
+    int64_t start_ns = get_clock();
+
+    /*
+     * If we're told to keep the target fully allocated (-S 0), everything
+     * must be written.
+     */
+    if (!s->min_sparse) {
+        runs[0] = (ImgConvertRun) {
+            .nb_sectors = nb_sectors,
+            .data = true,
+        };
+    } else {
+        thread_pool_submit_co(convert_zero_detect_func, &zd);
+    }
+
+    convert_stage_done(s, CONVERT_STAGE_ZERO_DETECT, nb_sectors, start_ns);
+}
 
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
-                                         enum ImgConvertBlockStatus status)
+                                         enum ImgConvertBlockStatus status,
+                                         const ImgConvertRun *runs)
 {
     int ret;
 
@@ -1893,19 +2014,13 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
             break;
 
         case BLK_DATA:
-            /* If we're told to keep the target fully allocated (-S 0) or there
-             * is real non-zero data, we must write it. Otherwise we can treat
-             * it as zero sectors.
-             * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
-            if (!s->min_sparse ||
-                (!s->compressed &&
-                 is_allocated_sectors_min(buf, n, &n, s->min_sparse,
-                                          sector_num, s->alignment)) ||
-                (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
-            {
+            /*
+             * convert_co_zero_detect() has told us which parts contain real
+             * non-zero data that we must write, and which ones we can treat
+             * as zero sectors.
+             */
+            n = runs->nb_sectors;
+            if ((runs++)->data) {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
                 if (ret < 0) {
@@ -1973,6 +2088,8 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
     uint8_t *buf = NULL;
+    ImgConvertRun *runs;
+    int64_t start_ns;
     int ret, i;
     int index = -1;
 
@@ -1986,6 +2103,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 
     s->running_coroutines++;
     buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
+    runs = g_new(ImgConvertRun, s->buf_sectors);
 
     while (1) {
         int n;
@@ -2026,15 +2144,23 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 retry:
         copy_range = s->copy_range && s->status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
+            start_ns = get_clock();
             ret = convert_co_read(s, sector_num, n, buf);
+            convert_stage_done(s, CONVERT_STAGE_READ, n, start_ns);
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
                 s->ret = ret;
+            } else {
+                convert_co_zero_detect(s, sector_num, n, buf, runs);
             }
         } else if (!s->min_sparse && status == BLK_ZERO) {
             status = BLK_DATA;
             memset(buf, 0x00, n * BDRV_SECTOR_SIZE);
+            runs[0] = (ImgConvertRun) {
+                .nb_sectors = n,
+                .data = true,
+            };
         }
 
         if (s->wr_in_order) {
@@ -2047,6 +2173,7 @@ retry:
         }
 
         if (s->ret == -EINPROGRESS) {
+            start_ns = get_clock();
             if (copy_range) {
                 WITH_GRAPH_RDLOCK_GUARD() {
                     ret = convert_co_copy_range(s, sector_num, n);
@@ -2056,8 +2183,11 @@ retry:
                     goto retry;
                 }
             } else {
-                ret = convert_co_write(s, sector_num, n, buf, status);
+                ret = convert_co_write(s, sector_num, n, buf, status, runs);
             }
+            /* Zero and backing file areas mostly need no I/O */
+            convert_stage_done(s, CONVERT_STAGE_WRITE,
+                               status == BLK_DATA ? n : 0, start_ns);
             if (ret < 0) {
                 error_report("error while writing at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2084,6 +2214,7 @@ retry:
     }
 
     qemu_vfree(buf);
+    g_free(runs);
     s->co[index] = NULL;
     s->running_coroutines--;
     if (!s->running_coroutines && s->ret == -EINPROGRESS) {
@@ -2105,14 +2236,22 @@ static int convert_do_copy(ImgConvertState *s)
         bdrv_graph_rdunlock_main_loop();
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /*
+     * Allocate buffer for copied data. For compressed images, only one cluster
+     * can be copied at a time, unless the format driver accepts compressed
+     * writes of several clusters, which it then compresses in parallel.
+     */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        if (blk_bs(s->target)->drv->bdrv_co_pwritev_compressed_part) {
+            s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors,
+                                             s->cluster_sectors);
+        } else {
+            s->buf_sectors = s->cluster_sectors;
+        }
     }
 
     while (sector_num < s->total_sectors) {
@@ -2132,6 +2271,7 @@ static int convert_do_copy(ImgConvertState *s)
     /* Do the copy */
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
+    s->elapsed_ns = get_clock();
 
     qemu_co_mutex_init(&s->lock);
     for (i = 0; i < s->num_coroutines; i++) {
@@ -2143,6 +2283,7 @@ static int convert_do_copy(ImgConvertState *s)
     while (s->running_coroutines) {
         main_loop_wait(false);
     }
+    s->elapsed_ns = get_clock() - s->elapsed_ns;
 
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
@@ -2155,6 +2296,33 @@ static int convert_do_copy(ImgConvertState *s)
     return s->ret;
 }
 
+static void convert_print_stats(ImgConvertState *s)
+{
+    static const char *const stage_names[CONVERT_STAGE__MAX] = {
+        [CONVERT_STAGE_READ]        = "read",
+        [CONVERT_STAGE_ZERO_DETECT] = "zero detection",
+        [CONVERT_STAGE_WRITE]       = "write",
+    };
+    double elapsed = MAX(s->elapsed_ns, 1) / (double)NANOSECONDS_PER_SECOND;
+    ImgConvertStage i;
+
+    printf("%-16s %12s %14s %14s %8s\n",
+           "Stage", "Data", "Throughput", "Per worker", "Busy");
+    for (i = 0; i < CONVERT_STAGE__MAX; i++) {
+        ImgConvertStageStats *st = &s->stats[i];
+        double busy = st->busy_ns / (double)NANOSECONDS_PER_SECOND;
+        g_autofree char *size = size_to_str(st->bytes);
+
+        /*
+         * Throughput is over the whole run; per worker is while busy.
+         * Busy is the average number of coroutines working on the stage.
+         */
+        printf("%-16s %12s %9.1f MiB/s %9.1f MiB/s %8.2f\n",
+               stage_names[i], size, st->bytes / elapsed / MiB,
+               busy > 0 ? st->bytes / busy / MiB : 0.0, busy / elapsed);
+    }
+}
+
 /* Check that bitmaps can be copied, or output an error */
 static int convert_check_bitmaps(BlockDriverState *src, bool skip_broken)
 {
@@ -2795,6 +2963,9 @@ out:
         qemu_progress_print(100, 0);
     }
     qemu_progress_end();
+    if (progress && !ret) {
+        convert_print_stats(&s);
+    }
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
     qobject_unref(open_opts);
@@ -179,13 +179,18 @@ ERST
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "-accel [accel=]accelerator[,prop[=value][,...]]\n"
     "                select accelerator (kvm, xen, hvf, nvmm, whpx or tcg; use 'help' for a list)\n"
+    "                hot-tb-threshold=n (split TBs spanning two pages after n executions, default 0)\n"
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                lazy-tlb-sync=on|off (apply broadcast TLB flushes at the next TB, default=off)\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
+    "                op-stats=on|off (collect TCG translation statistics, default=off)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
+    "                tb-cache=file (keep TCG translated code in file across runs)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reapers=n (threads reaping KVM dirty rings, default 1)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
@@ -197,6 +202,13 @@ SRST
     specified, the next one is used if the previous one fails to
     initialize.
 
+    ``hot-tb-threshold=n``
+        A translation block whose guest code spans two pages cannot be
+        chained to other blocks, so each of its executions goes back
+        through the main execution loop. When n is not zero, such a
+        block is retranslated after n of these executions to stop at
+        the page boundary, so that it can be chained. (default=0)
+
     ``igd-passthru=on|off``
         When Xen is in use, this option controls whether Intel
         integrated graphics devices can be passed through to the guest
@@ -212,18 +224,52 @@ SRST
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
+    ``lazy-tlb-sync=on|off``
+        With multi-threaded TCG, a guest instruction that invalidates
+        TLB entries on all vCPUs normally stops every vCPU until they
+        have all applied the invalidation. With this option enabled,
+        the issuing vCPU continues at once and the others apply the
+        invalidation when they finish the translation block they are
+        executing. This helps guests that issue many broadcast
+        invalidations, such as Arm64 guests using TLBI IS, but is only
+        safe when the guest does not depend on the other vCPUs having
+        stopped using the old translation by the time the instruction
+        completes. (default=off)
+
     ``one-insn-per-tb=on|off``
         Makes the TCG accelerator put only one guest instruction into
         each translation block. This slows down emulation a lot, but
         can be useful in some situations, such as when trying to analyse
         the logs produced by the ``-d`` option.
 
+    ``op-stats=on|off``
+        Makes the TCG accelerator time the optimizer and code generator
+        and count the ops of every translation block it generates, as
+        reported by the ``info opcount`` monitor command. This adds some
+        overhead to each translation. (default=off)
+
     ``split-wx=on|off``
         Controls the use of split w^x mapping for the TCG code generation
         buffer. Some operating systems require this to be enabled, and in
         such a case this will default on. On other operating systems, this
         will default off, but one may enable this for testing or debugging.
 
+    ``tb-cache=file``
+        Makes the TCG accelerator save the code it generates to ``file``
+        when QEMU exits, and reuse it on the next run for guest code that
+        has not changed, which shortens the warm-up phase of short-lived
+        or repeatedly started guests. The file is only used by the QEMU
+        build that wrote it, on the same host, and is silently replaced
+        otherwise; code generated for a differently configured CPU is not
+        reused. It is currently only supported on x86-64 Linux hosts.
+
+        The file is only written when QEMU exits normally, so nothing is
+        saved if QEMU is killed or crashes.
+
+        The file contains host code that QEMU executes without further
+        checks. Only use a file that is as trusted as the QEMU binary
+        itself, and do not let the guest or other users write to it.
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
@@ -245,6 +291,14 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reapers=n``
+        When the KVM dirty ring is enabled, this sets the number of threads
+        that collect dirty pages from the per-vCPU rings.  Each thread reaps
+        the rings of every n-th vCPU, so guests with many vCPUs that dirty
+        memory quickly may benefit from more than one thread.  The default
+        is 1.  Per-vCPU ring-full exits and reap times are reported by
+        ``query-stats`` for the KVM provider.
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+#
+# Benchmark TCG translation: op counts and code generation time
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import re
+import time
+import socket
+
+import simplebench
+from results_to_text import results_to_text
+
+sys.path.append(os.path.join(os.path.dirname(__file__), '..', '..', 'python'))
+from qemu.machine import QEMUMachine
+from qemu.qmp import ConnectError
+
+
+def parse_opcount(text):
+    """Parse the output of x-query-opcount into a dict"""
+    res = {}
+
+    m = re.search(r'translated TBs\s+(\d+)', text)
+    res['tbs'] = int(m.group(1))
+    m = re.search(r'avg ops/TB\s+([\d.]+) before opt, ([\d.]+) after opt',
+                  text)
+    res['ops-in'] = float(m.group(1))
+    res['ops-out'] = float(m.group(2))
+    m = re.search(r'env loads forwarded\s+(\d+)', text)
+    res['env-ld-fwd'] = int(m.group(1))
+    m = re.search(r'env stores removed\s+(\d+)', text)
+    res['env-st-dead'] = int(m.group(1))
+    m = re.search(r'avg gen time/TB\s+(\d+) ns', text)
+    res['gen-ns'] = int(m.group(1))
+
+    return res
+
+
+def bench_func(env, case):
+    """Run one guest for a fixed time and collect translation statistics
+
+    Returns {'seconds': float} with the average code generation time per
+    TB, plus the parsed x-query-opcount counters.
+    """
+    vm = QEMUMachine(env['qemu-binary'],
+                     args=['-accel', 'tcg', '-display', 'none',
+                           '-nodefaults'] + case['args'])
+
+    try:
+        vm.launch()
+    except OSError as e:
+        return {'error': 'popen failed: ' + str(e)}
+    except (ConnectError, socket.timeout):
+        return {'error': 'qemu failed: ' + str(vm.get_log())}
+
+    try:
+        time.sleep(case['duration'])
+        res = vm.qmp('x-query-opcount')
+    finally:
+        vm.shutdown()
+
+    if 'return' not in res:
+        return {'error': 'x-query-opcount failed: ' + str(res)}
+
+    try:
+        stats = parse_opcount(res['return']['human-readable-text'])
+    except AttributeError:
+        return {'error': 'failed to parse x-query-opcount output: ' +
+                res['return']['human-readable-text']}
+
+    stats['seconds'] = stats['gen-ns'] / 1e9
+    return stats
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 4 or '--' not in sys.argv:
+        print(f'USAGE: {sys.argv[0]} QEMU_BINARY [QEMU_BINARY ...] -- '
+              'NAME:KERNEL [NAME:KERNEL ...]')
+        print('Each KERNEL is booted with -kernel for 20 seconds; the '
+              'reported value is the average code generation time per TB.')
+        exit(1)
+
+    sep = sys.argv.index('--')
+
+    envs = [{'id': f'{i}: {b}', 'qemu-binary': b}
+            for i, b in enumerate(sys.argv[1:sep])]
+
+    cases = []
+    for guest in sys.argv[sep + 1:]:
+        name, kernel = guest.split(':', 1)
+        cases.append({
+            'id': name,
+            'args': ['-kernel', kernel],
+            'duration': 20
+        })
+
+    result = simplebench.bench(bench_func, envs, cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
+
+    print()
+    for case in cases:
+        for e in envs:
+            runs = [r for r in result['tab'][case['id']][e['id']]['runs']
+                    if 'error' not in r]
+            if not runs:
+                continue
+            r = runs[-1]
+            print(f"{case['id']} / {e['id']}: {r['tbs']} TBs, "
+                  f"{r['ops-in']:.1f} -> {r['ops-out']:.1f} ops/TB, "
+                  f"{r['env-ld-fwd']} env loads forwarded, "
+                  f"{r['env-st-dead']} env stores removed")
@@ -21,7 +21,7 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
     abort();
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(AioContext *ctx, int64_t sqpoll_cpu, Error **errp)
 {
     abort();
 }
@@ -3132,6 +3132,11 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfd_nb = 0;
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    as->bounce_buffer_size = 0;
+    as->bounce_wait_count = 0;
+    qemu_mutex_init(&as->map_client_list_lock);
+    QLIST_INIT(&as->map_client_list);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
@@ -3140,6 +3145,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 
 static void do_address_space_destroy(AddressSpace *as)
 {
+    assert(qatomic_read(&as->bounce_buffer_size) == 0);
+    assert(QLIST_EMPTY(&as->map_client_list));
+    qemu_mutex_destroy(&as->map_client_list_lock);
+
     assert(QTAILQ_EMPTY(&as->listeners));
 
     flatview_unref(as->current_map);
@@ -3506,6 +3515,13 @@ static void mtree_print_as_name(gpointer data, gpointer user_data)
     AddressSpace *as = data;
 
     qemu_printf("address-space: %s\n", as->name);
+    if (qatomic_read(&as->bounce_wait_count) ||
+        qatomic_read(&as->bounce_buffer_size)) {
+        qemu_printf("  bounce buffers: %zu/%zu bytes in use, %u waits\n",
+                    qatomic_read(&as->bounce_buffer_size),
+                    as->max_bounce_buffer_size,
+                    qatomic_read(&as->bounce_wait_count));
+    }
 }
 
 static void mtree_print_as(gpointer key, gpointer value, gpointer user_data)
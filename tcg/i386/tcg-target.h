@@ -247,4 +247,9 @@ typedef enum {
 #define TCG_TARGET_NEED_LDST_LABELS
 #define TCG_TARGET_NEED_POOL_LABELS
 
+/* Generated code can be relocated for the persistent TB cache. */
+#if TCG_TARGET_REG_BITS == 64 && defined(__linux__)
+#define TCG_TARGET_HAS_TB_CACHE 1
+#endif
+
 #endif
@@ -55,6 +55,18 @@ typedef struct TempOptInfo {
     uint64_t s_mask;  /* a left-aligned mask of clrsb(value) bits. */
 } TempOptInfo;
 
+/*
+ * A store to env whose bytes have not been read since.  If a later store
+ * overwrites all of them before anything can observe env, it is dead.
+ */
+typedef struct EnvStoreInfo {
+    TCGOp *op;
+    intptr_t start;
+    intptr_t last;
+} EnvStoreInfo;
+
+#define MAX_ENV_STORES 16
+
 typedef struct OptContext {
     TCGContext *tcg;
     TCGOp *prev_mb;
@@ -63,6 +75,11 @@ typedef struct OptContext {
     IntervalTreeRoot mem_copy;
     QSIMPLEQ_HEAD(, MemCopyInfo) mem_free;
 
+    EnvStoreInfo env_st[MAX_ENV_STORES];
+    int nb_env_st;
+    uint64_t env_ld_fwd;
+    uint64_t env_st_dead;
+
     /* In flight values from optimization. */
     uint64_t a_mask;  /* mask bit is 0 iff value identical to first input */
     uint64_t z_mask;  /* mask bit is 0 iff value bit is 0 */
@@ -338,6 +355,50 @@ static TCGTemp *find_mem_copy_for(OptContext *ctx, TCGType type, intptr_t s)
     return NULL;
 }
 
+/* Something may read any part of env: no pending store can be elided. */
+static void env_st_reset(OptContext *ctx)
+{
+    ctx->nb_env_st = 0;
+}
+
+/* Bytes [S, L] of env are read: stores that overlap them stay live. */
+static void env_st_read(OptContext *ctx, intptr_t s, intptr_t l)
+{
+    int i, j;
+
+    for (i = j = 0; i < ctx->nb_env_st; i++) {
+        EnvStoreInfo *e = &ctx->env_st[i];
+        if (e->start > l || e->last < s) {
+            ctx->env_st[j++] = *e;
+        }
+    }
+    ctx->nb_env_st = j;
+}
+
+/* OP stores bytes [S, L] of env: remove earlier stores it overwrites. */
+static void env_st_write(OptContext *ctx, TCGOp *op, intptr_t s, intptr_t l)
+{
+    int i, j;
+
+    for (i = j = 0; i < ctx->nb_env_st; i++) {
+        EnvStoreInfo *e = &ctx->env_st[i];
+        if (e->start >= s && e->last <= l) {
+            tcg_op_remove(ctx->tcg, e->op);
+            ctx->env_st_dead++;
+        } else {
+            ctx->env_st[j++] = *e;
+        }
+    }
+    if (j == MAX_ENV_STORES) {
+        /* Forget the oldest store; it is simply kept. */
+        memmove(&ctx->env_st[0], &ctx->env_st[1],
+                (MAX_ENV_STORES - 1) * sizeof(EnvStoreInfo));
+        j--;
+    }
+    ctx->env_st[j] = (EnvStoreInfo){ .op = op, .start = s, .last = l };
+    ctx->nb_env_st = j + 1;
+}
+
 static TCGArg arg_new_constant(OptContext *ctx, uint64_t val)
 {
     TCGType type = ctx->type;
@@ -1365,6 +1426,9 @@ static bool fold_call(OptContext *ctx, TCGOp *op)
         remove_mem_copy_all(ctx);
     }
 
+    /* Even without side effects, the function may read env. */
+    env_st_reset(ctx);
+
     /* Reset temp data for outputs. */
     for (i = 0; i < nb_oargs; i++) {
         reset_temp(ctx, op->args[i]);
@@ -2205,6 +2269,55 @@ static bool fold_sub2(OptContext *ctx, TCGOp *op)
 
 static bool fold_tcg_ld(OptContext *ctx, TCGOp *op)
 {
+    intptr_t ofs = op->args[2];
+    uint64_t fwd_mask = 0;
+    intptr_t lm1;
+
+    if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+        env_st_reset(ctx);
+    } else {
+        switch (op->opc) {
+        CASE_OP_32_64(ld8u):
+            fwd_mask = 0xff;
+            /* fall through */
+        CASE_OP_32_64(ld8s):
+            lm1 = 0;
+            break;
+        CASE_OP_32_64(ld16u):
+            fwd_mask = 0xffff;
+            /* fall through */
+        CASE_OP_32_64(ld16s):
+            lm1 = 1;
+            break;
+        case INDEX_op_ld32u_i64:
+            fwd_mask = 0xffffffffu;
+            /* fall through */
+        case INDEX_op_ld32s_i64:
+            lm1 = 3;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+
+        /*
+         * A zero-extending load of the low part of a value stored
+         * with the same type is just a mask of that value.
+         */
+        if (!HOST_BIG_ENDIAN && fwd_mask) {
+            TCGTemp *src = find_mem_copy_for(ctx, ctx->type, ofs);
+
+            if (src && src->base_type == ctx->type) {
+                op->opc = (ctx->type == TCG_TYPE_I32
+                           ? INDEX_op_and_i32 : INDEX_op_and_i64);
+                op->args[1] = temp_arg(src);
+                op->args[2] = arg_new_constant(ctx, fwd_mask);
+                ctx->env_ld_fwd++;
+                return fold_and(ctx, op);
+            }
+        }
+        env_st_read(ctx, ofs, ofs + lm1);
+    }
+
     /* We can't do any folding with a load, but we can record bits. */
     switch (op->opc) {
     CASE_OP_32_64(ld8s):
@@ -2241,6 +2354,7 @@ static bool fold_tcg_ld_memcopy(OptContext *ctx, TCGOp *op)
     TCGType type;
 
     if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+        env_st_reset(ctx);
         return false;
     }
 
@@ -2249,9 +2363,11 @@ static bool fold_tcg_ld_memcopy(OptContext *ctx, TCGOp *op)
     dst = arg_temp(op->args[0]);
     src = find_mem_copy_for(ctx, type, ofs);
     if (src && src->base_type == type) {
+        ctx->env_ld_fwd++;
         return tcg_opt_gen_mov(ctx, op, temp_arg(dst), temp_arg(src));
     }
 
+    env_st_read(ctx, ofs, ofs + tcg_type_size(type) - 1);
     reset_ts(ctx, dst);
     record_mem_copy(ctx, type, dst, ofs, ofs + tcg_type_size(type) - 1);
     return true;
@@ -2264,6 +2380,7 @@ static bool fold_tcg_st(OptContext *ctx, TCGOp *op)
 
     if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
         remove_mem_copy_all(ctx);
+        env_st_reset(ctx);
         return false;
     }
 
@@ -2288,6 +2405,7 @@ static bool fold_tcg_st(OptContext *ctx, TCGOp *op)
         g_assert_not_reached();
     }
     remove_mem_copy_in(ctx, ofs, ofs + lm1);
+    env_st_write(ctx, op, ofs, ofs + lm1);
     return false;
 }
 
@@ -2314,6 +2432,7 @@ static bool fold_tcg_st_memcopy(OptContext *ctx, TCGOp *op)
         TCGTemp *prev = find_mem_copy_for(ctx, type, ofs);
         if (src == prev) {
             tcg_op_remove(ctx->tcg, op);
+            ctx->env_st_dead++;
             return true;
         }
     }
@@ -2321,6 +2440,7 @@ static bool fold_tcg_st_memcopy(OptContext *ctx, TCGOp *op)
     last = ofs + tcg_type_size(type) - 1;
     remove_mem_copy_in(ctx, ofs, last);
     record_mem_copy(ctx, type, src, ofs, last);
+    env_st_write(ctx, op, ofs, last);
     return false;
 }
 
@@ -2374,6 +2494,15 @@ void tcg_optimize(TCGContext *s)
         init_arguments(&ctx, op, def->nb_oargs + def->nb_iargs);
         copy_propagate(&ctx, op, def->nb_oargs, def->nb_iargs);
 
+        /*
+         * Anything that may leave the TB, fault, or load through an
+         * arbitrary pointer may observe env: keep all pending stores.
+         */
+        if (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS) ||
+            opc == INDEX_op_mb || opc == INDEX_op_dupm_vec) {
+            env_st_reset(&ctx);
+        }
+
         /* Pre-compute the type of the operation. */
         if (def->flags & TCG_OPF_VECTOR) {
             ctx.type = TCG_TYPE_V64 + TCGOP_VECL(op);
@@ -2584,4 +2713,9 @@ void tcg_optimize(TCGContext *s)
             finish_folding(&ctx, op);
         }
     }
+
+    if (tcg_op_stats_enabled) {
+        stat64_add(&s->op_stats.env_ld_fwd, ctx.env_ld_fwd);
+        stat64_add(&s->op_stats.env_st_dead, ctx.env_st_dead);
+    }
 }
@@ -237,6 +237,7 @@ bool tcg_use_softmmu;
 TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 
+bool tcg_op_stats_enabled;
 TCGContext **tcg_ctxs;
 unsigned int tcg_cur_ctxs;
 unsigned int tcg_max_ctxs;
@@ -751,6 +752,59 @@ static const TCGTargetOpDef constraint_sets[] = {
 #define C_O2_I4(O1, O2, I1, I2, I3, I4) C_PFX6(c_o2_i4_, O1, O2, I1, I2, I3, I4)
 #define C_N1_O1_I4(O1, O2, I1, I2, I3, I4) C_PFX6(c_n1_o1_i4_, O1, O2, I1, I2, I3, I4)
 
+#if TCG_TARGET_HAS_TB_CACHE
+extern const char __executable_start[];
+extern const char etext[];
+#endif
+
+/*
+ * Persistent TB cache support.  While s->tbc_record is set, the backend
+ * emits host addresses outside of the TB in a form that can be patched
+ * when the code is loaded back, and describes each of them with
+ * tcg_tbc_reloc().
+ */
+static void G_GNUC_UNUSED tcg_tbc_reloc(TCGContext *s,
+                                        const tcg_insn_unit *ptr,
+                                        TCGTBCacheRelocKind kind,
+                                        intptr_t addend)
+{
+    TCGTBCacheReloc *r;
+
+    if (s->tbc_nb_relocs == TCG_TBC_MAX_RELOCS) {
+        s->tbc_unsafe = true;
+        return;
+    }
+
+    r = &s->tbc_relocs[s->tbc_nb_relocs++];
+    r->offset = tcg_ptr_byte_diff(ptr, s->code_buf);
+    r->kind = kind;
+    r->addend = addend;
+}
+
+/* Describe a 64-bit absolute address of QEMU code, such as a helper.  */
+static void G_GNUC_UNUSED tcg_tbc_reloc_abs64(TCGContext *s,
+                                              const tcg_insn_unit *ptr,
+                                              const void *dest)
+{
+#if TCG_TARGET_HAS_TB_CACHE
+    if ((const char *)dest >= __executable_start &&
+        (const char *)dest < etext) {
+        tcg_tbc_reloc(s, ptr, TCG_TBC_RELOC_ABS64,
+                      (uintptr_t)dest - tcg_tbc_anchor());
+        return;
+    }
+#endif
+    /* Not in our own text, e.g. a plugin callback.  */
+    s->tbc_unsafe = true;
+}
+
+/* Return true if @dest lies within the TB whose code is being generated. */
+static bool G_GNUC_UNUSED tcg_tbc_in_tb(TCGContext *s, const void *dest)
+{
+    return dest >= tcg_splitwx_to_rx(s->code_buf) &&
+           dest <= tcg_splitwx_to_rx(s->code_ptr);
+}
+
 #include "tcg-target.c.inc"
 
 #ifndef CONFIG_TCG_INTERPRETER
@@ -1906,6 +1960,10 @@ TCGv_i64 tcg_constant_i64(int64_t val)
 
 TCGv_ptr tcg_constant_ptr_int(intptr_t val)
 {
+    /* Host pointers cannot be relocated by the persistent TB cache.  */
+    if (val != (int16_t)val) {
+        tcg_ctx->tbc_unsafe = true;
+    }
     return temp_tcgv_ptr(tcg_constant_internal(TCG_TYPE_PTR, val));
 }
 
@@ -6032,9 +6090,17 @@ static void tcg_out_st_helper_args(TCGContext *s, const TCGLabelQemuLdst *ldst,
 
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
 {
-    int i, start_words, num_insns;
+    int i, start_words, num_insns, ops_in = 0, ops_out = 0;
+    int64_t t_start = 0, t_opt = 0;
+    bool stats;
     TCGOp *op;
 
+    stats = tcg_op_stats_enabled;
+    if (stats) {
+        t_start = get_clock();
+        ops_in = s->nb_ops;
+    }
+
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP)
                  && qemu_log_in_addr_range(pc_start))) {
         FILE *logfile = qemu_log_trylock();
@@ -6088,6 +6154,11 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
         }
     }
 
+    if (stats) {
+        t_opt = get_clock();
+        ops_out = s->nb_ops;
+    }
+
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP_OPT)
                  && qemu_log_in_addr_range(pc_start))) {
         FILE *logfile = qemu_log_trylock();
@@ -6223,9 +6294,58 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
                         tcg_ptr_byte_diff(s->code_ptr, s->code_buf));
 #endif
 
+    if (stats) {
+        stat64_add(&s->op_stats.tb_count, 1);
+        stat64_add(&s->op_stats.ops_in, ops_in);
+        stat64_add(&s->op_stats.ops_out, ops_out);
+        stat64_add(&s->op_stats.opt_time, t_opt - t_start);
+        stat64_add(&s->op_stats.gen_time, get_clock() - t_start);
+    }
+
     return tcg_current_code_size(s);
 }
 
+void tcg_dump_op_stats(GString *buf)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    uint64_t tb_count = 0, ops_in = 0, ops_out = 0;
+    uint64_t env_ld_fwd = 0, env_st_dead = 0, opt_time = 0, gen_time = 0;
+    unsigned int i;
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        tb_count += stat64_get(&s->op_stats.tb_count);
+        ops_in += stat64_get(&s->op_stats.ops_in);
+        ops_out += stat64_get(&s->op_stats.ops_out);
+        env_ld_fwd += stat64_get(&s->op_stats.env_ld_fwd);
+        env_st_dead += stat64_get(&s->op_stats.env_st_dead);
+        opt_time += stat64_get(&s->op_stats.opt_time);
+        gen_time += stat64_get(&s->op_stats.gen_time);
+    }
+
+    if (!tcg_op_stats_enabled) {
+        g_string_append_printf(buf, "[TCG op statistics are disabled, "
+                               "use -accel tcg,op-stats=on]\n");
+    }
+
+    g_string_append_printf(buf, "translated TBs      %" PRIu64 "\n", tb_count);
+    g_string_append_printf(buf, "avg ops/TB          %0.1f before opt, "
+                           "%0.1f after opt\n",
+                           tb_count ? (double)ops_in / tb_count : 0,
+                           tb_count ? (double)ops_out / tb_count : 0);
+    g_string_append_printf(buf, "env loads forwarded %" PRIu64 "\n",
+                           env_ld_fwd);
+    g_string_append_printf(buf, "env stores removed  %" PRIu64 "\n",
+                           env_st_dead);
+    g_string_append_printf(buf, "optimizer time      %" PRIu64 " us "
+                           "(%0.1f%% of code generation)\n",
+                           opt_time / SCALE_US,
+                           gen_time ? (double)opt_time * 100 / gen_time : 0);
+    g_string_append_printf(buf, "avg gen time/TB     %" PRIu64 " ns\n",
+                           tb_count ? gen_time / tb_count : 0);
+}
+
 #ifdef ELF_HOST_MACHINE
 /* In order to use this feature, the backend needs to do three things:
 
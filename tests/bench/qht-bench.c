@@ -11,6 +11,16 @@
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
+
+/*
+ * Latency histogram: values below 2**LAT_SUB_BITS get a bucket each; above
+ * that, each power of two is split into 2**LAT_SUB_BITS buckets, so that the
+ * reported percentiles are accurate to 1/2**LAT_SUB_BITS.
+ */
+#define LAT_SUB_BITS 3
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
 
 struct thread_stats {
     size_t rd;
@@ -21,6 +31,8 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    uint64_t lat_max;
+    size_t lat[LAT_BUCKETS];
 };
 
 struct thread_info {
@@ -71,6 +83,7 @@ static int qht_mode;
 
 static bool test_start;
 static bool test_stop;
+static bool measure_latency;
 
 static struct thread_info *rw_info;
 
@@ -93,7 +106,9 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    "\n"
+    " -L = report latency percentiles of insertions/removals";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -135,6 +150,37 @@ static uint64_t xorshift64star(uint64_t x)
     return x * UINT64_C(2685821657736338717);
 }
 
+static unsigned int lat_to_bucket(uint64_t ns)
+{
+    int msb;
+
+    if (ns < (1 << LAT_SUB_BITS)) {
+        return ns;
+    }
+    msb = 63 - clz64(ns);
+    return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+           ((ns >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+static uint64_t lat_from_bucket(unsigned int idx)
+{
+    unsigned int sub = idx & ((1 << LAT_SUB_BITS) - 1);
+    int msb = (idx >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+
+    if (idx < (1 << LAT_SUB_BITS)) {
+        return idx;
+    }
+    return (uint64_t)((1 << LAT_SUB_BITS) + sub) << (msb - LAT_SUB_BITS);
+}
+
+static void lat_record(struct thread_stats *stats, int64_t start)
+{
+    uint64_t ns = get_clock() - start;
+
+    stats->lat[lat_to_bucket(ns)]++;
+    stats->lat_max = MAX(stats->lat_max, ns);
+}
+
 static void do_rz(struct thread_info *info)
 {
     struct thread_stats *stats = &info->stats;
@@ -181,7 +227,12 @@ static void do_rw(struct thread_info *info)
             bool written = false;
 
             if (qht_lookup(&ht, p, hash) == NULL) {
+                int64_t start = measure_latency ? get_clock() : 0;
+
                 written = qht_insert(&ht, p, hash, NULL);
+                if (measure_latency) {
+                    lat_record(stats, start);
+                }
             }
             if (written) {
                 stats->in++;
@@ -192,7 +243,12 @@ static void do_rw(struct thread_info *info)
             bool removed = false;
 
             if (qht_lookup(&ht, p, hash)) {
+                int64_t start = measure_latency ? get_clock() : 0;
+
                 removed = qht_remove(&ht, p, hash);
+                if (measure_latency) {
+                    lat_record(stats, start);
+                }
             }
             if (removed) {
                 stats->rm++;
@@ -368,7 +424,7 @@ static void htable_init(void)
 
 static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 {
-    int i;
+    int i, j;
 
     for (i = 0; i < n; i++) {
         struct thread_stats *stats = &info[i].stats;
@@ -384,7 +440,44 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->lat_max = MAX(s->lat_max, stats->lat_max);
+        for (j = 0; j < LAT_BUCKETS; j++) {
+            s->lat[j] += stats->lat[j];
+        }
+    }
+}
+
+static uint64_t lat_percentile(const struct thread_stats *s, size_t total,
+                               double pct)
+{
+    size_t target = total * pct / 100.0;
+    size_t sum = 0;
+    unsigned int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        sum += s->lat[i];
+        if (sum > target) {
+            return lat_from_bucket(i);
+        }
     }
+    return s->lat_max;
+}
+
+static void pr_latency(const struct thread_stats *s)
+{
+    static const double pcts[] = { 50, 90, 99, 99.9, 99.99 };
+    size_t total = s->in + s->rm;
+    int i;
+
+    if (!total) {
+        return;
+    }
+    printf(" Update latency:   ");
+    for (i = 0; i < ARRAY_SIZE(pcts); i++) {
+        printf(" p%g %" PRIu64 "ns", pcts[i], lat_percentile(s, total, pcts[i]));
+    }
+    printf(" max %" PRIu64 "ns\n", s->lat_max);
 }
 
 static void pr_stats(void)
@@ -418,6 +511,9 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+    if (measure_latency) {
+        pr_latency(&s);
+    }
 }
 
 static void run_test(void)
@@ -445,7 +541,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:Lhn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -475,6 +571,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
@@ -658,6 +658,8 @@ typedef struct {
     bool only_target;
     /* Use dirty ring if true; dirty logging otherwise */
     bool use_dirty_ring;
+    /* Number of threads reaping the dirty ring, 0 for the default */
+    unsigned int dirty_ring_reapers;
     const char *opts_source;
     const char *opts_target;
     /* suspend the src before migrating to dest. */
@@ -768,7 +770,7 @@ static int test_migrate_start(QTestState **from, QTestState **to,
     const gchar *ignore_stderr;
     g_autofree char *shmem_opts = NULL;
     g_autofree char *shmem_path = NULL;
-    const char *kvm_opts = NULL;
+    g_autofree char *kvm_opts = NULL;
     const char *arch = qtest_get_arch();
     const char *memory_size;
     const char *machine_alias, *machine_opts = "";
@@ -851,7 +853,13 @@ static int test_migrate_start(QTestState **from, QTestState **to,
     }
 
     if (args->use_dirty_ring) {
-        kvm_opts = ",dirty-ring-size=4096";
+        if (args->dirty_ring_reapers) {
+            kvm_opts = g_strdup_printf(",dirty-ring-size=4096"
+                                       ",dirty-ring-reapers=%u",
+                                       args->dirty_ring_reapers);
+        } else {
+            kvm_opts = g_strdup(",dirty-ring-size=4096");
+        }
     }
 
     machine = resolve_machine_version(machine_alias, QEMU_ENV_SRC,
@@ -2189,6 +2197,93 @@ static void test_precopy_file_offset_bad(void)
     test_file_common(&args, false);
 }
 
+static void *migrate_mapped_ram_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_mapped_ram_live(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_start,
+    };
+
+    test_file_common(&args, false);
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_start,
+    };
+
+    test_file_common(&args, true);
+}
+
+static void test_precopy_file_offset_mapped_ram(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s,offset=%d", tmpfs,
+                                           FILE_TEST_FILENAME,
+                                           FILE_TEST_OFFSET);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_start,
+    };
+
+    test_file_common(&args, false);
+}
+
+static void *multifd_mapped_ram_start(QTestState *from, QTestState *to)
+{
+    migrate_mapped_ram_start(from, to);
+
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_parameter_int(to, "multifd-channels", 4);
+
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+
+    return NULL;
+}
+
+static void test_multifd_file_mapped_ram_live(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = multifd_mapped_ram_start,
+    };
+
+    test_file_common(&args, false);
+}
+
+static void test_multifd_file_mapped_ram(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = multifd_mapped_ram_start,
+    };
+
+    test_file_common(&args, true);
+}
+
 static void *test_mode_reboot_start(QTestState *from, QTestState *to)
 {
     migrate_set_parameter_str(from, "mode", "cpr-reboot");
@@ -2621,6 +2716,24 @@ test_migrate_precopy_tcp_multifd_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_start_zero_page_legacy(QTestState *from,
+                                                        QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    migrate_set_parameter_str(from, "zero-page-detection", "legacy");
+    return NULL;
+}
+
+static void *
+test_migrate_precopy_tcp_multifd_no_zero_page_start(QTestState *from,
+                                                    QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    migrate_set_parameter_str(from, "zero-page-detection", "none");
+    return NULL;
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
                                             QTestState *to)
@@ -2652,6 +2765,36 @@ static void test_multifd_tcp_none(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_zero_page_legacy(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_start_zero_page_legacy,
+        /*
+         * Multifd is more complicated than most of the features, it
+         * directly takes guest page buffers when sending, make sure
+         * everything will work alright even if guest page is changing.
+         */
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
+static void test_multifd_tcp_no_zero_page(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_no_zero_page_start,
+        /*
+         * Multifd is more complicated than most of the features, it
+         * directly takes guest page buffers when sending, make sure
+         * everything will work alright even if guest page is changing.
+         */
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_zlib(void)
 {
     MigrateCommon args = {
@@ -2915,6 +3058,110 @@ static void test_multifd_tcp_cancel(void)
     test_migrate_end(from, to2, true);
 }
 
+/* Each vCPU must report how long reaping its dirty ring took */
+static void check_dirty_ring_reap_stats(QTestState *who, int nr_vcpus)
+{
+    QDict *rsp;
+    QList *results;
+    const QListEntry *entry;
+    int n = 0;
+
+    rsp = qtest_qmp(who, "{ 'execute': 'query-stats',"
+                    "'arguments': { 'target': 'vcpu',"
+                    "'providers': [ { 'provider': 'kvm',"
+                    "'names': [ 'dirty_ring_reap_ns' ] } ] } }");
+    results = qdict_get_qlist(rsp, "return");
+    g_assert(results);
+
+    QLIST_FOREACH_ENTRY(results, entry) {
+        QDict *result = qobject_to(QDict, qlist_entry_obj(entry));
+        QList *stats = qdict_get_qlist(result, "stats");
+        QDict *stat;
+
+        g_assert(stats && !qlist_empty(stats));
+        stat = qobject_to(QDict, qlist_entry_obj(qlist_first(stats)));
+        g_assert_cmpstr(qdict_get_str(stat, "name"), ==,
+                        "dirty_ring_reap_ns");
+        n++;
+    }
+    g_assert_cmpint(n, ==, nr_vcpus);
+
+    qobject_unref(rsp);
+}
+
+/*
+ * Cancel a migration while several threads reap the dirty ring, then
+ * migrate again.  The reaper threads must survive the cancellation, keep
+ * the dirty bitmap complete for the second attempt, and stop with QEMU.
+ */
+static void test_precopy_dirty_ring_reapers_cancel(void)
+{
+    MigrateStart args = {
+        .hide_stderr = true,
+        .use_dirty_ring = true,
+        .dirty_ring_reapers = 4,
+        .opts_source = "-smp 4",
+        .opts_target = "-smp 4",
+    };
+    QTestState *from, *to, *to2;
+    g_autofree char *uri = NULL;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_ensure_non_converge(from);
+    migrate_prepare_for_dirty_mem(from);
+
+    migrate_incoming_qmp(to, "tcp:127.0.0.1:0", "{}");
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    uri = migrate_get_socket_address(to, "socket-address");
+
+    migrate_qmp(from, uri, "{}");
+
+    migrate_wait_for_dirty_mem(from, to);
+
+    migrate_cancel(from);
+
+    /* Make sure QEMU process "to" exited */
+    qtest_set_expected_status(to, EXIT_FAILURE);
+    qtest_wait_qemu(to);
+
+    args.only_target = true;
+
+    if (test_migrate_start(&from, &to2, "defer", &args)) {
+        return;
+    }
+
+    migrate_incoming_qmp(to2, "tcp:127.0.0.1:0", "{}");
+
+    g_free(uri);
+    uri = migrate_get_socket_address(to2, "socket-address");
+
+    wait_for_migration_status(from, "cancelled", NULL);
+
+    migrate_ensure_non_converge(from);
+
+    migrate_qmp(from, uri, "{}");
+
+    migrate_wait_for_dirty_mem(from, to2);
+
+    migrate_ensure_converge(from);
+
+    wait_for_stop(from, &src_state);
+    qtest_qmp_eventwait(to2, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    check_dirty_ring_reap_stats(from, 4);
+
+    test_migrate_end(from, to2, true);
+}
+
 static void calc_dirty_rate(QTestState *who, uint64_t calc_time)
 {
     qtest_qmp_assert_success(who,
@@ -3462,6 +3709,17 @@ int main(int argc, char **argv)
     migration_test_add("/migration/precopy/file/offset/bad",
                        test_precopy_file_offset_bad);
 
+    migration_test_add("/migration/precopy/file/mapped-ram",
+                       test_precopy_file_mapped_ram);
+    migration_test_add("/migration/precopy/file/mapped-ram/live",
+                       test_precopy_file_mapped_ram_live);
+    migration_test_add("/migration/precopy/file/offset/mapped-ram",
+                       test_precopy_file_offset_mapped_ram);
+    migration_test_add("/migration/multifd/file/mapped-ram",
+                       test_multifd_file_mapped_ram);
+    migration_test_add("/migration/multifd/file/mapped-ram/live",
+                       test_multifd_file_mapped_ram_live);
+
     /*
      * Our CI system has problems with shared memory.
      * Don't run this test until we find a workaround.
@@ -3550,6 +3808,10 @@ int main(int argc, char **argv)
     }
     migration_test_add("/migration/multifd/tcp/plain/none",
                        test_multifd_tcp_none);
+    migration_test_add("/migration/multifd/tcp/plain/zero-page/legacy",
+                       test_multifd_tcp_zero_page_legacy);
+    migration_test_add("/migration/multifd/tcp/plain/zero-page/none",
+                       test_multifd_tcp_no_zero_page);
     migration_test_add("/migration/multifd/tcp/plain/cancel",
                        test_multifd_tcp_cancel);
     migration_test_add("/migration/multifd/tcp/plain/zlib",
@@ -3580,6 +3842,8 @@ int main(int argc, char **argv)
     if (g_str_equal(arch, "x86_64") && has_kvm && kvm_dirty_ring_supported()) {
         migration_test_add("/migration/dirty_ring",
                            test_precopy_unix_dirty_ring);
+        migration_test_add("/migration/dirty_ring/reapers/cancel",
+                           test_precopy_dirty_ring_reapers_cancel);
         migration_test_add("/migration/vcpu_dirty_limit",
                            test_vcpu_dirty_limit);
     }
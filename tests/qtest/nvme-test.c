@@ -8,13 +8,19 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "qemu/module.h"
 #include "qemu/units.h"
 #include "libqtest.h"
 #include "libqos/qgraph.h"
 #include "libqos/pci.h"
+#include "libqos/malloc.h"
 #include "include/block/nvme.h"
 
+#define NVME_TEST_TIMEOUT_US    (5 * 1000 * 1000)
+#define NVME_TEST_AQ_DEPTH      8
+#define NVME_TEST_IOQPAIRS      4
+
 typedef struct QNvme QNvme;
 
 struct QNvme {
@@ -22,6 +28,17 @@ struct QNvme {
     QPCIDevice dev;
 };
 
+typedef struct NvmeTestAdminQueue {
+    QPCIDevice *pdev;
+    QPCIBar bar;
+    uint64_t sq;
+    uint64_t cq;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint16_t cid;
+    bool phase;
+} NvmeTestAdminQueue;
+
 static void *nvme_get_driver(void *obj, const char *interface)
 {
     QNvme *nvme = obj;
@@ -142,6 +159,171 @@ static void nvmetest_pmr_reg_test(void *obj, void *data, QGuestAllocator *alloc)
     qpci_iounmap(pdev, pmr_bar);
 }
 
+/* Set up the admin queues in guest memory and enable the controller */
+static void nvmetest_admin_init(NvmeTestAdminQueue *q, QPCIDevice *pdev,
+                                QGuestAllocator *alloc)
+{
+    uint32_t cc = 0;
+
+    q->pdev = pdev;
+    q->bar = qpci_iomap(pdev, 0, NULL);
+    q->sq = guest_alloc(alloc, NVME_TEST_AQ_DEPTH * sizeof(NvmeCmd));
+    q->cq = guest_alloc(alloc, NVME_TEST_AQ_DEPTH * sizeof(NvmeCqe));
+    q->sq_tail = q->cq_head = q->cid = 0;
+    q->phase = true;
+
+    qtest_memset(pdev->bus->qts, q->cq, 0,
+                 NVME_TEST_AQ_DEPTH * sizeof(NvmeCqe));
+
+    qpci_io_writel(pdev, q->bar, NVME_REG_AQA,
+                   (NVME_TEST_AQ_DEPTH - 1) << 16 | (NVME_TEST_AQ_DEPTH - 1));
+    qpci_io_writeq(pdev, q->bar, NVME_REG_ASQ, q->sq);
+    qpci_io_writeq(pdev, q->bar, NVME_REG_ACQ, q->cq);
+
+    NVME_SET_CC_IOSQES(cc, 6);
+    NVME_SET_CC_IOCQES(cc, 4);
+    NVME_SET_CC_EN(cc, 1);
+    qpci_io_writel(pdev, q->bar, NVME_REG_CC, cc);
+    g_assert_cmpint(NVME_CSTS_RDY(qpci_io_readl(pdev, q->bar, NVME_REG_CSTS)),
+                    ==, 1);
+}
+
+/*
+ * Submit @cmd on the admin queue and wait for its completion.  Returns the
+ * status code of the completion and stores Dword 0 in @result.
+ */
+static uint16_t nvmetest_admin_cmd(NvmeTestAdminQueue *q, NvmeCmd *cmd,
+                                   uint32_t *result)
+{
+    QTestState *qts = q->pdev->bus->qts;
+    uint64_t cqe_addr = q->cq + q->cq_head * sizeof(NvmeCqe);
+    gint64 start_time = g_get_monotonic_time();
+    NvmeCqe cqe;
+    uint16_t status;
+
+    cmd->cid = cpu_to_le16(q->cid++);
+    qtest_memwrite(qts, q->sq + q->sq_tail * sizeof(NvmeCmd), cmd,
+                   sizeof(*cmd));
+    q->sq_tail = (q->sq_tail + 1) % NVME_TEST_AQ_DEPTH;
+    qpci_io_writel(q->pdev, q->bar, sizeof(NvmeBar), q->sq_tail);
+
+    for (;;) {
+        qtest_memread(qts, cqe_addr, &cqe, sizeof(cqe));
+        status = le16_to_cpu(cqe.status);
+        if ((status & 0x1) == q->phase) {
+            break;
+        }
+        qtest_clock_step(qts, 100);
+        g_assert(g_get_monotonic_time() - start_time <= NVME_TEST_TIMEOUT_US);
+    }
+
+    g_assert_cmpint(le16_to_cpu(cqe.cid), ==, le16_to_cpu(cmd->cid));
+
+    q->cq_head = (q->cq_head + 1) % NVME_TEST_AQ_DEPTH;
+    if (!q->cq_head) {
+        q->phase = !q->phase;
+    }
+    qpci_io_writel(q->pdev, q->bar, sizeof(NvmeBar) + 4, q->cq_head);
+
+    *result = le32_to_cpu(cqe.result);
+    return status >> 1;
+}
+
+static uint16_t nvmetest_set_feature(NvmeTestAdminQueue *q, uint8_t fid,
+                                     uint32_t dw11, uint32_t *result)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(fid),
+        .cdw11 = cpu_to_le32(dw11),
+    };
+
+    return nvmetest_admin_cmd(q, &cmd, result);
+}
+
+static uint16_t nvmetest_get_feature(NvmeTestAdminQueue *q, uint8_t fid,
+                                     uint32_t dw11, uint32_t *result)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_GET_FEATURES,
+        .cdw10 = cpu_to_le32(fid),
+        .cdw11 = cpu_to_le32(dw11),
+    };
+
+    return nvmetest_admin_cmd(q, &cmd, result);
+}
+
+static void nvmetest_int_coalescing_test(void *obj, void *data,
+                                         QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    QPCIDevice *pdev = &nvme->dev;
+    NvmeTestAdminQueue q;
+    uint32_t result;
+    uint16_t iv;
+
+    qpci_device_enable(pdev);
+    nvmetest_admin_init(&q, pdev, alloc);
+
+    /* Aggregation Time 100 (10 ms), Aggregation Threshold 3 */
+    g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_COALESCING, 0,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(result, ==, 0);
+    g_assert_cmphex(nvmetest_set_feature(&q, NVME_INTERRUPT_COALESCING,
+                                         0x6403, &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_COALESCING, 0,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(result, ==, 0x6403);
+
+    /* The admin queue's vector is never coalesced and cannot be changed */
+    g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_VECTOR_CONF, 0,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(result, ==, NVME_INTVC_NOCOALESCING);
+    g_assert_cmphex(nvmetest_set_feature(&q, NVME_INTERRUPT_VECTOR_CONF, 0,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_VECTOR_CONF, 0,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(result, ==, NVME_INTVC_NOCOALESCING);
+
+    /* I/O vectors are coalesced by default; toggle Coalescing Disable */
+    for (iv = 1; iv <= NVME_TEST_IOQPAIRS; iv++) {
+        g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_VECTOR_CONF,
+                                             iv, &result), ==, NVME_SUCCESS);
+        g_assert_cmphex(result, ==, iv);
+    }
+
+    g_assert_cmphex(nvmetest_set_feature(&q, NVME_INTERRUPT_VECTOR_CONF,
+                                         NVME_INTVC_NOCOALESCING | 2,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_VECTOR_CONF, 2,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(result, ==, NVME_INTVC_NOCOALESCING | 2);
+    g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_VECTOR_CONF, 1,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(result, ==, 1);
+
+    g_assert_cmphex(nvmetest_set_feature(&q, NVME_INTERRUPT_VECTOR_CONF, 2,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_VECTOR_CONF, 2,
+                                         &result), ==, NVME_SUCCESS);
+    g_assert_cmphex(result, ==, 2);
+
+    /* Vectors beyond the I/O queue pairs are rejected */
+    iv = NVME_TEST_IOQPAIRS + 1;
+    g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_VECTOR_CONF, iv,
+                                         &result),
+                    ==, NVME_INVALID_FIELD | NVME_DNR);
+    g_assert_cmphex(nvmetest_set_feature(&q, NVME_INTERRUPT_VECTOR_CONF,
+                                         NVME_INTVC_NOCOALESCING | iv,
+                                         &result),
+                    ==, NVME_INVALID_FIELD | NVME_DNR);
+    g_assert_cmphex(nvmetest_get_feature(&q, NVME_INTERRUPT_VECTOR_CONF,
+                                         0xffff, &result),
+                    ==, NVME_INVALID_FIELD | NVME_DNR);
+
+    qpci_iounmap(pdev, q.bar);
+}
+
 static void nvme_register_nodes(void)
 {
     QOSGraphEdgeOptions opts = {
@@ -168,6 +350,11 @@ static void nvme_register_nodes(void)
     });
 
     qos_add_test("reg-read", "nvme", nvmetest_reg_read_test, NULL);
+
+    qos_add_test("int-coalescing", "nvme", nvmetest_int_coalescing_test,
+                 &(QOSGraphTestOptions) {
+        .edge.extra_device_opts = "max_ioqpairs=" stringify(NVME_TEST_IOQPAIRS)
+    });
 }
 
 libqos_init(nvme_register_nodes);
@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Persistent TB cache test: the cache written by a run must be used by the
+# next run of the same binary, and ignored if it comes from another QEMU
+# build or was generated for a differently configured CPU.
+#
+# usage: tb-cache.sh QEMU BINARY [OTHER-CPU-OPTION]
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+QEMU=$1
+BIN=$2
+OTHER_CPU=$3
+CACHE=$BIN.tbcache
+LOG=$BIN.tbcache.log
+
+fail()
+{
+    echo "tb-cache: $*" >&2
+    exit 1
+}
+
+# run [QEMU options...]: run BIN with the cache and tracing enabled
+run()
+{
+    rm -f "$LOG"
+    "$QEMU" -tb-cache "$CACHE" -d 'trace:tb_cache_*' -D "$LOG" "$@" "$BIN" \
+        > /dev/null
+}
+
+# tbc_stat N: print the new entries (1), hits (2) or misses (3) of the last run
+tbc_stat()
+{
+    sed -n 's/.*tb_cache_save .*: \([0-9]*\) new entries, \([0-9]*\) hits, \([0-9]*\) misses/\1 \2 \3/p' \
+        "$LOG" | tail -n 1 | cut -d' ' -f"$1"
+}
+
+rm -f "$CACHE"
+
+# Cold run: everything is translated, and saved on exit
+if ! run 2> "$LOG.err"; then
+    if grep -q "not supported on this host" "$LOG.err"; then
+        echo "tb-cache: not supported on this host, skipping"
+        exit 0
+    fi
+    cat "$LOG.err" >&2
+    fail "cold run failed"
+fi
+if ! grep -q tb_cache_save "$LOG"; then
+    echo "tb-cache: needs the log trace backend, skipping"
+    exit 0
+fi
+test -s "$CACHE" || fail "cache was not saved"
+test "$(tbc_stat 1)" -gt 0 || fail "no TB was recorded"
+test "$(tbc_stat 2)" -eq 0 || fail "hits without a cache"
+
+# Warm run: the TBs come from the file
+run || fail "warm run failed"
+grep -q "tb_cache_load .*: [1-9][0-9]* entries" "$LOG" || fail "cache not loaded"
+test "$(tbc_stat 2)" -gt 0 || fail "no hits on a warm run"
+
+# Another CPU configuration must not reuse the code
+if [ -n "$OTHER_CPU" ]; then
+    cp "$CACHE" "$CACHE.saved"
+    run -cpu "$OTHER_CPU" || fail "run with -cpu $OTHER_CPU failed"
+    test "$(tbc_stat 2)" -eq 0 || fail "hits with -cpu $OTHER_CPU"
+    mv "$CACHE.saved" "$CACHE"
+fi
+
+# A file from another build is rejected: change its QEMU version string
+printf X | dd of="$CACHE" bs=1 seek=16 conv=notrunc 2> /dev/null
+run || fail "run with a foreign cache failed"
+grep -q "tb_cache_reject .*: written by a different QEMU binary or host" "$LOG" ||
+    fail "foreign cache not rejected"
+test "$(tbc_stat 2)" -eq 0 || fail "hits from a foreign cache"
+
+rm -f "$CACHE" "$LOG" "$LOG.err"
+exit 0
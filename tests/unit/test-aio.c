@@ -368,6 +368,50 @@ static void test_wait_event_notifier_noflush(void)
     event_notifier_cleanup(&data.e);
 }
 
+#ifndef _WIN32
+typedef struct {
+    int fds[2];
+    int n;
+} PipeTestData;
+
+/* Consume only one byte, leaving the rest for the next call */
+static void pipe_read_one_cb(void *opaque)
+{
+    PipeTestData *data = opaque;
+    char c;
+
+    g_assert_cmpint(read(data->fds[0], &c, 1), ==, 1);
+    data->n++;
+}
+
+/*
+ * fd handlers are level-triggered: one that leaves data unread must be
+ * called again without any new data arriving.
+ */
+static void test_fd_partial_read(void)
+{
+    PipeTestData data = { .n = 0 };
+
+    g_assert(g_unix_open_pipe(data.fds, FD_CLOEXEC, NULL));
+    aio_set_fd_handler(ctx, data.fds[0], pipe_read_one_cb, NULL, NULL, NULL,
+                       &data);
+    g_assert(!aio_poll(ctx, false));
+
+    g_assert_cmpint(write(data.fds[1], "abc", 3), ==, 3);
+    while (data.n < 3) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(data.n, ==, 3);
+    g_assert(!aio_poll(ctx, false));
+    g_assert_cmpint(data.n, ==, 3);
+
+    aio_set_fd_handler(ctx, data.fds[0], NULL, NULL, NULL, NULL, NULL);
+    while (aio_poll(ctx, false));
+    close(data.fds[0]);
+    close(data.fds[1]);
+}
+#endif
+
 static void test_timer_schedule(void)
 {
     TimerTestData data = { .n = 0, .ctx = ctx, .ns = SCALE_MS * 750LL,
@@ -825,6 +869,110 @@ static void test_worker_thread_co_enter(void)
     g_assert(!aio_poll(ctx, false));
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Requests added with aio_add_sqe() share the ring of the AioContext, which
+ * must stay in use when glib runs the AioContext.
+ */
+
+typedef struct {
+    CqeHandler cqe_handler;
+    int n;
+    int res;
+} CqeTestData;
+
+static bool io_uring_available(void)
+{
+    struct io_uring ring;
+
+    if (io_uring_queue_init(1, &ring, 0) < 0) {
+        return false;
+    }
+    io_uring_queue_exit(&ring);
+    return true;
+}
+
+static void cqe_test_cb(CqeHandler *cqe_handler)
+{
+    CqeTestData *data = container_of(cqe_handler, CqeTestData, cqe_handler);
+
+    data->n++;
+    data->res = cqe_handler->res;
+}
+
+static void add_nop_sqe(CqeTestData *data)
+{
+    struct io_uring_sqe sqe = { 0 };
+
+    io_uring_prep_nop(&sqe);
+    data->cqe_handler.cb = cqe_test_cb;
+    aio_add_sqe(ctx, &sqe, &data->cqe_handler);
+}
+
+static void test_add_sqe(void)
+{
+    CqeTestData data = { .n = 0, .res = -EINPROGRESS };
+
+    if (!io_uring_available()) {
+        g_test_skip("io_uring is not available");
+        return;
+    }
+    g_assert(aio_has_io_uring(ctx));
+
+    add_nop_sqe(&data);
+    while (data.n == 0) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(data.n, ==, 1);
+    g_assert_cmpint(data.res, ==, 0);
+    g_assert(!aio_poll(ctx, false));
+}
+
+static void test_source_add_sqe(void)
+{
+    CqeTestData data = { .n = 0, .res = -EINPROGRESS };
+    EventNotifierTestData en = { .n = 0, .active = 1 };
+
+    if (!io_uring_available()) {
+        g_test_skip("io_uring is not available");
+        return;
+    }
+    g_assert(aio_has_io_uring(ctx));
+
+    add_nop_sqe(&data);
+    while (data.n == 0) {
+        g_main_context_iteration(NULL, true);
+    }
+    g_assert_cmpint(data.n, ==, 1);
+    g_assert_cmpint(data.res, ==, 0);
+
+    /* Requests and fd handlers can be mixed on the ring */
+    event_notifier_init(&en.e, false);
+    set_event_notifier(ctx, &en.e, event_ready_cb);
+    while (g_main_context_iteration(NULL, false));
+
+    add_nop_sqe(&data);
+    event_notifier_set(&en.e);
+    while (data.n < 2 || en.n < 1) {
+        g_main_context_iteration(NULL, true);
+    }
+    g_assert_cmpint(data.n, ==, 2);
+    g_assert_cmpint(en.n, ==, 1);
+    g_assert_cmpint(en.active, ==, 0);
+
+    /* aio_poll() keeps working on the same ring */
+    add_nop_sqe(&data);
+    while (data.n < 3) {
+        aio_poll(ctx, true);
+    }
+    g_assert(!g_main_context_iteration(NULL, false));
+
+    set_event_notifier(ctx, &en.e, NULL);
+    while (g_main_context_iteration(NULL, false));
+    event_notifier_cleanup(&en.e);
+}
+#endif
+
 /* End of tests.  */
 
 int main(int argc, char **argv)
@@ -846,10 +994,16 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait",              test_wait_event_notifier);
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
+#ifndef _WIN32
+    g_test_add_func("/aio/fd/partial-read",         test_fd_partial_read);
+#endif
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
 
     g_test_add_func("/aio/coroutine/queue-chaining", test_queue_chaining);
     g_test_add_func("/aio/coroutine/worker-thread-co-enter", test_worker_thread_co_enter);
+#ifdef CONFIG_LINUX_IO_URING
+    g_test_add_func("/aio/io-uring/add-sqe",        test_add_sqe);
+#endif
 
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
     g_test_add_func("/aio-gsource/bh/schedule",             test_source_bh_schedule);
@@ -864,5 +1018,8 @@ int main(int argc, char **argv)
     g_test_add_func("/aio-gsource/event/wait/no-flush-cb",  test_source_wait_event_notifier_noflush);
     g_test_add_func("/aio-gsource/event/flush",             test_source_flush_event_notifier);
     g_test_add_func("/aio-gsource/timer/schedule",          test_source_timer_schedule);
+#ifdef CONFIG_LINUX_IO_URING
+    g_test_add_func("/aio-gsource/io-uring/add-sqe",        test_source_add_sqe);
+#endif
     return g_test_run();
 }
@@ -251,10 +251,65 @@ static void test_resize(void)
     qht_test(QHT_MODE_AUTO_RESIZE);
 }
 
+static size_t head_buckets(void)
+{
+    struct qht_stats stats;
+    size_t ret;
+
+    qht_statistics_init(&ht, &stats);
+    ret = stats.head_buckets;
+    qht_statistics_destroy(&stats);
+    return ret;
+}
+
+/*
+ * While an incremental resize is ongoing, the statistics count moved head
+ * buckets twice, once for each of the new map's buckets they were split into.
+ */
+static void test_resize_partial(void)
+{
+    size_t n_buckets;
+    int i;
+
+    qht_init(&ht, is_equal, N / 4, QHT_MODE_AUTO_RESIZE);
+    n_buckets = head_buckets();
+
+    /* insert until the resize has started, i.e. some buckets were moved */
+    for (i = 0; i < N && head_buckets() == n_buckets; i++) {
+        insert(i, i + 1);
+    }
+    g_assert_cmpint(i, <, N);
+    g_assert_cmpuint(head_buckets(), <, n_buckets * 2);
+
+    check(0, i, true);
+    check(i, N, false);
+    check_n(i);
+
+    /* the last head buckets are the last ones to be moved */
+    rm(n_buckets - 4, n_buckets);
+    check(n_buckets - 4, n_buckets, false);
+    rm_nonexist(n_buckets - 4, n_buckets);
+    check_n(i - 4);
+    insert(n_buckets - 4, n_buckets);
+    insert(i, i + 4);
+    check(0, i + 4, true);
+    check_n(i + 4);
+    g_assert_cmpuint(head_buckets(), <, n_buckets * 2);
+
+    /* qht_iter completes the resize first */
+    iter_check(i + 4);
+    g_assert_cmpuint(head_buckets(), ==, n_buckets * 2);
+    check(0, i + 4, true);
+    check(i + 4, N, false);
+
+    qht_destroy(&ht);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/qht/mode/default", test_default);
     g_test_add_func("/qht/mode/resize", test_resize);
+    g_test_add_func("/qht/resize/partial", test_resize_partial);
     return g_test_run();
 }
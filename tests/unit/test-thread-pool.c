@@ -134,6 +134,18 @@ static void test_submit_many(void)
     }
 }
 
+static void test_submit_single_worker(void)
+{
+    /*
+     * With a single worker most requests land in queues that have no worker
+     * of their own and have to be stolen.
+     */
+    aio_context_set_thread_pool_params(ctx, 0, 1, &error_abort);
+    test_submit_many();
+    aio_context_set_thread_pool_params(ctx, 0, THREAD_POOL_MAX_THREADS_DEFAULT,
+                                       &error_abort);
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -240,6 +252,8 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/submit-single-worker",
+                    test_submit_single_worker);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
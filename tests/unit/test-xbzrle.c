@@ -173,6 +173,135 @@ static void test_encode_decode(void)
     }
 }
 
+static void encode_decode_runs(void)
+{
+    uint8_t *buffer = g_malloc0(XBZRLE_PAGE_SIZE);
+    uint8_t *test = g_malloc0(XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    int i = 0, j, len;
+    int dlen, rc;
+
+    /*
+     * Scatter runs of changed bytes of random length, so that run
+     * boundaries land anywhere inside and across 64 byte chunks.
+     */
+    while (i < XBZRLE_PAGE_SIZE) {
+        i += g_test_rand_int_range(1, 130);
+        len = g_test_rand_int_range(1, 130);
+        for (j = i; j < i + len && j < XBZRLE_PAGE_SIZE; j++) {
+            buffer[j] = test[j] + 1 + g_test_rand_int_range(0, 254);
+        }
+        i += len;
+    }
+
+    dlen = xbzrle_encode_buffer(test, buffer, XBZRLE_PAGE_SIZE,
+                                compressed, XBZRLE_PAGE_SIZE);
+    if (dlen != -1) {
+        rc = xbzrle_decode_buffer(compressed, dlen, test, XBZRLE_PAGE_SIZE);
+        g_assert(rc <= XBZRLE_PAGE_SIZE);
+        g_assert(memcmp(test, buffer, XBZRLE_PAGE_SIZE) == 0);
+    }
+
+    g_free(buffer);
+    g_free(compressed);
+    g_free(test);
+}
+
+static void test_encode_decode_runs(void)
+{
+    int i;
+
+    for (i = 0; i < 10000; i++) {
+        encode_decode_runs();
+    }
+}
+
+/*
+ * The vector encoders must produce exactly the output of the portable one,
+ * also for lengths that are not a multiple of their width and when the
+ * output does not fit.  On hosts without them, both are the same.
+ */
+static void encode_compare(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                           int dlen)
+{
+    /* Leave room for what an encoder writes before noticing the overflow */
+    uint8_t *out_int = g_malloc(dlen + 16);
+    uint8_t *out_accel = g_malloc(dlen + 16);
+    int len_int, len_accel;
+
+    len_int = xbzrle_encode_buffer_int(old_buf, new_buf, slen, out_int, dlen);
+    len_accel = xbzrle_encode_buffer(old_buf, new_buf, slen, out_accel, dlen);
+    g_assert_cmpint(len_int, ==, len_accel);
+    if (len_int > 0) {
+        g_assert(memcmp(out_int, out_accel, len_int) == 0);
+    }
+
+    g_free(out_int);
+    g_free(out_accel);
+}
+
+static void encode_accel(int n)
+{
+    uint8_t *old_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    int slen = XBZRLE_PAGE_SIZE;
+    int i, j, len;
+
+    for (i = 0; i < XBZRLE_PAGE_SIZE; i++) {
+        old_buf[i] = g_test_rand_int_range(0, 256);
+    }
+    memcpy(new_buf, old_buf, XBZRLE_PAGE_SIZE);
+
+    switch (n % 3) {
+    case 0:
+        /* Sparse random changes, about 3 bytes of output each */
+        for (i = 0; i < XBZRLE_PAGE_SIZE / 16; i++) {
+            new_buf[g_test_rand_int_range(0, XBZRLE_PAGE_SIZE)] ^=
+                g_test_rand_int_range(1, 256);
+        }
+        break;
+    case 1:
+        /* Runs of random length, as in encode_decode_runs() */
+        i = 0;
+        while (i < XBZRLE_PAGE_SIZE) {
+            i += g_test_rand_int_range(1, 130);
+            len = g_test_rand_int_range(1, 130);
+            for (j = i; j < i + len && j < XBZRLE_PAGE_SIZE; j++) {
+                new_buf[j] ^= g_test_rand_int_range(1, 256);
+            }
+            i += len;
+        }
+        break;
+    case 2:
+        /* Nearly every byte changed, the output is larger than the page */
+        for (i = 0; i < XBZRLE_PAGE_SIZE; i++) {
+            new_buf[i] = g_test_rand_int_range(0, 256);
+        }
+        break;
+    }
+
+    /* A tail that is a multiple of sizeof(long) but not of 64 bytes */
+    if (n & 1) {
+        slen -= 8 * g_test_rand_int_range(1, 8);
+    }
+
+    encode_compare(old_buf, new_buf, slen, slen);
+    /* Far below the output size of runs and full pages, above sparse ones */
+    encode_compare(old_buf, new_buf, slen, slen / 4);
+
+    g_free(old_buf);
+    g_free(new_buf);
+}
+
+static void test_encode_accel(void)
+{
+    int i;
+
+    for (i = 0; i < 10000; i++) {
+        encode_accel(i);
+    }
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -185,6 +314,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_decode_runs", test_encode_decode_runs);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
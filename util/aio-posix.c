@@ -97,13 +97,18 @@ static bool aio_remove_fd_handler(AioContext *ctx, AioHandler *node)
     return true;
 }
 
-void aio_set_fd_handler(AioContext *ctx,
-                        int fd,
-                        IOHandler *io_read,
-                        IOHandler *io_write,
-                        AioPollFn *io_poll,
-                        IOHandler *io_poll_ready,
-                        void *opaque)
+/*
+ * @drains_fd: @io_read always empties the fd, so that the fd monitoring
+ * implementation need not report it again until new data arrives
+ */
+static void aio_set_fd_handler_full(AioContext *ctx,
+                                    int fd,
+                                    IOHandler *io_read,
+                                    IOHandler *io_write,
+                                    AioPollFn *io_poll,
+                                    IOHandler *io_poll_ready,
+                                    void *opaque,
+                                    bool drains_fd)
 {
     AioHandler *node;
     AioHandler *new_node = NULL;
@@ -143,13 +148,17 @@ void aio_set_fd_handler(AioContext *ctx,
         new_node->io_poll = io_poll;
         new_node->io_poll_ready = io_poll_ready;
         new_node->opaque = opaque;
+        new_node->drains_fd = drains_fd;
 
         if (is_new) {
             new_node->pfd.fd = fd;
         } else {
             new_node->pfd = node->pfd;
         }
-        g_source_add_poll(&ctx->source, &new_node->pfd);
+        /* Otherwise the fd monitoring implementation polls for glib */
+        if (!ctx->fdmon_ops->gsource_prepare) {
+            g_source_add_poll(&ctx->source, &new_node->pfd);
+        }
 
         new_node->pfd.events = (io_read ? G_IO_IN | G_IO_HUP | G_IO_ERR : 0);
         new_node->pfd.events |= (io_write ? G_IO_OUT | G_IO_ERR : 0);
@@ -178,6 +187,18 @@ void aio_set_fd_handler(AioContext *ctx,
     }
 }
 
+void aio_set_fd_handler(AioContext *ctx,
+                        int fd,
+                        IOHandler *io_read,
+                        IOHandler *io_write,
+                        AioPollFn *io_poll,
+                        IOHandler *io_poll_ready,
+                        void *opaque)
+{
+    aio_set_fd_handler_full(ctx, fd, io_read, io_write, io_poll,
+                            io_poll_ready, opaque, false);
+}
+
 static void aio_set_fd_poll(AioContext *ctx, int fd,
                             IOHandler *io_poll_begin,
                             IOHandler *io_poll_end)
@@ -198,9 +219,10 @@ void aio_set_event_notifier(AioContext *ctx,
                             AioPollFn *io_poll,
                             EventNotifierHandler *io_poll_ready)
 {
-    aio_set_fd_handler(ctx, event_notifier_get_fd(notifier),
-                       (IOHandler *)io_read, NULL, io_poll,
-                       (IOHandler *)io_poll_ready, notifier);
+    /* Event notifier handlers clear the whole counter of the eventfd */
+    aio_set_fd_handler_full(ctx, event_notifier_get_fd(notifier),
+                            (IOHandler *)io_read, NULL, io_poll,
+                            (IOHandler *)io_poll_ready, notifier, true);
 }
 
 void aio_set_event_notifier_poll(AioContext *ctx,
@@ -263,6 +285,12 @@ bool aio_prepare(AioContext *ctx)
     poll_set_started(ctx, &ready_list, false);
     /* TODO what to do with this list? */
 
+    if (ctx->fdmon_ops->gsource_prepare) {
+        qemu_lockcnt_inc(&ctx->list_lock);
+        ctx->fdmon_ops->gsource_prepare(ctx);
+        qemu_lockcnt_dec(&ctx->list_lock);
+    }
+
     return false;
 }
 
@@ -293,6 +321,10 @@ bool aio_pending(AioContext *ctx)
     }
     qemu_lockcnt_dec(&ctx->list_lock);
 
+    if (!result && ctx->fdmon_ops->gsource_check) {
+        result = ctx->fdmon_ops->gsource_check(ctx);
+    }
+
     return result;
 }
 
@@ -404,6 +436,34 @@ static bool aio_dispatch_ready_handlers(AioContext *ctx,
     return progress;
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+bool aio_has_io_uring(AioContext *ctx)
+{
+    return ctx->fdmon_ops->add_sqe;
+}
+
+void aio_add_sqe(AioContext *ctx, const struct io_uring_sqe *sqe,
+                 CqeHandler *cqe_handler)
+{
+    assert(ctx == qemu_get_current_aio_context());
+    assert(aio_has_io_uring(ctx));
+    ctx->fdmon_ops->add_sqe(ctx, sqe, cqe_handler);
+}
+
+static bool aio_dispatch_cqe_handlers(AioContext *ctx)
+{
+    if (!ctx->fdmon_ops->dispatch) {
+        return false;
+    }
+    return ctx->fdmon_ops->dispatch(ctx);
+}
+#else
+static bool aio_dispatch_cqe_handlers(AioContext *ctx)
+{
+    return false;
+}
+#endif
+
 /* Slower than aio_dispatch_ready_handlers() but only used via glib */
 static bool aio_dispatch_handlers(AioContext *ctx)
 {
@@ -419,8 +479,15 @@ static bool aio_dispatch_handlers(AioContext *ctx)
 
 void aio_dispatch(AioContext *ctx)
 {
+    AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
+
     qemu_lockcnt_inc(&ctx->list_lock);
     aio_bh_poll(ctx);
+    if (ctx->fdmon_ops->gsource_dispatch) {
+        ctx->fdmon_ops->gsource_dispatch(ctx, &ready_list);
+        aio_dispatch_ready_handlers(ctx, &ready_list);
+        aio_dispatch_cqe_handlers(ctx);
+    }
     aio_dispatch_handlers(ctx);
     aio_free_deleted_handlers(ctx);
     qemu_lockcnt_dec(&ctx->list_lock);
@@ -721,6 +788,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     progress |= aio_bh_poll(ctx);
     progress |= aio_dispatch_ready_handlers(ctx, &ready_list);
+    progress |= aio_dispatch_cqe_handlers(ctx);
 
     aio_free_deleted_handlers(ctx);
 
@@ -754,13 +822,12 @@ void aio_context_destroy(AioContext *ctx)
 void aio_context_use_g_source(AioContext *ctx)
 {
     /*
-     * Disable io_uring when the glib main loop is used because it doesn't
-     * support mixed glib/aio_poll() usage. It relies on aio_poll() being
-     * called regularly so that changes to the monitored file descriptors are
-     * submitted, otherwise a list of pending fd handlers builds up.
+     * Nothing to do.  The fd monitoring implementation stays in use, because
+     * aio_prepare() and aio_dispatch() submit changes to the monitored file
+     * descriptors and reap events when glib runs the AioContext instead of
+     * aio_poll().  Mixed glib/aio_poll() usage is fine as both run in the
+     * AioContext's home thread.
      */
-    fdmon_io_uring_destroy(ctx);
-    aio_free_deleted_handlers(ctx);
 }
 
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
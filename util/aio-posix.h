@@ -38,6 +38,7 @@ struct AioHandler {
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
     bool poll_ready; /* has polling detected an event? */
+    bool drains_fd; /* io_read empties the fd, edge triggering is enough */
 };
 
 /* Add a handler to a ready list */
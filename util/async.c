@@ -30,6 +30,7 @@
 #include "block/graph-lock.h"
 #include "qemu/main-loop.h"
 #include "qemu/atomic.h"
+#include "qemu/bitmap.h"
 #include "qemu/rcu_queue.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine_int.h"
@@ -367,6 +368,7 @@ aio_ctx_finalize(GSource     *source)
     unsigned flags;
 
     thread_pool_free(ctx->thread_pool);
+    g_free(ctx->thread_pool_cpus);
 
 #ifdef CONFIG_LINUX_AIO
     if (ctx->linux_aio) {
@@ -466,7 +468,7 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx, ctx->io_uring_sqpoll_cpu, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -612,9 +614,12 @@ AioContext *aio_context_new(Error **errp)
     ctx->poll_shrink = 0;
 
     ctx->aio_max_batch = 0;
+    ctx->io_uring_sqpoll_cpu = -1;
 
     ctx->thread_pool_min = 0;
     ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    ctx->thread_pool_cpus = NULL;
+    ctx->thread_pool_cpus_nbits = 0;
 
     register_aiocontext(ctx);
 
@@ -740,6 +745,17 @@ void qemu_set_current_aio_context(AioContext *ctx)
     set_my_aiocontext(ctx);
 }
 
+void aio_context_set_io_uring_params(AioContext *ctx, int64_t sqpoll_cpu,
+                                     Error **errp)
+{
+    if (sqpoll_cpu < -1 || sqpoll_cpu > INT_MAX) {
+        error_setg(errp, "bad io-uring-sqpoll-cpu value");
+        return;
+    }
+
+    ctx->io_uring_sqpoll_cpu = sqpoll_cpu;
+}
+
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp)
 {
@@ -756,3 +772,22 @@ void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
         thread_pool_update_params(ctx->thread_pool, ctx);
     }
 }
+
+void aio_context_set_thread_pool_affinity(AioContext *ctx,
+                                          const unsigned long *host_cpus,
+                                          unsigned long nbits)
+{
+    g_free(ctx->thread_pool_cpus);
+    ctx->thread_pool_cpus = NULL;
+    ctx->thread_pool_cpus_nbits = 0;
+
+    if (host_cpus && nbits) {
+        ctx->thread_pool_cpus = bitmap_new(nbits);
+        bitmap_copy(ctx->thread_pool_cpus, host_cpus, nbits);
+        ctx->thread_pool_cpus_nbits = nbits;
+    }
+
+    if (ctx->thread_pool) {
+        thread_pool_update_params(ctx->thread_pool, ctx);
+    }
+}
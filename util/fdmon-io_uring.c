@@ -19,13 +19,17 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Other users can submit their own requests on the same ring with
+ * aio_add_sqe(), so that e.g. block I/O completions and file descriptor
+ * events are reaped by a single io_uring_enter(2) call.  Their user_data is
+ * the CqeHandler tagged with FDMON_IO_URING_CQE_HANDLER, while poll requests
+ * use the untagged AioHandler.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
- * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.  Where the
+ *    kernel supports it, the poll is multishot and stays armed after
+ *    completions; otherwise it has to be re-armed after each completion.
  * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
  *    the poll mask changes for a file descriptor it is first removed and then
  *    re-added with the new poll mask, so this operation is also used as part
@@ -38,13 +42,27 @@
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
  * The code is structured so that sq/cq rings are only modified within
- * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
- * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
- * and/or IORING_OP_POLL_REMOVE sqes for them.
+ * fdmon_io_uring_wait() and fdmon_io_uring_add_sqe(), which both run in the
+ * AioContext's home thread.  Changes to AioHandlers are made by enqueuing them
+ * on ctx->submit_list so that fdmon_io_uring_wait() can submit
+ * IORING_OP_POLL_ADD and/or IORING_OP_POLL_REMOVE sqes for them.
+ *
+ * When the glib main loop runs the AioContext, the ring fd is polled by glib
+ * instead of the AioHandlers' fds.  fdmon_io_uring_gsource_prepare() submits
+ * pending sqes and fdmon_io_uring_gsource_dispatch() reaps the cq ring, so
+ * aio_poll() and glib can be mixed freely in the home thread.
+ *
+ * The ring is set up with IORING_SETUP_SINGLE_ISSUER and
+ * IORING_SETUP_COOP_TASKRUN if the kernel supports them.  Because the ring is
+ * created by whichever thread creates the AioContext, it starts disabled and
+ * is enabled (and its fd registered) by the home thread on first use.  The
+ * main loop's AioContext is run by whichever thread holds the BQL, so its ring
+ * cannot have a single issuer.
  */
 
 #include "qemu/osdep.h"
 #include <poll.h>
+#include "qemu/main-loop.h"
 #include "qemu/rcu_queue.h"
 #include "aio-posix.h"
 
@@ -55,6 +73,21 @@ enum {
     FDMON_IO_URING_PENDING  = (1 << 0),
     FDMON_IO_URING_ADD      = (1 << 1),
     FDMON_IO_URING_REMOVE   = (1 << 2),
+
+    /* Tag in the user_data of requests added with aio_add_sqe() */
+    FDMON_IO_URING_CQE_HANDLER = (1 << 0),
+};
+
+/* Ring setup flags to try, from the most to the least desirable */
+static const unsigned fdmon_io_uring_setup_flags[] = {
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(IORING_SETUP_R_DISABLED)
+    IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG |
+    IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_R_DISABLED,
+#endif
+#ifdef IORING_SETUP_COOP_TASKRUN
+    IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG,
+#endif
+    0,
 };
 
 static inline int poll_events_from_pfd(int pfd_events)
@@ -73,9 +106,38 @@ static inline int pfd_events_from_poll(int poll_events)
            (poll_events & POLLERR ? G_IO_ERR : 0);
 }
 
+/*
+ * Enable a ring that was set up with IORING_SETUP_R_DISABLED, which makes the
+ * calling thread its single issuer.  Must be called in the home thread before
+ * the first submission.
+ */
+static void enable_ring(AioContext *ctx)
+{
+#ifdef IORING_SETUP_R_DISABLED
+    struct io_uring *ring = &ctx->fdmon_io_uring;
+    int ret;
+
+    if (likely(!ctx->fdmon_io_uring_disabled)) {
+        return;
+    }
+
+    ret = io_uring_enable_rings(ring);
+    assert(ret == 0);
+    ctx->fdmon_io_uring_disabled = false;
+
+#ifdef HAVE_IO_URING_REGISTER_RING_FD
+    /*
+     * Registered ring fds are per thread, so this has to happen here too.  It
+     * saves the fd lookup in each io_uring_enter(2); failure is harmless.
+     */
+    io_uring_register_ring_fd(ring);
+#endif
+#endif
+}
+
 /*
  * Returns an sqe for submitting a request.  Only be called within
- * fdmon_io_uring_wait().
+ * fdmon_io_uring_wait() or fdmon_io_uring_add_sqe().
  */
 static struct io_uring_sqe *get_sqe(AioContext *ctx)
 {
@@ -88,6 +150,7 @@ static struct io_uring_sqe *get_sqe(AioContext *ctx)
     }
 
     /* No free sqes left, submit pending sqes first */
+    enable_ring(ctx);
     do {
         ret = io_uring_submit(ring);
     } while (ret == -EINTR);
@@ -171,7 +234,21 @@ static void add_poll_add_sqe(AioContext *ctx, AioHandler *node)
     struct io_uring_sqe *sqe = get_sqe(ctx);
     int events = poll_events_from_pfd(node->pfd.events);
 
+#ifdef IORING_POLL_ADD_MULTI
+    /*
+     * A multishot poll posts a cqe when the fd becomes ready, but does not
+     * report it again if the handler left data behind.  Handlers expect
+     * level-triggered polling, so only use it for those that drain the fd;
+     * one-shot polls are re-armed after each cqe and see leftover data.
+     */
+    if (ctx->fdmon_io_uring_multishot && node->drains_fd) {
+        io_uring_prep_poll_multishot(sqe, node->pfd.fd, events);
+    } else {
+        io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+    }
+#else
     io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+#endif
     io_uring_sqe_set_data(sqe, node);
 }
 
@@ -221,34 +298,86 @@ static void fill_sq_ring(AioContext *ctx)
     }
 }
 
+static void fdmon_io_uring_add_sqe(AioContext *ctx,
+                                   const struct io_uring_sqe *sqe,
+                                   CqeHandler *cqe_handler)
+{
+    struct io_uring_sqe *new_sqe = get_sqe(ctx);
+
+    *new_sqe = *sqe;
+    io_uring_sqe_set_data(new_sqe, (void *)((uintptr_t)cqe_handler |
+                                            FDMON_IO_URING_CQE_HANDLER));
+}
+
 /* Returns true if a handler became ready */
 static bool process_cqe(AioContext *ctx,
                         AioHandlerList *ready_list,
                         struct io_uring_cqe *cqe)
 {
-    AioHandler *node = io_uring_cqe_get_data(cqe);
+    uintptr_t data = (uintptr_t)io_uring_cqe_get_data(cqe);
+    AioHandler *node;
     unsigned flags;
+    bool more = false;
 
     /* poll_timeout and poll_remove have a zero user_data field */
-    if (!node) {
+    if (!data) {
         return false;
     }
 
+    if (data & FDMON_IO_URING_CQE_HANDLER) {
+        CqeHandler *cqe_handler =
+            (CqeHandler *)(data & ~(uintptr_t)FDMON_IO_URING_CQE_HANDLER);
+
+        cqe_handler->res = cqe->res;
+        cqe_handler->flags = cqe->flags;
+        QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+        return true;
+    }
+
+    node = (AioHandler *)data;
+#ifdef IORING_CQE_F_MORE
+    more = cqe->flags & IORING_CQE_F_MORE;
+#endif
+
+    if (more) {
+        /* The handler is being deleted, wait for the final cqe */
+        if (qatomic_read(&node->flags) & FDMON_IO_URING_REMOVE) {
+            return false;
+        }
+    } else {
+        /*
+         * Deletion can only happen when IORING_OP_POLL_ADD completes for the
+         * last time.  If we race with enqueue() here then we can safely clear
+         * the FDMON_IO_URING_REMOVE bit before IORING_OP_POLL_REMOVE is
+         * submitted.
+         */
+        flags = qatomic_fetch_and(&node->flags, ~FDMON_IO_URING_REMOVE);
+        if (flags & FDMON_IO_URING_REMOVE) {
+            QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                  node_deleted);
+            return false;
+        }
+    }
+
     /*
-     * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
-     * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
-     * bit before IORING_OP_POLL_REMOVE is submitted.
+     * One-shot polls, and multishot polls that the kernel terminated (e.g.
+     * on cq ring overflow), must be re-armed
      */
-    flags = qatomic_fetch_and(&node->flags, ~FDMON_IO_URING_REMOVE);
-    if (flags & FDMON_IO_URING_REMOVE) {
-        QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node, node_deleted);
-        return false;
+    if (!more) {
+        add_poll_add_sqe(ctx, node);
     }
 
-    aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
-
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
-    add_poll_add_sqe(ctx, node);
+    /*
+     * A negative res is an errno, not a poll mask.  -ECANCELED only means
+     * that the kernel dropped the poll, anything else is reported to the
+     * handler like poll(2) reports an error on the fd.
+     */
+    if (cqe->res == -ECANCELED) {
+        return false;
+    }
+    aio_add_ready_handler(ready_list, node,
+                          cqe->res < 0 ? G_IO_ERR :
+                          pfd_events_from_poll(cqe->res));
     return true;
 }
 
@@ -285,6 +414,7 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     }
 
     fill_sq_ring(ctx);
+    enable_ring(ctx);
 
     do {
         ret = io_uring_submit_and_wait(&ctx->fdmon_io_uring, wait_nr);
@@ -302,6 +432,17 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
         return true;
     }
 
+#ifdef IORING_SQ_TASKRUN
+    /*
+     * With IORING_SETUP_COOP_TASKRUN, completions can wait for the next
+     * io_uring_enter(2) before they appear in the cq ring.  Userspace polling
+     * would not see them otherwise.
+     */
+    if (qatomic_read(ctx->fdmon_io_uring.sq.kflags) & IORING_SQ_TASKRUN) {
+        return true;
+    }
+#endif
+
     /* Are there pending sqes to submit? */
     if (io_uring_sq_ready(&ctx->fdmon_io_uring)) {
         return true;
@@ -315,23 +456,96 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
     return false;
 }
 
+static void fdmon_io_uring_gsource_prepare(AioContext *ctx)
+{
+    fill_sq_ring(ctx);
+    if (io_uring_sq_ready(&ctx->fdmon_io_uring)) {
+        enable_ring(ctx);
+        while (io_uring_submit(&ctx->fdmon_io_uring) == -EINTR) {
+            /* Keep trying if syscall was interrupted */
+        }
+    }
+}
+
+static void fdmon_io_uring_gsource_dispatch(AioContext *ctx,
+                                            AioHandlerList *ready_list)
+{
+    /* glib already waited, just submit leftovers and reap the cq ring */
+    fdmon_io_uring_wait(ctx, ready_list, 0);
+}
+
+static bool fdmon_io_uring_dispatch(AioContext *ctx)
+{
+    CqeHandler *cqe_handler;
+    bool progress = false;
+
+    /* Handlers may run a nested aio_poll(), which dispatches the rest */
+    while ((cqe_handler = QSIMPLEQ_FIRST(&ctx->cqe_handler_ready_list))) {
+        QSIMPLEQ_REMOVE_HEAD(&ctx->cqe_handler_ready_list, next);
+        cqe_handler->cb(cqe_handler);
+        progress = true;
+    }
+
+    return progress;
+}
+
 static const FDMonOps fdmon_io_uring_ops = {
     .update = fdmon_io_uring_update,
     .wait = fdmon_io_uring_wait,
     .need_wait = fdmon_io_uring_need_wait,
+    .gsource_prepare = fdmon_io_uring_gsource_prepare,
+    .gsource_check = fdmon_io_uring_need_wait,
+    .gsource_dispatch = fdmon_io_uring_gsource_dispatch,
+    .add_sqe = fdmon_io_uring_add_sqe,
+    .dispatch = fdmon_io_uring_dispatch,
 };
 
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
-    int ret;
+    struct io_uring_params params;
+    int ret = -EINVAL;
+    size_t i;
 
-    ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, &ctx->fdmon_io_uring, 0);
+    /*
+     * The main loop's AioContext is the first one to be created.  Any thread
+     * holding the BQL may run aio_poll() on it, so it gets none of the setup
+     * flags: task work for a request runs in the thread that submitted it,
+     * and IORING_SETUP_COOP_TASKRUN would let it wait until e.g. a vCPU thread
+     * next enters the kernel.
+     */
+    bool home_thread_only = qemu_get_aio_context() != NULL;
+
+    /* Older kernels reject setup flags that they don't know */
+    for (i = 0; i < ARRAY_SIZE(fdmon_io_uring_setup_flags); i++) {
+        if (fdmon_io_uring_setup_flags[i] && !home_thread_only) {
+            continue;
+        }
+        params = (struct io_uring_params) {
+            .flags = fdmon_io_uring_setup_flags[i],
+        };
+        ret = io_uring_queue_init_params(FDMON_IO_URING_ENTRIES,
+                                         &ctx->fdmon_io_uring, &params);
+        if (ret != -EINVAL) {
+            break;
+        }
+    }
     if (ret != 0) {
         return false;
     }
 
+#ifdef IORING_SETUP_R_DISABLED
+    ctx->fdmon_io_uring_disabled = params.flags & IORING_SETUP_R_DISABLED;
+#endif
+#ifdef IORING_FEAT_RSRC_TAGS
+    /* Multishot poll came with Linux 5.13, like IORING_FEAT_RSRC_TAGS */
+    ctx->fdmon_io_uring_multishot = params.features & IORING_FEAT_RSRC_TAGS;
+#endif
+
     QSLIST_INIT(&ctx->submit_list);
+    QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
+    ctx->io_uring_fd_tag = g_source_add_unix_fd(&ctx->source,
+            ctx->fdmon_io_uring.ring_fd, G_IO_IN);
     return true;
 }
 
@@ -340,6 +554,13 @@ void fdmon_io_uring_destroy(AioContext *ctx)
     if (ctx->fdmon_ops == &fdmon_io_uring_ops) {
         AioHandler *node;
 
+        /* Requests added with aio_add_sqe() must have completed */
+        assert(QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list));
+
+        /* glib cleans up a GSource that is being destroyed by itself */
+        if (!g_source_is_destroyed(&ctx->source)) {
+            g_source_remove_unix_fd(&ctx->source, ctx->io_uring_fd_tag);
+        }
         io_uring_queue_exit(&ctx->fdmon_io_uring);
 
         /* Move handlers due to be removed onto the deleted list */
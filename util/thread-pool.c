@@ -15,6 +15,7 @@
  * GNU GPL, version 2 or (at your option) any later version.
  */
 #include "qemu/osdep.h"
+#include "qemu/bitmap.h"
 #include "qemu/defer-call.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
@@ -26,6 +27,7 @@
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolQueue ThreadPoolQueue;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -36,98 +38,360 @@ enum ThreadState {
 struct ThreadPoolElement {
     BlockAIOCB common;
     ThreadPool *pool;
+    ThreadPoolQueue *queue;
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is protected by queue->lock.  After
+     * that, only the worker thread can write to it.  state and ret are
+     * published to the completion bottom half through pool->done_list.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Access to this list is protected by queue->lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
-    /* This list is only written by the thread pool's mother thread.  */
+    /* Lock-free list of completed requests, see thread_pool_complete().  */
+    QSLIST_ENTRY(ThreadPoolElement) done;
+
+    /* These lists are only written by the thread pool's mother thread.  */
+    QSIMPLEQ_ENTRY(ThreadPoolElement) completed;
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+/*
+ * Requests are spread over a fixed number of queues, each with its own lock,
+ * so that submitting and dequeuing requests does not serialize on a single
+ * mutex.  Every worker is homed on one queue and steals requests from the
+ * other queues when its own is empty.
+ */
+#define THREAD_POOL_QUEUES 16
+
+struct ThreadPoolQueue {
+    QemuMutex lock;
+    QemuCond request_cond;
+
+    /* The following variables are protected by lock.  */
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    int pending_wakeups; /* idle workers that were already signalled */
+
+    /* Written under lock, read locklessly to pick queues to submit to or
+     * to steal from.
+     */
+    int nr_requests;
+    int idle_threads;
+
+    /* Written under the pool lock, read locklessly on submission.  */
+    int nr_threads;
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuCond request_cond;
     QEMUBH *new_thread_bh;
 
+    ThreadPoolQueue queues[THREAD_POOL_QUEUES];
+
+    /* Completed requests, pushed by the workers without taking a lock.  */
+    QSLIST_HEAD(, ThreadPoolElement) done_list;
+
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) completed;
+    int next_queue;
 
-    /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    /* The following variables are protected by lock.  cur_threads and
+     * max_threads are also read locklessly by the workers and on submission.
+     */
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     int min_threads;
     int max_threads;
+    unsigned long *cpus; /* host CPUs the workers run on, NULL for any */
+    unsigned long cpus_nbits;
+    /* affinity of the AioContext's thread, restored when cpus is cleared */
+    unsigned long *home_cpus;
+    unsigned long home_cpus_nbits;
+    unsigned int affinity_gen; /* bumped when cpus changes */
 };
 
-static void *worker_thread(void *opaque)
+static bool thread_pool_worker_can_run(ThreadPool *pool)
 {
-    ThreadPool *pool = opaque;
+    return qatomic_read(&pool->cur_threads) <=
+           qatomic_read(&pool->max_threads);
+}
 
-    qemu_mutex_lock(&pool->lock);
-    pool->pending_threads--;
-    do_spawn_thread(pool);
+static bool thread_pool_has_requests(ThreadPool *pool)
+{
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        if (qatomic_read(&pool->queues[i].nr_requests)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    while (pool->cur_threads <= pool->max_threads) {
-        ThreadPoolElement *req;
-        int ret;
-
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
-            ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
-            if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
-                pool->cur_threads > pool->min_threads) {
-                /* Timed out + no work to do + no need for warm threads = exit.  */
-                break;
-            }
-            /*
-             * Even if there was some work to do, check if there aren't
-             * too many worker threads before picking it up.
-             */
+/*
+ * Wake up an idle worker, preferring one homed on @q.  Returns false if all
+ * idle workers have already been signalled.
+ *
+ * The caller must order the enqueueing of the request before this function
+ * with a full memory barrier, which pairs with the one in
+ * thread_pool_worker_wait().
+ */
+static bool thread_pool_kick(ThreadPool *pool, ThreadPoolQueue *q)
+{
+    int start = q - pool->queues;
+
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        ThreadPoolQueue *w = &pool->queues[(start + i) % THREAD_POOL_QUEUES];
+        bool kicked = false;
+
+        if (!qatomic_read(&w->idle_threads)) {
             continue;
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
+        qemu_mutex_lock(&w->lock);
+        if (w->idle_threads > w->pending_wakeups) {
+            w->pending_wakeups++;
+            qemu_cond_signal(&w->request_cond);
+            kicked = true;
+        }
+        qemu_mutex_unlock(&w->lock);
+
+        if (kicked) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Runs with lock taken.  */
+static void thread_pool_wake_all(ThreadPool *pool)
+{
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        ThreadPoolQueue *q = &pool->queues[i];
+
+        qemu_mutex_lock(&q->lock);
+        qemu_cond_broadcast(&q->request_cond);
+        qemu_mutex_unlock(&q->lock);
+    }
+}
+
+static ThreadPoolElement *thread_pool_dequeue(ThreadPoolQueue *q)
+{
+    ThreadPoolElement *req;
+
+    if (!qatomic_read(&q->nr_requests)) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&q->lock);
+    req = QTAILQ_FIRST(&q->request_list);
+    if (req) {
+        QTAILQ_REMOVE(&q->request_list, req, reqs);
+        qatomic_set(&q->nr_requests, q->nr_requests - 1);
         req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
+    }
+    qemu_mutex_unlock(&q->lock);
+    return req;
+}
+
+/*
+ * Take the oldest request of the worker's home queue or, if there is none,
+ * steal one from the other queues.
+ */
+static ThreadPoolElement *thread_pool_next_request(ThreadPool *pool,
+                                                   ThreadPoolQueue *home)
+{
+    int start = home - pool->queues;
+
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        ThreadPoolQueue *q = &pool->queues[(start + i) % THREAD_POOL_QUEUES];
+        ThreadPoolElement *req = thread_pool_dequeue(q);
+
+        if (req) {
+            if (q != home) {
+                trace_thread_pool_steal(pool, req, q - pool->queues, start);
+            }
+            return req;
+        }
+    }
+    return NULL;
+}
 
-        ret = req->func(req->arg);
+/*
+ * Hand a finished request over to the completion bottom half.  Only the
+ * thread that makes done_list non-empty schedules the bottom half, so a
+ * burst of completions costs a single wakeup of the AioContext.
+ */
+static void thread_pool_complete(ThreadPool *pool, ThreadPoolElement *req)
+{
+    ThreadPoolElement *first;
 
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
+    /* The cmpxchg orders the writes to ret and state before req is visible */
+    do {
+        first = qatomic_read(&pool->done_list.slh_first);
+        req->done.sle_next = first;
+    } while (qatomic_cmpxchg(&pool->done_list.slh_first, first, req) != first);
 
+    if (!first) {
         qemu_bh_schedule(pool->completion_bh);
-        qemu_mutex_lock(&pool->lock);
+    }
+}
+
+/*
+ * Sleep until a request is submitted or the pool is resized.  Returns true
+ * if the wait timed out.
+ */
+static bool thread_pool_worker_wait(ThreadPool *pool, ThreadPoolQueue *home)
+{
+    bool timed_out = false;
+
+    qemu_mutex_lock(&home->lock);
+    qatomic_set(&home->idle_threads, home->idle_threads + 1);
+
+    /*
+     * Write idle_threads before reading nr_requests, pairs with the
+     * barrier in thread_pool_submit_aio().
+     */
+    smp_mb();
+
+    if (!thread_pool_has_requests(pool) && thread_pool_worker_can_run(pool)) {
+        timed_out = !qemu_cond_timedwait(&home->request_cond, &home->lock,
+                                         10000);
+    }
+
+    if (home->pending_wakeups) {
+        home->pending_wakeups--;
+    }
+    qatomic_set(&home->idle_threads, home->idle_threads - 1);
+    qemu_mutex_unlock(&home->lock);
+    return timed_out;
+}
+
+/*
+ * Check under the lock whether the worker should exit, because there are
+ * too many worker threads or because it timed out and there is no need for
+ * warm threads.
+ */
+static bool thread_pool_worker_retire(ThreadPool *pool, ThreadPoolQueue *home,
+                                      bool timed_out)
+{
+    QEMU_LOCK_GUARD(&pool->lock);
+
+    if (pool->cur_threads <= pool->max_threads &&
+        !(timed_out && pool->cur_threads > pool->min_threads)) {
+        return false;
     }
 
-    pool->cur_threads--;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - 1);
+    qatomic_set(&home->nr_threads, home->nr_threads - 1);
     qemu_cond_signal(&pool->worker_stopped);
 
     /*
      * Wake up another thread, in case we got a wakeup but decided
      * to exit due to pool->cur_threads > pool->max_threads.
      */
-    qemu_cond_signal(&pool->request_cond);
+    if (thread_pool_has_requests(pool)) {
+        thread_pool_kick(pool, home);
+    }
+    return true;
+}
+
+/* Runs with lock taken.  */
+static ThreadPoolQueue *thread_pool_pick_home(ThreadPool *pool)
+{
+    ThreadPoolQueue *home = &pool->queues[0];
+
+    for (int i = 1; i < THREAD_POOL_QUEUES; i++) {
+        if (pool->queues[i].nr_threads < home->nr_threads) {
+            home = &pool->queues[i];
+        }
+    }
+
+    qatomic_set(&home->nr_threads, home->nr_threads + 1);
+    return home;
+}
+
+/* Runs with lock taken.  */
+static void thread_pool_set_affinity(ThreadPool *pool, QemuThread *thread)
+{
+    int ret;
+
+    /*
+     * Without a mask, undo any earlier pinning; a worker may also have
+     * inherited it from the pinned worker that spawned it.
+     */
+    if (pool->cpus) {
+        ret = qemu_thread_set_affinity(thread, pool->cpus, pool->cpus_nbits);
+    } else if (pool->home_cpus) {
+        ret = qemu_thread_set_affinity(thread, pool->home_cpus,
+                                       pool->home_cpus_nbits);
+    } else {
+        return;
+    }
+    if (ret) {
+        trace_thread_pool_set_affinity_failed(pool, ret);
+    }
+}
+
+static void *worker_thread(void *opaque)
+{
+    ThreadPool *pool = opaque;
+    ThreadPoolQueue *home;
+    QemuThread self;
+    unsigned int affinity_gen;
+
+    qemu_thread_get_self(&self);
+
+    qemu_mutex_lock(&pool->lock);
+    pool->pending_threads--;
+    home = thread_pool_pick_home(pool);
+    affinity_gen = pool->affinity_gen;
+    thread_pool_set_affinity(pool, &self);
+    do_spawn_thread(pool);
     qemu_mutex_unlock(&pool->lock);
+
+    for (;;) {
+        ThreadPoolElement *req;
+        bool timed_out = false;
+
+        if (qatomic_read(&pool->affinity_gen) != affinity_gen) {
+            qemu_mutex_lock(&pool->lock);
+            affinity_gen = pool->affinity_gen;
+            thread_pool_set_affinity(pool, &self);
+            qemu_mutex_unlock(&pool->lock);
+        }
+
+        /*
+         * Even if there is some work to do, check if there aren't
+         * too many worker threads before picking it up.
+         */
+        if (thread_pool_worker_can_run(pool)) {
+            req = thread_pool_next_request(pool, home);
+            if (req) {
+                req->ret = req->func(req->arg);
+                req->state = THREAD_DONE;
+                thread_pool_complete(pool, req);
+                continue;
+            }
+
+            timed_out = thread_pool_worker_wait(pool, home);
+            if (!timed_out || thread_pool_has_requests(pool)) {
+                continue;
+            }
+        }
+
+        if (thread_pool_worker_retire(pool, home, timed_out)) {
+            break;
+        }
+    }
+
     return NULL;
 }
 
@@ -151,13 +415,27 @@ static void spawn_thread_bh_fn(void *opaque)
     ThreadPool *pool = opaque;
 
     qemu_mutex_lock(&pool->lock);
+    /*
+     * This runs before any worker exists, so that unpinned workers can be
+     * given back the affinity they would have had without pinning.
+     */
+    if (!pool->home_cpus) {
+        QemuThread self;
+
+        qemu_thread_get_self(&self);
+        if (qemu_thread_get_affinity(&self, &pool->home_cpus,
+                                     &pool->home_cpus_nbits)) {
+            pool->home_cpus = NULL;
+            pool->home_cpus_nbits = 0;
+        }
+    }
     do_spawn_thread(pool);
     qemu_mutex_unlock(&pool->lock);
 }
 
 static void spawn_thread(ThreadPool *pool)
 {
-    pool->cur_threads++;
+    qatomic_set(&pool->cur_threads, pool->cur_threads + 1);
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
      * we don't spend time creating many threads in a loop holding a mutex or
@@ -171,27 +449,37 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
+/* Move the requests completed by the workers to pool->completed, in order */
+static void thread_pool_collect_done(ThreadPool *pool)
+{
+    QSLIST_HEAD(, ThreadPoolElement) list;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) batch = QSIMPLEQ_HEAD_INITIALIZER(batch);
+    ThreadPoolElement *elem;
+
+    QSLIST_MOVE_ATOMIC(&list, &pool->done_list);
+    while ((elem = QSLIST_FIRST(&list))) {
+        QSLIST_REMOVE_HEAD(&list, done);
+        QSIMPLEQ_INSERT_HEAD(&batch, elem, completed);
+    }
+    QSIMPLEQ_CONCAT(&pool->completed, &batch);
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     defer_call_begin(); /* cb() may use defer_call() to coalesce work */
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
-        }
+    thread_pool_collect_done(pool);
+    while ((elem = QSIMPLEQ_FIRST(&pool->completed))) {
+        QSIMPLEQ_REMOVE_HEAD(&pool->completed, completed);
 
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
         QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
-            /* Read state before ret.  */
-            smp_rmb();
-
             /* Schedule ourselves in case elem->common.cb() calls aio_poll() to
              * wait for another request that completed at the same time.
              */
@@ -200,13 +488,13 @@ restart:
             elem->common.cb(elem->common.opaque, elem->ret);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we collect the
+             * requests that completed in the meantime right below.
              */
             qemu_bh_cancel(pool->completion_bh);
 
             qemu_aio_unref(elem);
-            goto restart;
+            thread_pool_collect_done(pool);
         } else {
             qemu_aio_unref(elem);
         }
@@ -218,17 +506,18 @@ restart:
 static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
-    ThreadPool *pool = elem->pool;
+    ThreadPoolQueue *q = elem->queue;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
+    QEMU_LOCK_GUARD(&q->lock);
     if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+        QTAILQ_REMOVE(&q->request_list, elem, reqs);
+        qatomic_set(&q->nr_requests, q->nr_requests - 1);
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        thread_pool_complete(elem->pool, elem);
     }
 
 }
@@ -238,33 +527,78 @@ static const AIOCBInfo thread_pool_aiocb_info = {
     .cancel_async       = thread_pool_cancel,
 };
 
+/*
+ * Prefer a queue whose worker is idle, so that the request is picked up
+ * without stealing.  Otherwise spread requests round-robin over the queues
+ * that have workers.
+ */
+static ThreadPoolQueue *thread_pool_pick_queue(ThreadPool *pool)
+{
+    ThreadPoolQueue *q = NULL;
+
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        ThreadPoolQueue *cand =
+            &pool->queues[(pool->next_queue + i) % THREAD_POOL_QUEUES];
+
+        if (qatomic_read(&cand->idle_threads)) {
+            q = cand;
+            break;
+        }
+        if (!q && qatomic_read(&cand->nr_threads)) {
+            q = cand;
+        }
+    }
+
+    if (!q) {
+        q = &pool->queues[pool->next_queue];
+    }
+    pool->next_queue = (q - pool->queues + 1) % THREAD_POOL_QUEUES;
+    return q;
+}
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
                                    BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolQueue *q;
     AioContext *ctx = qemu_get_current_aio_context();
     ThreadPool *pool = aio_get_thread_pool(ctx);
 
     /* Assert that the thread submitting work is the same running the pool */
     assert(pool->ctx == qemu_get_current_aio_context());
 
+    q = thread_pool_pick_queue(pool);
+
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->queue = q;
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    qemu_mutex_lock(&q->lock);
+    QTAILQ_INSERT_TAIL(&q->request_list, req, reqs);
+    qatomic_set(&q->nr_requests, q->nr_requests + 1);
+    qemu_mutex_unlock(&q->lock);
+
+    /*
+     * Write nr_requests before reading idle_threads, pairs with the
+     * barrier in thread_pool_worker_wait().
+     */
+    smp_mb();
+
+    if (!thread_pool_kick(pool, q) &&
+        qatomic_read(&pool->cur_threads) < qatomic_read(&pool->max_threads)) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->cur_threads < pool->max_threads) {
+            spawn_thread(pool);
+        }
+        qemu_mutex_unlock(&pool->lock);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -295,12 +629,38 @@ void thread_pool_submit(ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(func, arg, NULL, NULL);
 }
 
+static bool thread_pool_cpus_equal(ThreadPool *pool, AioContext *ctx)
+{
+    if (!pool->cpus || !ctx->thread_pool_cpus) {
+        return !pool->cpus && !ctx->thread_pool_cpus;
+    }
+    return pool->cpus_nbits == ctx->thread_pool_cpus_nbits &&
+           bitmap_equal(pool->cpus, ctx->thread_pool_cpus, pool->cpus_nbits);
+}
+
 void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
 {
     qemu_mutex_lock(&pool->lock);
 
     pool->min_threads = ctx->thread_pool_min;
-    pool->max_threads = ctx->thread_pool_max;
+    qatomic_set(&pool->max_threads, ctx->thread_pool_max);
+
+    /*
+     * Workers pick up the new CPU affinity before they run their next
+     * request.  Other parameters change more often than the mask, so
+     * leave the workers alone unless it did.
+     */
+    if (!thread_pool_cpus_equal(pool, ctx)) {
+        g_free(pool->cpus);
+        pool->cpus = NULL;
+        pool->cpus_nbits = 0;
+        if (ctx->thread_pool_cpus) {
+            pool->cpus_nbits = ctx->thread_pool_cpus_nbits;
+            pool->cpus = bitmap_new(pool->cpus_nbits);
+            bitmap_copy(pool->cpus, ctx->thread_pool_cpus, pool->cpus_nbits);
+        }
+        qatomic_set(&pool->affinity_gen, pool->affinity_gen + 1);
+    }
 
     /*
      * We either have to:
@@ -315,8 +675,8 @@ void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
         spawn_thread(pool);
     }
 
-    for (int i = pool->cur_threads; i > pool->max_threads; i--) {
-        qemu_cond_signal(&pool->request_cond);
+    if (pool->cur_threads > pool->max_threads) {
+        thread_pool_wake_all(pool);
     }
 
     qemu_mutex_unlock(&pool->lock);
@@ -333,11 +693,19 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_cond_init(&pool->request_cond);
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        ThreadPoolQueue *q = &pool->queues[i];
+
+        qemu_mutex_init(&q->lock);
+        qemu_cond_init(&q->request_cond);
+        QTAILQ_INIT(&q->request_list);
+    }
+
+    QSLIST_INIT(&pool->done_list);
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    QSIMPLEQ_INIT(&pool->completed);
 
     thread_pool_update_params(pool, ctx);
 }
@@ -361,12 +729,12 @@ void thread_pool_free(ThreadPool *pool)
 
     /* Stop new threads from spawning */
     qemu_bh_delete(pool->new_thread_bh);
-    pool->cur_threads -= pool->new_threads;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - pool->new_threads);
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->max_threads = 0;
-    qemu_cond_broadcast(&pool->request_cond);
+    qatomic_set(&pool->max_threads, 0);
+    thread_pool_wake_all(pool);
     while (pool->cur_threads > 0) {
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
@@ -374,8 +742,13 @@ void thread_pool_free(ThreadPool *pool)
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
-    qemu_cond_destroy(&pool->request_cond);
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        qemu_cond_destroy(&pool->queues[i].request_cond);
+        qemu_mutex_destroy(&pool->queues[i].lock);
+    }
     qemu_cond_destroy(&pool->worker_stopped);
+    g_free(pool->cpus);
+    g_free(pool->home_cpus);
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
 }